@@ -45,6 +45,12 @@ enum CppsshConnectStatus_t
     CPPSSH_CONNECT_ERROR
 };
 
+enum CppsshTuneMode_t
+{
+    CPPSSH_TUNE_CPUID,
+    CPPSSH_TUNE_BENCHMARK
+};
+
 class Cppssh
 {
 public:
@@ -64,6 +70,54 @@ public:
     CPPSSH_EXPORT static bool read(const int connectionId, CppsshMessage* data);
     CPPSSH_EXPORT static bool windowChange(const int connectionId, const uint32_t cols, const uint32_t rows);
     CPPSSH_EXPORT static bool close(const int connectionId);
+    // Open another session channel on the connection, with its own flow control
+    // and data queues, and a shell when term is set. channelId works like a
+    // connection id with write, read, windowChange, isConnected and close.
+    // Closing the connection id connect returned also closes its channels.
+    CPPSSH_EXPORT static bool openChannel(const int connectionId, int* channelId, const bool x11Forwarded = false, const char* term = nullptr);
+    // Run command on a new channel of the connection, without a pty or shell.
+    // read returns its stdout and readStderr its stderr. isConnected stays true
+    // until the command is done and everything it wrote has been read, then
+    // getExitStatus has the exit status, unless it was killed by a signal.
+    CPPSSH_EXPORT static bool exec(const int connectionId, int* channelId, const char* command);
+    CPPSSH_EXPORT static bool readStderr(const int channelId, CppsshMessage* data);
+    CPPSSH_EXPORT static bool getExitStatus(const int channelId, int* exitStatus);
+    // Start an SFTP session on a new channel of the connection, end it with close.
+    // Transfers run to completion and return false on any error.
+    CPPSSH_EXPORT static bool sftpOpen(const int connectionId, int* sftpId);
+    CPPSSH_EXPORT static bool sftpGet(const int sftpId, const char* remotePath, const char* localPath);
+    // A mode of 0 leaves the permissions of a new file to the server
+    CPPSSH_EXPORT static bool sftpPut(const int sftpId, const char* localPath, const char* remotePath, uint32_t mode = 0644);
+    CPPSSH_EXPORT static bool sftpMkdir(const int sftpId, const char* path, uint32_t mode = 0755);
+    CPPSSH_EXPORT static bool sftpRemove(const int sftpId, const char* path);
+    CPPSSH_EXPORT static bool sftpGetFileSize(const int sftpId, const char* path, uint64_t* size);
+    // Transfer a file or directory tree over streamsPerConnection SFTP sessions
+    // on each of the connections, all to the same host. Connections don't share
+    // a window or cipher stream, so they go further than channels on a fat pipe.
+    // Files of 8MB or more are split into ranges across the sessions, and every
+    // file's size is checked on the other end when the transfer is done.
+    CPPSSH_EXPORT static bool transferGet(const int* connectionIds, size_t connections, size_t streamsPerConnection, const char* remotePath, const char* localPath);
+    CPPSSH_EXPORT static bool transferPut(const int* connectionIds, size_t connections, size_t streamsPerConnection, const char* localPath, const char* remotePath);
+    // Same calling convention as getSupportedCiphers, filled with the MB/s of
+    // each stream of the last transfer as "stream=rate,...".
+    CPPSSH_EXPORT static size_t getTransferRates(char* rates);
+    // Copy one regular file with scp on a new exec channel, for hosts without
+    // an SFTP server. mbps, when not nullptr, gets the throughput in MB/s.
+    // As with scp, a remotePath that is a directory gets the file under its
+    // local name.
+    CPPSSH_EXPORT static bool scpPut(const int connectionId, const char* localPath, const char* remotePath, uint32_t mode = 0644, double* mbps = nullptr);
+    CPPSSH_EXPORT static bool scpGet(const int connectionId, const char* remotePath, const char* localPath, double* mbps = nullptr);
+    // Forward clients of listen:listenPort through the connection to remote:remotePort,
+    // like ssh -L, until cancelled or the connection is closed. A port of 0 makes
+    // the name a Unix socket path, an empty listen host is the loopback address.
+    CPPSSH_EXPORT static bool forwardLocal(const int connectionId, const char* listen, const short listenPort, const char* remote, const short remotePort);
+    CPPSSH_EXPORT static bool cancelForwardLocal(const int connectionId, const char* listen, const short listenPort);
+    // Have the server listen on bindAddress:bindPort and connect each client it
+    // accepts to local:localPort, like ssh -R. A bindPort of 0 lets the server
+    // pick the port, returned in boundPort, a localPort of 0 makes local a Unix
+    // socket path.
+    CPPSSH_EXPORT static bool forwardRemote(const int connectionId, const char* bindAddress, const short bindPort, const char* local, const short localPort, short* boundPort = nullptr);
+    CPPSSH_EXPORT static bool cancelForwardRemote(const int connectionId, const char* bindAddress, const short bindPort);
 
     // Set the preferred cipher/hmac, call multiple times to set the order
     // use getSupportedCipher/Hmac to get the list of possibilities
@@ -74,6 +128,67 @@ public:
     // will be filled with a coma separated list of ciphers.
     CPPSSH_EXPORT static size_t getSupportedCiphers(char* ciphers);
     CPPSSH_EXPORT static size_t getSupportedHmacs(char* hmacs);
+    // Generate the keystream of the aes*-ctr ciphers ahead of use on a helper
+    // thread, bufferSize bytes per direction (0 to disable, the default).
+    // With refillWhenIdle the buffer is only refilled when no data is flowing.
+    // Applies to connections made after the call.
+    CPPSSH_EXPORT static bool setCtrKeystreamPrefill(size_t bufferSize, bool refillWhenIdle);
+    // Encrypt and decrypt large aes*-ctr packets on a pool of threads (including
+    // the caller), splitting each packet into ranges of at least minChunkSize
+    // bytes. threads <= 1 disables it (the default). Takes precedence over the
+    // keystream prefill. Applies to connections made after the call. Packets
+    // are at most 16KB, so cppsshbenchcrypto should show a gain on the target
+    // machine before this is turned on.
+    CPPSSH_EXPORT static bool setParallelCtr(unsigned int threads, size_t minChunkSize);
+    // Reorder the cipher and hmac preference lists for this machine, either from
+    // the detected CPU features (AES-NI, SHA-NI, AVX2, NEON...) or by timing each
+    // algorithm (a few hundred milliseconds). Overrides setPreferredCipher/Hmac,
+    // the resulting order is what getSupportedCiphers/Hmacs return.
+    CPPSSH_EXPORT static bool tuneAlgorithms(CppsshTuneMode_t mode);
+    // Same calling convention as getSupportedCiphers, filled with the MB/s
+    // measured by CPPSSH_TUNE_BENCHMARK as "name=rate,...", empty otherwise.
+    CPPSSH_EXPORT static size_t getAlgorithmRates(char* rates);
+    // Generate ephemeral key exchange keys ahead of connect on a low priority
+    // thread, depth per group or curve (0 disables it, the default), refilled
+    // once lowWater or fewer are left. Without wipeAfterUse a key is reused by
+    // later connections, which gives up forward secrecy between them.
+    CPPSSH_EXPORT static bool setKexKeyPool(size_t depth, size_t lowWater, bool wipeAfterUse);
+    // Connects that found a pooled key (hits) and that generated one (misses)
+    CPPSSH_EXPORT static void getKexKeyPoolStats(uint64_t* hits, uint64_t* misses);
+    // Re-exchange keys once bytes have been sent plus received, or seconds have
+    // passed, since the last key exchange (0 disables either limit). Defaults to
+    // 1GB and one hour. Key exchanges started by the server are always answered.
+    // Applies to connections from their next key exchange.
+    CPPSSH_EXPORT static void setRekeyLimits(uint64_t bytes, uint32_t seconds);
+    // Send the first key exchange packet for our preferred kex method right
+    // behind our KEXINIT (first_kex_packet_follows), saving a round trip when
+    // the server prefers the same kex and host key methods. Hosts where the
+    // guess was wrong are remembered and not guessed for again. On by default.
+    CPPSSH_EXPORT static void setKexGuess(bool enable);
+    // Send our KEXINIT together with our version instead of waiting for the
+    // server's version first, saving a round trip. On by default.
+    CPPSSH_EXPORT static void setKexPipeline(bool enable);
+    // Send the signed publickey request straight away instead of first asking
+    // whether the server accepts the key, saving a round trip when it does at
+    // the cost of a signature when it doesn't. Off by default. A key that
+    // worked for the same user and host before is always sent signed.
+    CPPSSH_EXPORT static void setImmediateKeyAuth(bool enable);
+    // Keep up to requests SFTP reads or writes of requestSize bytes in flight
+    // (64 and 32KB by default), so a transfer needs requests * requestSize
+    // bytes per round trip to fill the link. Applies to SFTP sessions opened
+    // after the call.
+    CPPSSH_EXPORT static bool setSftpPipeline(size_t requests, uint32_t requestSize);
+    // Keep authenticated connections open after close, and have connect open a
+    // new session channel on one when the host, port, user, key and password
+    // match. Up to maxChannels sessions share a connection (0 disables the pool,
+    // the default), unused connections are closed after idleSeconds and checked
+    // with a global request every healthCheckSeconds (0 disables either).
+    // Must be called after create.
+    CPPSSH_EXPORT static bool setConnectionPool(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds);
+    // Keep count unused connections with these credentials in the pool, opened
+    // in the background, so connect only has to open a channel. The password is
+    // kept in memory until the pool is disabled or count is set to 0.
+    CPPSSH_EXPORT static bool preconnect(const char* host, const short port, const char* username, const char* privKeyFile, const char* password, unsigned int timeout, size_t count);
 
     CPPSSH_EXPORT static bool generateRsaKeyPair(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, short keySize);
     CPPSSH_EXPORT static bool generateDsaKeyPair(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, short keySize);
@@ -0,0 +1,240 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "algotuner.h"
+#include "crypto.h"
+#include "umac.h"
+#include "botan/cpuid.h"
+#include "botan/aead.h"
+#include "botan/stream_cipher.h"
+#include "botan/mac.h"
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+
+void CppsshAlgoTuner::orderByCpuid(std::vector<cryptoMethods>* ciphers, std::vector<macMethods>* macs)
+{
+    bool fastAes = false;
+    bool fastSha = false;
+#if defined(BOTAN_TARGET_CPU_IS_X86_FAMILY)
+    fastAes = ((Botan::CPUID::has_aes_ni() == true) && (Botan::CPUID::has_clmul() == true));
+    fastSha = (Botan::CPUID::has_intel_sha() == true);
+    cdLog(LogLevel::Debug) << "aes-ni: " << fastAes << " sha-ni: " << fastSha << " avx2: " << Botan::CPUID::has_avx2();
+#elif defined(BOTAN_TARGET_CPU_IS_ARM_FAMILY)
+    fastAes = ((Botan::CPUID::has_arm_aes() == true) && (Botan::CPUID::has_arm_pmull() == true));
+    fastSha = (Botan::CPUID::has_arm_sha2() == true);
+    cdLog(LogLevel::Debug) << "arm aes: " << fastAes << " arm sha2: " << fastSha << " neon: " << Botan::CPUID::has_neon();
+#endif
+
+    if (fastAes == true)
+    {
+        *ciphers = {cryptoMethods::AES256_GCM, cryptoMethods::AES128_GCM, cryptoMethods::CHACHA20_POLY1305,
+                    cryptoMethods::AES256_CTR, cryptoMethods::AES192_CTR, cryptoMethods::AES128_CTR};
+    }
+    else
+    {
+        // ChaCha uses the SIMD units (SSE2/AVX2/NEON) and table-free AES is
+        // slow, so fewer AES rounds come next and GHASH without clmul last.
+        *ciphers = {cryptoMethods::CHACHA20_POLY1305, cryptoMethods::AES128_CTR, cryptoMethods::AES192_CTR,
+                    cryptoMethods::AES256_CTR, cryptoMethods::AES128_GCM, cryptoMethods::AES256_GCM};
+    }
+
+    // UMAC would be faster than either without SHA-NI, it stays behind the
+    // etm HMACs until cppsshtestumac has passed on the supported platforms
+    if (fastSha == true)
+    {
+        *macs = {macMethods::HMAC_SHA256_ETM, macMethods::HMAC_SHA1_ETM, macMethods::UMAC_64_ETM, macMethods::UMAC_128_ETM,
+                 macMethods::HMAC_SHA256, macMethods::HMAC_SHA1, macMethods::UMAC_64, macMethods::UMAC_128};
+    }
+    else
+    {
+        *macs = {macMethods::HMAC_SHA1_ETM, macMethods::HMAC_SHA256_ETM, macMethods::UMAC_64_ETM, macMethods::UMAC_128_ETM,
+                 macMethods::HMAC_SHA1, macMethods::HMAC_SHA256, macMethods::UMAC_64, macMethods::UMAC_128};
+    }
+}
+
+void CppsshAlgoTuner::orderByBenchmark(const CppsshCryptoAlgos& cipherAlgos, const CppsshMacAlgos& macAlgos,
+                                       std::vector<cryptoMethods>* ciphers, std::vector<macMethods>* macs, std::string* rates)
+{
+    std::vector<cryptoMethods> cipherMethods;
+    std::vector<macMethods> macMethodList;
+    std::vector<std::pair<cryptoMethods, double> > cipherRates;
+    std::vector<std::pair<macMethods, double> > macRates;
+    std::ostringstream out;
+    double bestMac = 0;
+
+    macAlgos.getMethods(&macMethodList);
+    for (macMethods method : macMethodList)
+    {
+        if (method != macMethods::HMAC_NONE)
+        {
+            double rate = benchMac(method);
+            // The etm variants do the same work, they only change what is covered
+            macRates.push_back(std::make_pair(method, rate));
+            bestMac = std::max(bestMac, rate);
+            out << ((out.tellp() > 0) ? "," : "") << macAlgos.enum2ssh(method) << "=" << std::fixed << std::setprecision(1) << rate;
+        }
+    }
+    sortByRate(&macRates, macs);
+
+    cipherAlgos.getMethods(&cipherMethods);
+    for (cryptoMethods method : cipherMethods)
+    {
+        double rate = benchCipher(method, cipherAlgos.enum2botan(method));
+        out << ((out.tellp() > 0) ? "," : "") << cipherAlgos.enum2ssh(method) << "=" << std::fixed << std::setprecision(1) << rate;
+        // Everything but the AEAD ciphers also pays for the mac on every byte
+        if ((CppsshCrypto::isAead(method) == false) && (rate > 0) && (bestMac > 0))
+        {
+            rate = 1 / ((1 / rate) + (1 / bestMac));
+        }
+        cipherRates.push_back(std::make_pair(method, rate));
+    }
+    sortByRate(&cipherRates, ciphers);
+    rates->assign(out.str());
+}
+
+template<typename T> void CppsshAlgoTuner::sortByRate(std::vector<std::pair<T, double> >* rates, std::vector<T>* order)
+{
+    std::stable_sort(rates->begin(), rates->end(), [](const std::pair<T, double>& a, const std::pair<T, double>& b)
+    {
+        return a.second > b.second;
+    });
+    for (const std::pair<T, double>& rate : *rates)
+    {
+        // Anything that could not be measured keeps its default place
+        if (rate.second > 0)
+        {
+            order->push_back(rate.first);
+        }
+    }
+}
+
+double CppsshAlgoTuner::benchCipher(cryptoMethods method, const std::string& botanName)
+{
+    double ret = 0;
+    try
+    {
+        std::unique_ptr<Botan::Cipher_Mode> mode;
+        std::unique_ptr<Botan::StreamCipher> stream;
+        Botan::secure_vector<Botan::byte> buf(CPPSSH_TUNE_BENCH_LEN);
+        Botan::secure_vector<Botan::byte> nonce;
+
+        if ((method == cryptoMethods::AES128_GCM) || (method == cryptoMethods::AES256_GCM))
+        {
+            mode = Botan::AEAD_Mode::create(botanName + "/GCM", Botan::ENCRYPTION);
+        }
+        else if (method == cryptoMethods::CHACHA20_POLY1305)
+        {
+            // Same primitives as the openssh construction, plus one extra ChaCha
+            // block per packet that does not change the ranking.
+            mode = Botan::AEAD_Mode::create("ChaCha20Poly1305", Botan::ENCRYPTION);
+        }
+        else if ((method == cryptoMethods::AES128_CTR) || (method == cryptoMethods::AES192_CTR) ||
+                 (method == cryptoMethods::AES256_CTR))
+        {
+            stream = Botan::StreamCipher::create("CTR-BE(" + botanName + ")");
+        }
+        else
+        {
+            mode = Botan::Cipher_Mode::create(botanName + "/CBC/NoPadding", Botan::ENCRYPTION);
+        }
+
+        if (stream != nullptr)
+        {
+            stream->set_key(Botan::secure_vector<Botan::byte>(stream->key_spec().maximum_keylength()));
+            stream->set_iv(nullptr, 0);
+        }
+        else if (mode != nullptr)
+        {
+            mode->set_key(Botan::secure_vector<Botan::byte>(mode->key_spec().maximum_keylength()));
+            nonce.resize(mode->default_nonce_length());
+        }
+
+        if ((stream != nullptr) || (mode != nullptr))
+        {
+            size_t bytes = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed;
+            do
+            {
+                if (stream != nullptr)
+                {
+                    stream->cipher1(buf.data(), CPPSSH_TUNE_BENCH_LEN);
+                }
+                else
+                {
+                    buf.resize(CPPSSH_TUNE_BENCH_LEN);
+                    mode->start(nonce);
+                    mode->finish(buf);
+                }
+                bytes += CPPSSH_TUNE_BENCH_LEN;
+                elapsed = std::chrono::steady_clock::now() - start;
+            } while (elapsed < std::chrono::milliseconds(CPPSSH_TUNE_BENCH_MS));
+            ret = (bytes / elapsed.count()) / (1024 * 1024);
+        }
+        else
+        {
+            cdLog(LogLevel::Debug) << "Unable to benchmark " << botanName;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
+    }
+    return ret;
+}
+
+double CppsshAlgoTuner::benchMac(macMethods method)
+{
+    double ret = 0;
+    try
+    {
+        uint32_t keyLen = 0;
+        std::unique_ptr<Botan::MessageAuthenticationCode> mac = CppsshCrypto::createMac(method, &keyLen);
+        if (mac != nullptr)
+        {
+            Botan::secure_vector<Botan::byte> buf(CPPSSH_TUNE_BENCH_LEN);
+            Botan::byte nonce[CppsshUmac::NONCE_LEN] = {0};
+            size_t bytes = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed;
+            mac->set_key(Botan::secure_vector<Botan::byte>(keyLen));
+            do
+            {
+                if (CppsshCrypto::isUmac(method) == true)
+                {
+                    mac->start(nonce, sizeof(nonce));
+                }
+                mac->update(buf);
+                mac->final();
+                bytes += CPPSSH_TUNE_BENCH_LEN;
+                elapsed = std::chrono::steady_clock::now() - start;
+            } while (elapsed < std::chrono::milliseconds(CPPSSH_TUNE_BENCH_MS));
+            ret = (bytes / elapsed.count()) / (1024 * 1024);
+        }
+        else
+        {
+            cdLog(LogLevel::Debug) << "Unable to benchmark mac " << (int)method;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
+    }
+    return ret;
+}
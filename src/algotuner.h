@@ -0,0 +1,52 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _ALGO_TUNER_Hxx
+#define _ALGO_TUNER_Hxx
+
+#include "cryptoalgos.h"
+#include <string>
+#include <vector>
+
+#define CPPSSH_TUNE_BENCH_MS  20
+#define CPPSSH_TUNE_BENCH_LEN (16 * 1024)
+
+// Reorders the cipher and mac preference lists for the machine we are running
+// on, either from the CPU features Botan detects or from a short benchmark of
+// each primitive. Only the order changes, every algorithm is still offered.
+class CppsshAlgoTuner
+{
+public:
+    CppsshAlgoTuner() = delete;
+    CppsshAlgoTuner(const CppsshAlgoTuner&) = delete;
+
+    // Hardware AES/GHASH favours the gcm and ctr modes, without it
+    // chacha20-poly1305 is faster. SHA extensions favour hmac-sha2-256.
+    static void orderByCpuid(std::vector<cryptoMethods>* ciphers, std::vector<macMethods>* macs);
+    // Time every cipher and mac for about CPPSSH_TUNE_BENCH_MS each, rates is
+    // filled with "name=MB/s" pairs separated by commas.
+    static void orderByBenchmark(const CppsshCryptoAlgos& cipherAlgos, const CppsshMacAlgos& macAlgos,
+                                 std::vector<cryptoMethods>* ciphers, std::vector<macMethods>* macs, std::string* rates);
+
+private:
+    static double benchCipher(cryptoMethods method, const std::string& botanName);
+    static double benchMac(macMethods method);
+    template<typename T> static void sortByRate(std::vector<std::pair<T, double> >* rates, std::vector<T>* order);
+};
+
+#endif
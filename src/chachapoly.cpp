@@ -0,0 +1,86 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "chachapoly.h"
+#include "botan/loadstor.h"
+#include "botan/mem_ops.h"
+#include <algorithm>
+
+CppsshChaChaPoly::CppsshChaChaPoly()
+    : _main(Botan::StreamCipher::create_or_throw("ChaCha(20)")),
+    _header(Botan::StreamCipher::create_or_throw("ChaCha(20)")),
+    _poly1305(Botan::MessageAuthenticationCode::create_or_throw("Poly1305")),
+    _polyKey(32),
+    _tag(TAG_LEN)
+{
+}
+
+void CppsshChaChaPoly::setKey(const Botan::secure_vector<Botan::byte>& key)
+{
+    _main->set_key(key.data(), KEY_LEN / 2);
+    _header->set_key(key.data() + (KEY_LEN / 2), KEY_LEN / 2);
+}
+
+void CppsshChaChaPoly::setNonce(uint32_t seq)
+{
+    Botan::store_be((uint64_t)seq, _nonce);
+}
+
+void CppsshChaChaPoly::cryptLength(Botan::byte* out, const Botan::byte* in, uint32_t seq)
+{
+    setNonce(seq);
+    _header->set_iv(_nonce, sizeof(_nonce));
+    _header->cipher(in, out, sizeof(uint32_t));
+}
+
+// The poly1305 key is the first 32 bytes of the payload keystream, and the
+// payload itself starts at the second ChaCha20 block.
+void CppsshChaChaPoly::startPacket(uint32_t seq)
+{
+    setNonce(seq);
+    _main->set_iv(_nonce, sizeof(_nonce));
+    std::fill(_polyKey.begin(), _polyKey.end(), 0);
+    _main->cipher1(_polyKey.data(), _polyKey.size());
+    _poly1305->set_key(_polyKey);
+    _main->seek(64);
+}
+
+void CppsshChaChaPoly::encrypt(Botan::byte* packet, uint32_t len, uint32_t seq, Botan::secure_vector<Botan::byte>* tag)
+{
+    cryptLength(packet, packet, seq);
+    startPacket(seq);
+    _main->cipher1(packet + sizeof(uint32_t), len - sizeof(uint32_t));
+    _poly1305->update(packet, len);
+    tag->resize(TAG_LEN);
+    _poly1305->final(tag->data());
+}
+
+bool CppsshChaChaPoly::decrypt(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t len,
+                               const Botan::byte* tag, uint32_t seq)
+{
+    bool ret = false;
+    startPacket(seq);
+    _poly1305->update(encrypted, len);
+    _poly1305->final(_tag.data());
+    if (Botan::same_mem(_tag.data(), tag, TAG_LEN) == true)
+    {
+        _main->cipher(encrypted + sizeof(uint32_t), decrypted + sizeof(uint32_t), len - sizeof(uint32_t));
+        ret = true;
+    }
+    return ret;
+}
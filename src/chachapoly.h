@@ -0,0 +1,60 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _CHACHA_POLY_Hxx
+#define _CHACHA_POLY_Hxx
+
+#include "botan/stream_cipher.h"
+#include "botan/mac.h"
+#include <memory>
+
+// chacha20-poly1305@openssh.com as described in OpenSSH's PROTOCOL.chacha20poly1305.
+// The packet length and the payload are encrypted with separately keyed ChaCha20
+// instances, and the nonce is the packet sequence number.
+class CppsshChaChaPoly
+{
+public:
+    CppsshChaChaPoly();
+    CppsshChaChaPoly(const CppsshChaChaPoly&) = delete;
+
+    // The first half of the key is the payload key, the second half the length key
+    void setKey(const Botan::secure_vector<Botan::byte>& key);
+
+    void cryptLength(Botan::byte* out, const Botan::byte* in, uint32_t seq);
+    // Encrypt the packet in place, including its length, and compute the tag
+    void encrypt(Botan::byte* packet, uint32_t len, uint32_t seq, Botan::secure_vector<Botan::byte>* tag);
+    // Verify the tag over the encrypted packet, then decrypt everything after the length
+    bool decrypt(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t len, const Botan::byte* tag, uint32_t seq);
+
+    static const uint32_t KEY_LEN = 64;
+    static const uint32_t TAG_LEN = 16;
+    static const uint32_t BLOCK_SIZE = 8;
+
+private:
+    void startPacket(uint32_t seq);
+    void setNonce(uint32_t seq);
+
+    std::unique_ptr<Botan::StreamCipher> _main;
+    std::unique_ptr<Botan::StreamCipher> _header;
+    std::unique_ptr<Botan::MessageAuthenticationCode> _poly1305;
+    Botan::byte _nonce[8];
+    Botan::secure_vector<Botan::byte> _polyKey;
+    Botan::secure_vector<Botan::byte> _tag;
+};
+
+#endif
@@ -30,7 +30,9 @@
 
 CppsshChannel::CppsshChannel(const std::shared_ptr<CppsshSession>& session)
     : _session(session),
+    _lateGlobalReplies(0),
     _mainChannel(0),
+    _mainChannelOpened(false),
     _x11ReqSuccess(false)
 {
 }
@@ -51,7 +53,87 @@ bool CppsshChannel::establish(const std::string& host, short port)
     return ret;
 }
 
-bool CppsshChannel::openChannel()
+bool CppsshChannel::openSessionChannel(uint32_t* rxChannel)
+{
+    bool ret = false;
+    if (_mainChannelOpened == false)
+    {
+        _mainChannelOpened = true;
+        *rxChannel = _mainChannel;
+        ret = ((sendChannelOpen(_mainChannel, Botan::secure_vector<Botan::byte>()) == true) &&
+               (getChannel(_mainChannel)->handleChannelConfirm() == true));
+    }
+    else
+    {
+        ret = openChannel("session", Botan::secure_vector<Botan::byte>(), rxChannel);
+    }
+    return ret;
+}
+
+bool CppsshChannel::openChannel(const std::string& channelName, const Botan::secure_vector<Botan::byte>& openData,
+                                uint32_t* rxChannel)
+{
+    return ((beginChannelOpen(channelName, openData, rxChannel) == true) && (waitChannelOpen(*rxChannel) == true));
+}
+
+bool CppsshChannel::beginChannelOpen(const std::string& channelName, const Botan::secure_vector<Botan::byte>& openData,
+                                     uint32_t* rxChannel)
+{
+    bool ret = false;
+    if (createNewSubChannel(channelName, rxChannel) == true)
+    {
+        if (channelName != "session")
+        {
+            _channels.at(*rxChannel)->setWindowOnRead(true);
+        }
+        ret = sendChannelOpen(*rxChannel, openData);
+        if (ret == false)
+        {
+            _channels.erase(*rxChannel);
+        }
+    }
+    return ret;
+}
+
+bool CppsshChannel::waitChannelOpen(uint32_t rxChannel)
+{
+    bool ret = false;
+    try
+    {
+        ret = getChannel(rxChannel)->handleChannelConfirm();
+        if (ret == false)
+        {
+            _channels.erase(rxChannel);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "waitChannelOpen " << ex.what();
+    }
+    return ret;
+}
+
+bool CppsshChannel::pollChannelOpen(uint32_t rxChannel, bool* opened)
+{
+    bool ret = false;
+    try
+    {
+        ret = getChannel(rxChannel)->pollChannelConfirm(opened);
+        if ((ret == true) && (*opened == false))
+        {
+            _channels.erase(rxChannel);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "pollChannelOpen " << ex.what();
+        *opened = false;
+        ret = true;
+    }
+    return ret;
+}
+
+bool CppsshChannel::sendChannelOpen(uint32_t rxChannel, const Botan::secure_vector<Botan::byte>& openData)
 {
     bool ret = false;
     Botan::secure_vector<Botan::byte> buf;
@@ -59,16 +141,16 @@ bool CppsshChannel::openChannel()
     packet.addByte(SSH2_MSG_CHANNEL_OPEN);
     try
     {
-        packet.addString(_channels.at(_mainChannel)->getChannelName());
-        packet.addInt(_mainChannel);
+        packet.addString(_channels.at(rxChannel)->getChannelName());
+        packet.addInt(rxChannel);
 
         packet.addInt(CppsshSubChannel::getRxWindowSize());
         packet.addInt(CPPSSH_MAX_PACKET_LEN);
-
-        if (_session->_transport->sendMessage(buf) == true)
+        if (openData.empty() == false)
         {
-            ret = _channels.at(_mainChannel)->handleChannelConfirm();
+            packet.addRawData(openData.data(), openData.size());
         }
+        ret = _session->_transport->sendMessage(buf);
     }
     catch (const std::exception& ex)
     {
@@ -77,49 +159,244 @@ bool CppsshChannel::openChannel()
     return ret;
 }
 
-bool CppsshChannel::isConnected()
+// The channel is dropped once both sides have sent their close
+void CppsshChannel::closeChannel(uint32_t rxChannel)
+{
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        std::shared_ptr<CppsshSubChannel> channel = _channels.at(rxChannel);
+        if (channel->isRemoteClosed() == true)
+        {
+            _channels.erase(rxChannel);
+        }
+        else
+        {
+            channel->sendClose();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "closeChannel " << ex.what();
+    }
+}
+
+bool CppsshChannel::isChannelOpen(uint32_t rxChannel)
+{
+    bool ret = false;
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+    if (_channels.find(rxChannel) != _channels.cend())
+    {
+        std::shared_ptr<CppsshSubChannel> channel = _channels.at(rxChannel);
+        ret = (((channel->isRemoteClosed() == false) && (_session->_transport->isRunning() == true)) ||
+               (channel->isReadable() == true));
+    }
+    return ret;
+}
+
+bool CppsshChannel::isRemoteDone(uint32_t rxChannel)
+{
+    bool ret = true;
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+    if (_channels.find(rxChannel) != _channels.cend())
+    {
+        std::shared_ptr<CppsshSubChannel> channel = _channels.at(rxChannel);
+        ret = ((channel->isRemoteEof() == true) && (channel->getQueuedReads() == 0));
+    }
+    return ret;
+}
+
+bool CppsshChannel::writeChannel(uint32_t rxChannel, const uint8_t* data, uint32_t bytes)
+{
+    bool ret = false;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->writeChannel(data, bytes);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "writeChannel " << ex.what();
+    }
+    return ret;
+}
+
+bool CppsshChannel::readChannel(uint32_t rxChannel, CppsshMessage* data)
+{
+    bool ret = false;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->readChannel(data);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "readChannel " << ex.what();
+    }
+    return ret;
+}
+
+bool CppsshChannel::writeChannel(uint32_t rxChannel, const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message)
+{
+    bool ret = false;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->writeChannel(message);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "writeChannel " << ex.what();
+    }
+    return ret;
+}
+
+bool CppsshChannel::readChannel(uint32_t rxChannel, std::shared_ptr<CppsshMessage>* message)
+{
+    bool ret = false;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->readChannel(message);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "readChannel " << ex.what();
+    }
+    return ret;
+}
+
+uint32_t CppsshChannel::getMaxWrite(uint32_t rxChannel)
+{
+    uint32_t ret = 0;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->getMaxWrite();
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "getMaxWrite " << ex.what();
+    }
+    return ret;
+}
+
+size_t CppsshChannel::getQueuedWrites(uint32_t rxChannel)
+{
+    size_t ret = 0;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->getQueuedWrites();
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "getQueuedWrites " << ex.what();
+    }
+    return ret;
+}
+
+size_t CppsshChannel::getQueuedReads(uint32_t rxChannel)
+{
+    size_t ret = 0;
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        ret = _channels.at(rxChannel)->getQueuedReads();
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "getQueuedReads " << ex.what();
+    }
+    return ret;
+}
+
+void CppsshChannel::sendEof(uint32_t rxChannel)
 {
-    return ((_channels.find(_mainChannel) != _channels.cend()) &&
-            (_session->_transport->isRunning() == true));
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        _channels.at(rxChannel)->sendEof();
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "sendEof " << ex.what();
+    }
 }
 
-bool CppsshChannel::writeMainChannel(const uint8_t* data, uint32_t bytes)
+bool CppsshChannel::readStderr(uint32_t rxChannel, CppsshMessage* data)
 {
     bool ret = false;
     try
     {
         std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
-        ret = _channels.at(_mainChannel)->writeChannel(data, bytes);
+        ret = _channels.at(rxChannel)->readStderr(data);
     }
     catch (const std::exception& ex)
     {
-        cdLog(LogLevel::Error) << "writeMainChannel " << ex.what();
+        cdLog(LogLevel::Error) << "readStderr " << ex.what();
     }
     return ret;
 }
 
-bool CppsshChannel::readMainChannel(CppsshMessage* data)
+bool CppsshChannel::getExitStatus(uint32_t rxChannel, int* exitStatus)
 {
     bool ret = false;
     try
     {
         std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
-        ret = _channels.at(_mainChannel)->readChannel(data);
+        ret = _channels.at(rxChannel)->getExitStatus(exitStatus);
     }
     catch (const std::exception& ex)
     {
-        cdLog(LogLevel::Error) << "readMainChannel " << ex.what();
+        cdLog(LogLevel::Error) << "getExitStatus " << ex.what();
     }
     return ret;
 }
 
-bool CppsshChannel::windowChange(const uint32_t rows, const uint32_t cols)
+// No pty, so stdout and stderr stay apart and nothing is echoed
+bool CppsshChannel::exec(uint32_t rxChannel, const char* command)
+{
+    return doStringRequest(rxChannel, "exec", command);
+}
+
+bool CppsshChannel::subsystem(uint32_t rxChannel, const char* subsystem)
+{
+    return doStringRequest(rxChannel, "subsystem", subsystem);
+}
+
+bool CppsshChannel::doStringRequest(uint32_t rxChannel, const std::string& req, const char* value)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    packet.addString(value);
+    try
+    {
+        ret = getChannel(rxChannel)->doChannelRequest(req, buf);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << req << " " << ex.what();
+    }
+    return ret;
+}
+
+// The lock is only held for the lookup, requests that wait for a reply must not keep
+// the rx thread from the channels while the reply comes in
+std::shared_ptr<CppsshSubChannel> CppsshChannel::getChannel(uint32_t rxChannel)
+{
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+    return _channels.at(rxChannel);
+}
+
+bool CppsshChannel::windowChange(uint32_t rxChannel, const uint32_t rows, const uint32_t cols)
 {
     bool ret = false;
     try
     {
         std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
-        ret = _channels.at(_mainChannel)->windowChange(rows, cols);
+        ret = _channels.at(rxChannel)->windowChange(rows, cols);
     }
     catch (const std::exception& ex)
     {
@@ -128,6 +405,144 @@ bool CppsshChannel::windowChange(const uint32_t rows, const uint32_t cols)
     return ret;
 }
 
+bool CppsshChannel::ping()
+{
+    Botan::secure_vector<Botan::byte> reply;
+    // Servers refuse the unknown request, any reply means the connection is alive
+    return globalRequest("keepalive@openssh.com", Botan::secure_vector<Botan::byte>(), &reply);
+}
+
+// Replies can't be matched to requests other than by order, so a reply that
+// comes after its request timed out is dropped when it arrives
+bool CppsshChannel::globalRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& request,
+                                  Botan::secure_vector<Botan::byte>* reply)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    std::unique_lock<std::mutex> lock(_globalRequestMutex);
+    packet.addByte(SSH2_MSG_GLOBAL_REQUEST);
+    packet.addString(req);
+    packet.addByte(1);// want reply == true
+    if (request.empty() == false)
+    {
+        packet.addRawData(request.data(), request.size());
+    }
+    if (_session->_transport->sendMessage(buf) == true)
+    {
+        while ((ret == false) && (_incomingGlobalReplies.dequeue(*reply, _session->getTimeout()) == true))
+        {
+            if (_lateGlobalReplies > 0)
+            {
+                _lateGlobalReplies--;
+            }
+            else
+            {
+                ret = true;
+            }
+        }
+        if (ret == false)
+        {
+            cdLog(LogLevel::Error) << "No reply to " << req;
+            _lateGlobalReplies++;
+        }
+    }
+    return ret;
+}
+
+// The queue is in place before the request goes out, the server can open a channel
+// right after its reply. A port of 0 waits under 0 until the reply names the port.
+bool CppsshChannel::tcpipForward(const std::string& address, uint32_t port, uint32_t* boundPort,
+                                 const std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> >& opens)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket packet(&buf);
+    packet.addString(address);
+    packet.addInt(port);
+    std::unique_lock<std::mutex> lock(_tcpipForwardMutex);
+    if (_remoteForwards.find(port) != _remoteForwards.cend())
+    {
+        cdLog(LogLevel::Error) << "Port " << port << " is already forwarded";
+    }
+    else
+    {
+        _remoteForwards.insert(std::pair<uint32_t, std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> > >(port, opens));
+        if ((globalRequest("tcpip-forward", buf, &reply) == true) && (reply.empty() == false))
+        {
+            const CppsshConstPacket replyPacket(&reply);
+            if (replyPacket.getCommand() == SSH2_MSG_REQUEST_SUCCESS)
+            {
+                *boundPort = port;
+                if (port == 0)
+                {
+                    replyPacket.skipHeader();
+                    *boundPort = replyPacket.getInt();
+                    std::shared_ptr<std::unique_lock<std::recursive_mutex> > mapLock = _remoteForwards.getLock();
+                    _remoteForwards.insert(std::pair<uint32_t, std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> > >(
+                                               *boundPort, opens));
+                    _remoteForwards.erase(0);
+                }
+                ret = true;
+            }
+            else
+            {
+                cdLog(LogLevel::Error) << "Server refused to forward " << address << ":" << port;
+            }
+        }
+        if (ret == false)
+        {
+            _remoteForwards.erase(port);
+        }
+    }
+    return ret;
+}
+
+// Channels already open for the port carry on
+bool CppsshChannel::cancelTcpipForward(const std::string& address, uint32_t port)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket packet(&buf);
+    packet.addString(address);
+    packet.addInt(port);
+    _remoteForwards.erase(port);
+    if ((globalRequest("cancel-tcpip-forward", buf, &reply) == true) && (reply.empty() == false))
+    {
+        const CppsshConstPacket replyPacket(&reply);
+        ret = (replyPacket.getCommand() == SSH2_MSG_REQUEST_SUCCESS);
+    }
+    return ret;
+}
+
+void CppsshChannel::confirmOpen(uint32_t rxChannel)
+{
+    try
+    {
+        sendOpenConfirmation(rxChannel);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "confirmOpen " << ex.what();
+    }
+}
+
+void CppsshChannel::refuseOpen(uint32_t rxChannel, CppsshOpenFailureReason reason)
+{
+    try
+    {
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+        sendOpenFailure(_channels.at(rxChannel)->getTxChannel(), reason);
+        _channels.erase(rxChannel);
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "refuseOpen " << ex.what();
+    }
+}
+
 void CppsshChannel::handleDebug(const CppsshConstPacket& packet)
 {
     std::string dbg;
@@ -140,6 +555,27 @@ void CppsshChannel::handleDebug(const CppsshConstPacket& packet)
     }
 }
 
+// RFC 8308, only server-sig-algs is used
+void CppsshChannel::handleExtInfo(const CppsshConstPacket& packet)
+{
+    packet.skipHeader();
+    uint32_t extensions = packet.getInt();
+    for (uint32_t i = 0; i < extensions; i++)
+    {
+        std::string name;
+        std::string value;
+        if ((packet.getString(&name) == false) || (packet.getString(&value) == false))
+        {
+            break;
+        }
+        cdLog(LogLevel::Debug) << "Extension " << name << ": " << value;
+        if (name == "server-sig-algs")
+        {
+            _session->setServerSigAlgs(value);
+        }
+    }
+}
+
 void CppsshChannel::handleDisconnect(const CppsshConstPacket& packet)
 {
     std::string err;
@@ -154,6 +590,7 @@ void CppsshChannel::disconnect()
 {
     cdLog(LogLevel::Debug) << "disconnect[" << _session->getConnectionId() << "]";
     _channels.clear();
+    _remoteForwards.clear();
 }
 
 void CppsshChannel::handleEof(const Botan::secure_vector<Botan::byte>& buf)
@@ -164,13 +601,21 @@ void CppsshChannel::handleEof(const Botan::secure_vector<Botan::byte>& buf)
     _channels.at(rxChannel)->handleEof();
 }
 
+// Channels stay until closed locally, so what the server sent last can still be read, x11 channels
+// have no local owner to close them
 void CppsshChannel::handleClose(const Botan::secure_vector<Botan::byte>& buf)
 {
     CppsshConstPacket packet(&buf);
     packet.skipHeader();
     uint32_t rxChannel = packet.getInt();
-    _channels.at(rxChannel)->handleClose();
-    _channels.erase(rxChannel);
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
+    std::shared_ptr<CppsshSubChannel> channel = _channels.at(rxChannel);
+    bool closeSent = channel->isCloseSent();
+    channel->handleClose();
+    if ((closeSent == true) || (channel->getChannelName() == "x11"))
+    {
+        _channels.erase(rxChannel);
+    }
 }
 
 bool CppsshChannel::createNewSubChannel(const std::string& channelName, uint32_t windowSend, uint32_t maxPacket,
@@ -198,6 +643,8 @@ bool CppsshChannel::createNewSubChannel(const std::string& channelName, uint32_t
         channel.reset(new CppsshSubChannel(_session, channelName));
     }
 
+    // Channels can be opened from several threads at once
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
     for (chan = 100; chan < 2048; chan++)
     {
         if (_channels.find(chan) == _channels.cend())
@@ -237,18 +684,16 @@ void CppsshChannel::sendOpenFailure(uint32_t rxChannel, CppsshOpenFailureReason
     _session->_transport->sendMessage(buf);
 }
 
+// forwarded-tcpip channels wait in the queue of their port for the forwarder to connect them
 void CppsshChannel::handleOpen(const Botan::secure_vector<Botan::byte>& buf)
 {
     std::string channelName;
-    std::string originatorAddr;
     CppsshConstPacket openPacket(&buf);
     openPacket.skipHeader();
     openPacket.getString(&channelName);
     uint32_t txChannel = openPacket.getInt();
     uint32_t windowSend = openPacket.getInt();
     uint32_t maxPacket = openPacket.getInt();
-    openPacket.getString(&originatorAddr);
-    //uint32_t originatorPort = openPacket.getInt();
     if (channelName == "x11")
     {
         if (_x11ReqSuccess == false)
@@ -268,6 +713,31 @@ void CppsshChannel::handleOpen(const Botan::secure_vector<Botan::byte>& buf)
             }
         }
     }
+    else if (channelName == "forwarded-tcpip")
+    {
+        CppsshForwardedOpen open;
+        openPacket.getString(&open._address);
+        open._port = openPacket.getInt();
+        openPacket.getString(&open._originator);
+        open._originatorPort = openPacket.getInt();
+        std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _remoteForwards.getLock();
+        // Only a request for port 0 still waiting for its reply is under 0
+        uint32_t key = (_remoteForwards.find(open._port) != _remoteForwards.cend()) ? open._port : 0;
+        if (_remoteForwards.find(key) == _remoteForwards.cend())
+        {
+            cdLog(LogLevel::Error) << "No forward for " << open._address << ":" << open._port;
+            sendOpenFailure(txChannel, SSH2_OPEN_ADMINISTRATIVELY_PROHIBITED);
+        }
+        else if (createNewSubChannel(channelName, windowSend, maxPacket, txChannel, &open._rxChannel) == true)
+        {
+            _channels.at(open._rxChannel)->setWindowOnRead(true);
+            _remoteForwards.at(key)->enqueue(open);
+        }
+        else
+        {
+            sendOpenFailure(txChannel, SSH2_OPEN_RESOURCE_SHORTAGE);
+        }
+    }
     else
     {
         sendOpenFailure(txChannel, SSH2_OPEN_UNKNOWN_CHANNEL_TYPE);
@@ -286,7 +756,8 @@ bool CppsshChannel::flushOutgoingChannelData()
     return ret;
 }
 
-bool CppsshChannel::getShell(const char* term)
+// pty-req and shell go out back to back, saving a round trip
+bool CppsshChannel::getShell(uint32_t rxChannel, const char* term)
 {
     bool ret = false;
     Botan::secure_vector<Botan::byte> buf;
@@ -301,13 +772,13 @@ bool CppsshChannel::getShell(const char* term)
 
     try
     {
-        if (_channels.at(_mainChannel)->doChannelRequest("pty-req", buf) == true)
+        std::shared_ptr<CppsshSubChannel> channel = getChannel(rxChannel);
+        if ((channel->sendChannelRequest("pty-req", buf, true) == true) &&
+            (channel->sendChannelRequest("shell", Botan::secure_vector<Botan::byte>(), true) == true))
         {
-            buf.clear();
-            if (_channels.at(_mainChannel)->doChannelRequest("shell", buf) == true)
-            {
-                ret = true;
-            }
+            // Both replies are read, even when the first one is a failure
+            bool pty = channel->waitChannelReply("pty-req");
+            ret = ((channel->waitChannelReply("shell") == true) && (pty == true));
         }
     }
     catch (const std::exception& ex)
@@ -331,7 +802,7 @@ bool CppsshChannel::getRandomString(const int size, std::string* randomString)
     return true;
 }
 
-bool CppsshChannel::getX11()
+bool CppsshChannel::getX11(uint32_t rxChannel)
 {
     bool ret = false;
     std::string display;
@@ -359,7 +830,7 @@ bool CppsshChannel::getX11()
         x11packet.addInt(screenNum);
         try
         {
-            ret = _channels.at(_mainChannel)->doChannelRequest("x11-req", x11req);
+            ret = getChannel(rxChannel)->doChannelRequest("x11-req", x11req);
             if (ret == true)
             {
                 _x11ReqSuccess = true;
@@ -381,6 +852,14 @@ void CppsshChannel::handleIncomingChannelData(const Botan::secure_vector<Botan::
     _channels.at(rxChannel)->handleIncomingChannelData(buf);
 }
 
+void CppsshChannel::handleIncomingExtendedData(const Botan::secure_vector<Botan::byte>& buf)
+{
+    CppsshConstPacket packet(&buf);
+    packet.skipHeader();
+    uint32_t rxChannel = packet.getInt();
+    _channels.at(rxChannel)->handleIncomingExtendedData(buf);
+}
+
 void CppsshChannel::handleIncomingControlData(const Botan::secure_vector<Botan::byte>& buf)
 {
     CppsshConstPacket packet(&buf);
@@ -409,6 +888,32 @@ bool CppsshChannel::waitForGlobalMessage(Botan::secure_vector<Botan::byte>& buf)
     return _incomingGlobalData.dequeue(buf, _session->getTimeout());
 }
 
+void CppsshChannel::handleIncomingKexData(const Botan::secure_vector<Botan::byte>& buf)
+{
+    _incomingKexData.enqueue(buf);
+}
+
+void CppsshChannel::handleGlobalRequest(const Botan::secure_vector<Botan::byte>& buf)
+{
+    std::string request;
+    CppsshConstPacket packet(&buf);
+    packet.skipHeader();
+    packet.getString(&request);
+    // Servers probe idle clients with keepalive@openssh.com, which must be answered
+    if (packet.getByte() != 0)
+    {
+        Botan::secure_vector<Botan::byte> reply;
+        CppsshPacket replyPacket(&reply);
+        replyPacket.addByte(SSH2_MSG_REQUEST_FAILURE);
+        _session->_transport->sendMessage(reply);
+    }
+}
+
+bool CppsshChannel::waitForKexMessage(Botan::secure_vector<Botan::byte>& buf)
+{
+    return _incomingKexData.dequeue(buf, _session->getTimeout());
+}
+
 void CppsshChannel::handleBanner(const Botan::secure_vector<Botan::byte>& buf)
 {
     std::shared_ptr<std::unique_lock<std::recursive_mutex> > lock = _channels.getLock();
@@ -457,10 +962,13 @@ void CppsshChannel::handleReceived(const Botan::secure_vector<Botan::byte>& buf)
             case SSH2_MSG_USERAUTH_SUCCESS:
             case SSH2_MSG_USERAUTH_PK_OK:
             case SSH2_MSG_SERVICE_ACCEPT:
+                handleIncomingGlobalData(buf);
+                break;
+
             case SSH2_MSG_KEXDH_REPLY:
             case SSH2_MSG_NEWKEYS:
             case SSH2_MSG_KEXINIT:
-                handleIncomingGlobalData(buf);
+                handleIncomingKexData(buf);
                 break;
 
             case SSH2_MSG_USERAUTH_BANNER:
@@ -468,8 +976,7 @@ void CppsshChannel::handleReceived(const Botan::secure_vector<Botan::byte>& buf)
                 break;
 
             case SSH2_MSG_CHANNEL_EXTENDED_DATA:
-                //handleExtendedData(newPacket.value());
-                cdLog(LogLevel::Error) << "Unhandled SSH2_MSG_CHANNEL_EXTENDED_DATA: " << cmd;
+                handleIncomingExtendedData(buf);
                 break;
 
             case SSH2_MSG_CHANNEL_EOF:
@@ -492,14 +999,24 @@ void CppsshChannel::handleReceived(const Botan::secure_vector<Botan::byte>& buf)
                 handleDebug(packet);
                 break;
 
+            case SSH2_MSG_EXT_INFO:
+                handleExtInfo(packet);
+                break;
+
             case SSH2_MSG_DISCONNECT:
                 handleDisconnect(packet);
                 break;
 
-            case SSH2_MSG_IGNORE:
             case SSH2_MSG_GLOBAL_REQUEST:
+                handleGlobalRequest(buf);
+                break;
+
             case SSH2_MSG_REQUEST_SUCCESS:
             case SSH2_MSG_REQUEST_FAILURE:
+                _incomingGlobalReplies.enqueue(buf);
+                break;
+
+            case SSH2_MSG_IGNORE:
                 break;
 
             default:
@@ -25,43 +25,95 @@
 #include "transport.h"
 #include "threadsafemap.h"
 #include "threadsafequeue.h"
+#include <mutex>
 
 class CppsshSubChannel;
 
+// A forwarded-tcpip channel the server opened, until it is confirmed or refused
+class CppsshForwardedOpen
+{
+public:
+    uint32_t _rxChannel;
+    std::string _address;
+    uint32_t _port;
+    std::string _originator;
+    uint32_t _originatorPort;
+};
+
 class CppsshChannel
 {
 public:
     CppsshChannel(const std::shared_ptr<CppsshSession>& session);
     ~CppsshChannel();
     bool establish(const std::string& host, short port);
-    bool openChannel();
-    bool writeMainChannel(const uint8_t* data, uint32_t bytes);
-    bool readMainChannel(CppsshMessage* data);
-    bool windowChange(const uint32_t rows, const uint32_t cols);
-    bool getShell(const char* term);
-    bool getX11();
+    // The first session opened uses the main channel, so it also receives the banner
+    bool openSessionChannel(uint32_t* rxChannel);
+    // Opens a channel of any type, openData is what follows the common fields in SSH2_MSG_CHANNEL_OPEN
+    bool openChannel(const std::string& channelName, const Botan::secure_vector<Botan::byte>& openData, uint32_t* rxChannel);
+    // The two halves of openChannel, pollChannelOpen returns true once the server
+    // answered, a refused channel is gone by then
+    bool beginChannelOpen(const std::string& channelName, const Botan::secure_vector<Botan::byte>& openData, uint32_t* rxChannel);
+    bool waitChannelOpen(uint32_t rxChannel);
+    bool pollChannelOpen(uint32_t rxChannel, bool* opened);
+    void closeChannel(uint32_t rxChannel);
+    bool writeChannel(uint32_t rxChannel, const uint8_t* data, uint32_t bytes);
+    bool readChannel(uint32_t rxChannel, CppsshMessage* data);
+    bool readStderr(uint32_t rxChannel, CppsshMessage* data);
+    // The copy free variants of writeChannel and readChannel, see CppsshSubChannel
+    bool writeChannel(uint32_t rxChannel, const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message);
+    bool readChannel(uint32_t rxChannel, std::shared_ptr<CppsshMessage>* message);
+    uint32_t getMaxWrite(uint32_t rxChannel);
+    size_t getQueuedWrites(uint32_t rxChannel);
+    size_t getQueuedReads(uint32_t rxChannel);
+    void sendEof(uint32_t rxChannel);
+    bool getExitStatus(uint32_t rxChannel, int* exitStatus);
+    bool exec(uint32_t rxChannel, const char* command);
+    bool subsystem(uint32_t rxChannel, const char* subsystem);
+    bool windowChange(uint32_t rxChannel, const uint32_t rows, const uint32_t cols);
+    bool getShell(uint32_t rxChannel, const char* term);
+    bool getX11(uint32_t rxChannel);
     void handleReceived(const Botan::secure_vector<Botan::byte>& buf);
     bool flushOutgoingChannelData();
     void disconnect();
-    bool isConnected();
+    bool isChannelOpen(uint32_t rxChannel);
+    // The server sent EOF or close and everything before it has been read
+    bool isRemoteDone(uint32_t rxChannel);
+    // A global request round trip, to check the connection is still usable
+    bool ping();
+    // Remote forwarding, RFC 4254 section 7.1. Channels the server opens for the
+    // port go to opens, the port it picked when port is 0 is in boundPort
+    bool tcpipForward(const std::string& address, uint32_t port, uint32_t* boundPort, const std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> >& opens);
+    bool cancelTcpipForward(const std::string& address, uint32_t port);
+    void confirmOpen(uint32_t rxChannel);
+    void refuseOpen(uint32_t rxChannel, CppsshOpenFailureReason reason);
     bool waitForGlobalMessage(Botan::secure_vector<Botan::byte>& buf);
+    bool waitForKexMessage(Botan::secure_vector<Botan::byte>& buf);
     static bool getRandomString(const int size, std::string* randomString);
 private:
     void handleIncomingChannelData(const Botan::secure_vector<Botan::byte>& buf);
+    void handleIncomingExtendedData(const Botan::secure_vector<Botan::byte>& buf);
     void handleIncomingControlData(const Botan::secure_vector<Botan::byte>& buf);
     void handleWindowAdjust(const Botan::secure_vector<Botan::byte>& buf);
     void handleIncomingGlobalData(const Botan::secure_vector<Botan::byte>& buf);
+    void handleIncomingKexData(const Botan::secure_vector<Botan::byte>& buf);
+    void handleGlobalRequest(const Botan::secure_vector<Botan::byte>& buf);
     void handleChannelRequest(const Botan::secure_vector<Botan::byte>& buf);
     void handleBanner(const Botan::secure_vector<Botan::byte>& buf);
     void handleEof(const Botan::secure_vector<Botan::byte>& buf);
     void handleClose(const Botan::secure_vector<Botan::byte>& buf);
 
     void handleDebug(const CppsshConstPacket& packet);
+    void handleExtInfo(const CppsshConstPacket& packet);
     void handleDisconnect(const CppsshConstPacket& packet);
     void handleOpen(const Botan::secure_vector<Botan::byte>& buf);
+    bool sendChannelOpen(uint32_t rxChannel, const Botan::secure_vector<Botan::byte>& openData);
+    std::shared_ptr<CppsshSubChannel> getChannel(uint32_t rxChannel);
+    bool doStringRequest(uint32_t rxChannel, const std::string& req, const char* value);
     bool runXauth(const char* display, std::string* method, Botan::secure_vector<Botan::byte>* cookie) const;
     bool createNewSubChannel(const std::string& channelName, uint32_t windowSend, uint32_t maxPacket, uint32_t txChannel, uint32_t* rxChannel);
     bool createNewSubChannel(const std::string& channelName, uint32_t* rxChannel);
+    // Replies come in the order the requests went out, so only one is in flight at a time
+    bool globalRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& request, Botan::secure_vector<Botan::byte>* reply);
     void sendOpenFailure(uint32_t txChannel, CppsshOpenFailureReason reason);
     void sendOpenConfirmation(uint32_t rxChannel);
 
@@ -71,8 +123,18 @@ private:
     std::string _fakeX11Cookie;
 
     ThreadSafeQueue<Botan::secure_vector<Botan::byte> > _incomingGlobalData;
+    // Kept apart so a re-exchange can run while something waits for a global message
+    ThreadSafeQueue<Botan::secure_vector<Botan::byte> > _incomingKexData;
+    ThreadSafeQueue<Botan::secure_vector<Botan::byte> > _incomingGlobalReplies;
+    std::mutex _globalRequestMutex;
+    // Requests that timed out, their replies are still to come
+    uint32_t _lateGlobalReplies;
+    std::mutex _tcpipForwardMutex;
+    // By the port the server listens on
+    ThreadSafeMap<uint32_t, std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> > > _remoteForwards;
     ThreadSafeMap<int, std::shared_ptr<CppsshSubChannel> > _channels;
     uint32_t _mainChannel;
+    bool _mainChannelOpened;
     bool _x11ReqSuccess;
     friend class CppsshX11Channel;
 };
@@ -27,13 +27,16 @@
 #include "impl.h"
 #include "strtrim.h"
 
+std::map<std::string, std::string> CppsshConnection::s_authMemory;
+std::mutex CppsshConnection::s_authMemoryMutex;
+
 CppsshConnection::CppsshConnection(int connectionId, unsigned int timeout)
     : _session(new CppsshSession(connectionId, timeout)),
-    _connected(false)
+    _connected(false),
+    _mainChannel(0)
 {
     cdLog(LogLevel::Debug) << "CppsshConnection";
-    _session->_transport.reset(new CppsshTransportThreaded(_session));
-    _session->_crypto.reset(new CppsshCrypto(_session));
+    _session->_transport.reset(new CppsshTransportCrypto(_session));
     _session->_channel.reset(new CppsshChannel(_session));
 }
 
@@ -51,22 +54,46 @@ CppsshConnection::~CppsshConnection()
 CppsshConnectStatus_t CppsshConnection::connect(const char* host, const short port, const char* username,
                                                 const char* privKeyFile, const char* password, const bool x11Forwarded,
                                                 const bool keepAlives, const char* term)
+{
+    CppsshConnectStatus_t ret = connectTransport(host, port, username, privKeyFile, password, keepAlives);
+    if ((ret == CPPSSH_CONNECT_OK) && (openSession(&_mainChannel, x11Forwarded, term) == false))
+    {
+        ret = CPPSSH_CONNECT_ERROR;
+    }
+    return ret;
+}
+
+CppsshConnectStatus_t CppsshConnection::connectTransport(const char* host, const short port, const char* username,
+                                                         const char* privKeyFile, const char* password,
+                                                         const bool keepAlives)
 {
     CppsshConnectStatus_t ret = CPPSSH_CONNECT_OK;
     CppsshKex kex(_session);
+    const std::string peer(std::string(host) + ":" + std::to_string(port));
+    const bool pipeline = CppsshImpl::getKexPipeline();
 
+    // Our version, KEXINIT and possibly a guessed first kex packet go out
+    // before the server's version arrives, they don't depend on it.
     if (_session->_channel->establish(host, port) == false)
     {
         ret = CPPSSH_CONNECT_UNKNOWN_HOST;
     }
-    else if (checkRemoteVersion() == false)
+    else if (sendLocalVersion() == false)
     {
         ret = CPPSSH_CONNECT_INCOMPATIBLE_SERVER;
     }
-    else if (sendLocalVersion() == false)
+    else if ((pipeline == true) && (kex.sendInit(peer) == false))
+    {
+        ret = CPPSSH_CONNECT_KEX_FAIL;
+    }
+    else if (checkRemoteVersion() == false)
     {
         ret = CPPSSH_CONNECT_INCOMPATIBLE_SERVER;
     }
+    else if ((pipeline == false) && (kex.sendInit(peer) == false))
+    {
+        ret = CPPSSH_CONNECT_KEX_FAIL;
+    }
     else if (_session->_transport->startThreads() == false)
     {
         ret = CPPSSH_CONNECT_ERROR;
@@ -79,19 +106,14 @@ CppsshConnectStatus_t CppsshConnection::connect(const char* host, const short po
     {
         ret = CPPSSH_CONNECT_KEX_FAIL;
     }
-    else if (kex.sendKexNewKeys() == 0)
+    else if (kex.sendKexNewKeys() == false)
     {
         ret = CPPSSH_CONNECT_KEX_FAIL;
     }
     else
     {
         std::string pkf;
-        _session->_transport.reset(new CppsshTransportCrypto(_session, _session->_transport->getSocket()));
-        if (_session->_transport->startThreads() == false)
-        {
-            ret = CPPSSH_CONNECT_ERROR;
-        }
-        else if (requestService("ssh-userauth") == false)
+        if (requestService("ssh-userauth") == false)
         {
             ret = CPPSSH_CONNECT_ERROR;
         }
@@ -101,30 +123,15 @@ CppsshConnectStatus_t CppsshConnection::connect(const char* host, const short po
             {
                 pkf.assign(privKeyFile);
             }
-            if ((authWithKey(username, pkf, password) == false) && (authWithPassword(username, password) == false))
+            if (authenticateUser(username, pkf, password, peer) == false)
             {
                 ret = CPPSSH_CONNECT_AUTH_FAIL;
             }
-            else if (_session->_channel->openChannel() == false)
-            {
-                ret = CPPSSH_CONNECT_ERROR;
-            }
             else
             {
-                if (term != nullptr)
+                if (keepAlives == true)
                 {
-                    if (x11Forwarded == true)
-                    {
-                        _session->_channel->getX11();
-                    }
-                    if (_session->_channel->getShell(term) == false)
-                    {
-                        ret = CPPSSH_CONNECT_ERROR;
-                    }
-                    else if (keepAlives == true)
-                    {
-                        _session->_transport->enableKeepAlives();
-                    }
+                    _session->_transport->enableKeepAlives();
                 }
                 _connected = true;
             }
@@ -133,38 +140,199 @@ CppsshConnectStatus_t CppsshConnection::connect(const char* host, const short po
     return ret;
 }
 
-bool CppsshConnection::write(const uint8_t* data, uint32_t bytes)
+bool CppsshConnection::openSession(uint32_t* channel, const bool x11Forwarded, const char* term)
+{
+    bool ret = false;
+    if (_session->_channel->openSessionChannel(channel) == true)
+    {
+        ret = true;
+        if (term != nullptr)
+        {
+            if (x11Forwarded == true)
+            {
+                _session->_channel->getX11(*channel);
+            }
+            ret = _session->_channel->getShell(*channel, term);
+        }
+    }
+    return ret;
+}
+
+bool CppsshConnection::openExec(uint32_t* channel, const char* command)
+{
+    bool ret = false;
+    if (_session->_channel->openSessionChannel(channel) == true)
+    {
+        ret = _session->_channel->exec(*channel, command);
+    }
+    return ret;
+}
+
+bool CppsshConnection::openSubsystem(uint32_t* channel, const char* subsystem)
+{
+    bool ret = false;
+    if (_session->_channel->openSessionChannel(channel) == true)
+    {
+        ret = _session->_channel->subsystem(*channel, subsystem);
+    }
+    return ret;
+}
+
+// RFC 4254 section 7.2
+bool CppsshConnection::openDirectTcpip(uint32_t* channel, const std::string& host, uint32_t port,
+                                       const std::string& originatorHost, uint32_t originatorPort)
+{
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    packet.addString(host);
+    packet.addInt(port);
+    packet.addString(originatorHost);
+    packet.addInt(originatorPort);
+    return _session->_channel->beginChannelOpen("direct-tcpip", buf, channel);
+}
+
+// The OpenSSH PROTOCOL file, section 2.4, the reserved fields are sent empty
+bool CppsshConnection::openDirectStreamLocal(uint32_t* channel, const std::string& socketPath)
+{
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    packet.addString(socketPath);
+    packet.addString("");
+    packet.addInt(0);
+    return _session->_channel->beginChannelOpen("direct-streamlocal@openssh.com", buf, channel);
+}
+
+bool CppsshConnection::pollOpen(uint32_t channel, bool* opened)
+{
+    return _session->_channel->pollChannelOpen(channel, opened);
+}
+
+bool CppsshConnection::waitOpen(uint32_t channel)
+{
+    return _session->_channel->waitChannelOpen(channel);
+}
+
+bool CppsshConnection::requestRemoteForward(const std::string& address, uint32_t port, uint32_t* boundPort,
+                                            const std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> >& opens)
+{
+    return _connected && _session->_channel->tcpipForward(address, port, boundPort, opens);
+}
+
+bool CppsshConnection::cancelRemoteForward(const std::string& address, uint32_t port)
+{
+    return _connected && _session->_channel->cancelTcpipForward(address, port);
+}
+
+void CppsshConnection::confirmForwarded(uint32_t channel)
 {
-    return _session->_channel->writeMainChannel(data, bytes);
+    _session->_channel->confirmOpen(channel);
 }
 
-bool CppsshConnection::read(CppsshMessage* data)
+void CppsshConnection::refuseForwarded(uint32_t channel, CppsshOpenFailureReason reason)
 {
-    return _session->_channel->readMainChannel(data);
+    _session->_channel->refuseOpen(channel, reason);
 }
 
-bool CppsshConnection::windowChange(const uint32_t cols, const uint32_t rows)
+void CppsshConnection::closeSession(uint32_t channel)
 {
-    return _session->_channel->windowChange(cols, rows);
+    _session->_channel->closeChannel(channel);
 }
 
-bool CppsshConnection::isConnected()
+uint32_t CppsshConnection::getMainChannel() const
 {
-    return _connected && _session->_channel->isConnected();
+    return _mainChannel;
+}
+
+unsigned int CppsshConnection::getTimeout() const
+{
+    return _session->getTimeout();
+}
+
+bool CppsshConnection::write(uint32_t channel, const uint8_t* data, uint32_t bytes)
+{
+    return _session->_channel->writeChannel(channel, data, bytes);
+}
+
+bool CppsshConnection::read(uint32_t channel, CppsshMessage* data)
+{
+    return _session->_channel->readChannel(channel, data);
+}
+
+bool CppsshConnection::write(uint32_t channel, const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message)
+{
+    return _session->_channel->writeChannel(channel, message);
+}
+
+bool CppsshConnection::read(uint32_t channel, std::shared_ptr<CppsshMessage>* message)
+{
+    return _session->_channel->readChannel(channel, message);
+}
+
+uint32_t CppsshConnection::getMaxWrite(uint32_t channel)
+{
+    return _session->_channel->getMaxWrite(channel);
+}
+
+size_t CppsshConnection::getQueuedWrites(uint32_t channel)
+{
+    return _session->_channel->getQueuedWrites(channel);
+}
+
+size_t CppsshConnection::getQueuedReads(uint32_t channel)
+{
+    return _session->_channel->getQueuedReads(channel);
+}
+
+bool CppsshConnection::isRemoteDone(uint32_t channel)
+{
+    return _session->_channel->isRemoteDone(channel);
+}
+
+void CppsshConnection::sendEof(uint32_t channel)
+{
+    _session->_channel->sendEof(channel);
+}
+
+bool CppsshConnection::readStderr(uint32_t channel, CppsshMessage* data)
+{
+    return _session->_channel->readStderr(channel, data);
+}
+
+bool CppsshConnection::getExitStatus(uint32_t channel, int* exitStatus)
+{
+    return _session->_channel->getExitStatus(channel, exitStatus);
+}
+
+bool CppsshConnection::windowChange(uint32_t channel, const uint32_t cols, const uint32_t rows)
+{
+    return _session->_channel->windowChange(channel, cols, rows);
+}
+
+bool CppsshConnection::isConnected(uint32_t channel)
+{
+    return _connected && _session->_channel->isChannelOpen(channel);
+}
+
+bool CppsshConnection::isTransportConnected()
+{
+    return _connected && _session->_transport->isRunning();
+}
+
+bool CppsshConnection::ping()
+{
+    return _connected && _session->_channel->ping();
 }
 
 bool CppsshConnection::checkRemoteVersion()
 {
     bool ret = false;
-    Botan::secure_vector<Botan::byte> remoteVer;
-    if (_session->_transport->receiveMessage(&remoteVer) == true)
+    std::string rv;
+    if (_session->_transport->receiveVersion(&rv) == true)
     {
         std::string sshVer("SSH-2.0");
-        std::string rv(remoteVer.begin(), remoteVer.end());
         StrTrim::trim(rv);
         cdLog(LogLevel::Info) << "Remote version: " << rv;
-        if ((remoteVer.size() >= sshVer.length()) &&
-            std::equal(remoteVer.begin(), remoteVer.begin() + sshVer.length(), sshVer.begin()))
+        if (rv.compare(0, sshVer.length(), sshVer) == 0)
         {
             ret = true;
             _session->setRemoteVersion(rv);
@@ -255,7 +423,7 @@ bool CppsshConnection::authWithPassword(const std::string& username, const std::
 }
 
 bool CppsshConnection::authWithKey(const std::string& username, const std::string& privKeyFileName,
-                                   const char* keyPassword)
+                                   const char* keyPassword, bool immediate)
 {
     bool ret = false;
     CppsshKeys keyPair;
@@ -274,9 +442,9 @@ bool CppsshConnection::authWithKey(const std::string& username, const std::strin
         packetBegin.addString("ssh-connection");
         packetBegin.addString("publickey");
 
-        std::string algo = CppsshImpl::HOSTKEY_ALGORITHMS.enum2ssh(keyPair.getKeyAlgo());
-        std::transform(algo.begin(), algo.end(), algo.begin(), ::tolower);
-        packetEnd.addString(algo);
+        // Picked from server-sig-algs so the first signature is one the server takes
+        hostkeyMethods sigAlgo = keyPair.getSigAlgo(_session->getServerSigAlgs());
+        packetEnd.addString(CppsshImpl::HOSTKEY_ALGORITHMS.enum2ssh(sigAlgo));
         size_t packetSize = endBuf.size();
         packetEnd.addVectorField(keyPair.getPublicKeyBlob());
         if (packetSize == endBuf.size())
@@ -285,16 +453,21 @@ bool CppsshConnection::authWithKey(const std::string& username, const std::strin
         }
         else
         {
-            packet.addVector(beginBuf);
-            packet.addByte(0);
-            packet.addVector(endBuf);
-            if (authenticate(buf) == true)
+            bool accepted = immediate;
+            if (immediate == false)
             {
+                packet.addVector(beginBuf);
+                packet.addByte(0);
+                packet.addVector(endBuf);
+                accepted = authenticate(buf);
                 buf.clear();
+            }
+            if (accepted == true)
+            {
                 packet.addVector(beginBuf);
                 packet.addByte(1);
                 packet.addVector(endBuf);
-                Botan::secure_vector<Botan::byte> sigBlob = keyPair.generateSignature(_session->getSessionID(), buf);
+                Botan::secure_vector<Botan::byte> sigBlob = keyPair.generateSignature(_session->getSessionID(), buf, sigAlgo);
                 if (sigBlob.size() == 0)
                 {
                     cdLog(LogLevel::Error) << "Failure while generating the signature.";
@@ -303,7 +476,10 @@ bool CppsshConnection::authWithKey(const std::string& username, const std::strin
                 {
                     packet.addVectorField(sigBlob);
                     ret = authenticate(buf);
-                    cdLog(LogLevel::Debug) << "Authenticated with key: " << privKeyFileName;
+                    if (ret == true)
+                    {
+                        cdLog(LogLevel::Debug) << "Authenticated with key: " << privKeyFileName;
+                    }
                 }
             }
         }
@@ -311,6 +487,52 @@ bool CppsshConnection::authWithKey(const std::string& username, const std::strin
     return ret;
 }
 
+// Try what worked last time for this user and host first, a key that worked
+// is sent signed straight away.
+bool CppsshConnection::authenticateUser(const std::string& username, const std::string& privKeyFileName,
+                                        const char* password, const std::string& peer)
+{
+    bool ret = false;
+    bool passwordFirst = false;
+    bool immediate = CppsshImpl::getImmediateKeyAuth();
+    const std::string user(username + "@" + peer);
+    std::string method;
+
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(s_authMemoryMutex);
+        std::map<std::string, std::string>::const_iterator it = s_authMemory.find(user);
+        if (it != s_authMemory.cend())
+        {
+            passwordFirst = it->second.empty();
+            if ((passwordFirst == false) && (it->second == privKeyFileName))
+            {
+                immediate = true;
+            }
+        }
+    }
+
+    if ((passwordFirst == true) && (authWithPassword(username, password) == true))
+    {
+        ret = true;
+    }
+    else if (authWithKey(username, privKeyFileName, password, immediate) == true)
+    {
+        method = privKeyFileName;
+        ret = true;
+    }
+    else if ((passwordFirst == false) && (authWithPassword(username, password) == true))
+    {
+        ret = true;
+    }
+
+    if (ret == true)
+    {
+        std::unique_lock<std::mutex> lock(s_authMemoryMutex);
+        s_authMemory[user] = method;
+    }
+    return ret;
+}
+
 bool CppsshConnection::closeConnection()
 {
     _session->_transport->disconnect();
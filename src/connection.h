@@ -23,6 +23,8 @@
 #include "channel.h"
 #include "cppssh.h"
 #include <memory>
+#include <map>
+#include <mutex>
 
 class CppsshConnection
 {
@@ -30,22 +32,61 @@ public:
     CppsshConnection(int connectionId, unsigned int timeout);
     ~CppsshConnection();
     CppsshConnectStatus_t connect(const char* host, const short port, const char* username, const char* privKeyFile, const char* password, const bool x11Forwarded, const bool keepAlives, const char* term);
+    // Up to authentication, without opening a session channel
+    CppsshConnectStatus_t connectTransport(const char* host, const short port, const char* username, const char* privKeyFile, const char* password, const bool keepAlives);
+    // Another session channel on this connection, with a shell when term is set
+    bool openSession(uint32_t* channel, const bool x11Forwarded, const char* term);
+    // A session channel running command, without a pty
+    bool openExec(uint32_t* channel, const char* command);
+    bool openSubsystem(uint32_t* channel, const char* subsystem);
+    // Channels for local forwarding, the server connects on to host:port or the socket path.
+    // These only send the open, pollOpen or waitOpen finish it.
+    bool openDirectTcpip(uint32_t* channel, const std::string& host, uint32_t port, const std::string& originatorHost, uint32_t originatorPort);
+    bool openDirectStreamLocal(uint32_t* channel, const std::string& socketPath);
+    bool pollOpen(uint32_t channel, bool* opened);
+    bool waitOpen(uint32_t channel);
+    // Remote forwarding, the channels the server opens for the port are queued on opens
+    // and must be confirmed or refused once the local end is connected
+    bool requestRemoteForward(const std::string& address, uint32_t port, uint32_t* boundPort, const std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> >& opens);
+    bool cancelRemoteForward(const std::string& address, uint32_t port);
+    void confirmForwarded(uint32_t channel);
+    void refuseForwarded(uint32_t channel, CppsshOpenFailureReason reason);
+    void closeSession(uint32_t channel);
+    uint32_t getMainChannel() const;
+    unsigned int getTimeout() const;
 
-    bool write(const uint8_t* data, uint32_t bytes);
-    bool read(CppsshMessage* data);
-    bool windowChange(const uint32_t cols, const uint32_t rows);
-    bool isConnected();
+    bool write(uint32_t channel, const uint8_t* data, uint32_t bytes);
+    bool read(uint32_t channel, CppsshMessage* data);
+    bool readStderr(uint32_t channel, CppsshMessage* data);
+    bool write(uint32_t channel, const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message);
+    bool read(uint32_t channel, std::shared_ptr<CppsshMessage>* message);
+    uint32_t getMaxWrite(uint32_t channel);
+    size_t getQueuedWrites(uint32_t channel);
+    size_t getQueuedReads(uint32_t channel);
+    bool isRemoteDone(uint32_t channel);
+    void sendEof(uint32_t channel);
+    bool getExitStatus(uint32_t channel, int* exitStatus);
+    bool windowChange(uint32_t channel, const uint32_t cols, const uint32_t rows);
+    bool isConnected(uint32_t channel);
+    bool isTransportConnected();
+    bool ping();
     bool closeConnection();
 private:
     bool checkRemoteVersion();
     bool sendLocalVersion();
     bool requestService(const std::string& service);
     bool authWithPassword(const std::string& username, const std::string& password);
-    bool authWithKey(const std::string& username, const std::string& privKeyFileName, const char* keyPassword);
+    bool authWithKey(const std::string& username, const std::string& privKeyFileName, const char* keyPassword, bool immediate);
+    bool authenticateUser(const std::string& username, const std::string& privKeyFileName, const char* password, const std::string& peer);
     bool authenticate(const Botan::secure_vector<Botan::byte>& userAuthRequest);
 
     std::shared_ptr<CppsshSession> _session;
     bool _connected;
+    uint32_t _mainChannel;
+
+    // What last authenticated user@host:port, the key file or empty for the password
+    static std::map<std::string, std::string> s_authMemory;
+    static std::mutex s_authMemoryMutex;
 };
 
 #endif
@@ -0,0 +1,381 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "connectionpool.h"
+#include "CDLogger/Logger.h"
+#include "botan/hash.h"
+#include "botan/hex.h"
+#include <map>
+
+CppsshConnectionPool::CppsshConnectionPool(const std::function<int()>& nextConnectionId)
+    : _nextConnectionId(nextConnectionId),
+    _maxChannels(0),
+    _idleTime(0),
+    _healthCheckTime(0),
+    _running(true)
+{
+    _maintenanceThread = std::thread(&CppsshConnectionPool::maintenanceThread, this);
+}
+
+CppsshConnectionPool::~CppsshConnectionPool()
+{
+    stop();
+}
+
+void CppsshConnectionPool::stop()
+{
+    std::vector<Entry> entries;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_all();
+    if (_maintenanceThread.joinable() == true)
+    {
+        _maintenanceThread.join();
+    }
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        entries.swap(_entries);
+        _targets.clear();
+    }
+    for (Entry& entry : entries)
+    {
+        entry._connection->closeConnection();
+    }
+}
+
+void CppsshConnectionPool::configure(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds)
+{
+    std::vector<std::shared_ptr<CppsshConnection> > closing;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _maxChannels = maxChannels;
+        _idleTime = std::chrono::seconds(idleSeconds);
+        _healthCheckTime = std::chrono::seconds(healthCheckSeconds);
+        if (_maxChannels == 0)
+        {
+            _targets.clear();
+        }
+    }
+    evict(&closing);
+    for (std::shared_ptr<CppsshConnection>& connection : closing)
+    {
+        connection->closeConnection();
+    }
+    _cond.notify_all();
+}
+
+bool CppsshConnectionPool::isEnabled()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return (_maxChannels > 0);
+}
+
+bool CppsshConnectionPool::preconnect(const char* host, const short port, const char* username,
+                                      const char* privKeyFile, const char* password, unsigned int timeout,
+                                      size_t count)
+{
+    bool ret = false;
+    Target target;
+    target._key = makeKey(host, port, username, privKeyFile, password);
+    target._host = host;
+    target._port = port;
+    target._username = username;
+    target._privKeyFile = (privKeyFile != nullptr) ? privKeyFile : "";
+    target._hasPassword = (password != nullptr);
+    target._password = (password != nullptr) ? password : "";
+    target._timeout = timeout;
+    target._count = count;
+    target._retryAt = std::chrono::steady_clock::now();
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_maxChannels == 0)
+        {
+            cdLog(LogLevel::Error) << "The connection pool is disabled, not pre-connecting to " << host;
+        }
+        else
+        {
+            std::vector<Target>::iterator it;
+            for (it = _targets.begin(); (it != _targets.end()) && (it->_key != target._key); it++)
+            {
+            }
+            if (it != _targets.end())
+            {
+                _targets.erase(it);
+            }
+            if (count > 0)
+            {
+                _targets.push_back(target);
+            }
+            ret = true;
+        }
+    }
+    _cond.notify_all();
+    return ret;
+}
+
+std::string CppsshConnectionPool::makeKey(const char* host, const short port, const char* username,
+                                          const char* privKeyFile, const char* password)
+{
+    std::string key(std::string(host) + ":" + std::to_string(port) + ":" + username + ":");
+    if (privKeyFile != nullptr)
+    {
+        key.append(privKeyFile);
+    }
+    key.append(":");
+    if (password != nullptr)
+    {
+        std::unique_ptr<Botan::HashFunction> hash(Botan::HashFunction::create("SHA-256"));
+        hash->update(password);
+        key.append(Botan::hex_encode(hash->final()));
+    }
+    return key;
+}
+
+std::shared_ptr<CppsshConnection> CppsshConnectionPool::acquire(const std::string& key)
+{
+    std::shared_ptr<CppsshConnection> ret;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (Entry& entry : _entries)
+    {
+        if ((entry._key == key) && (entry._healthy == true) && (entry._channels < _maxChannels) &&
+            (entry._connection->isTransportConnected() == true))
+        {
+            entry._channels++;
+            entry._lastUsed = std::chrono::steady_clock::now();
+            ret = entry._connection;
+            break;
+        }
+    }
+    return ret;
+}
+
+void CppsshConnectionPool::add(const std::string& key, const std::shared_ptr<CppsshConnection>& connection)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _entries.push_back(Entry(key, connection, 1));
+}
+
+bool CppsshConnectionPool::reserve(const std::shared_ptr<CppsshConnection>& connection)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (Entry& entry : _entries)
+    {
+        if ((entry._connection == connection) && (entry._channels < _maxChannels))
+        {
+            entry._channels++;
+            entry._lastUsed = std::chrono::steady_clock::now();
+            ret = true;
+            break;
+        }
+    }
+    return ret;
+}
+
+void CppsshConnectionPool::release(const std::shared_ptr<CppsshConnection>& connection, bool healthy)
+{
+    bool found = false;
+    std::vector<std::shared_ptr<CppsshConnection> > closing;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (Entry& entry : _entries)
+        {
+            if (entry._connection == connection)
+            {
+                found = true;
+                if (entry._channels > 0)
+                {
+                    entry._channels--;
+                }
+                entry._lastUsed = std::chrono::steady_clock::now();
+                if (healthy == false)
+                {
+                    entry._healthy = false;
+                }
+                break;
+            }
+        }
+    }
+    if (found == false)
+    {
+        connection->closeConnection();
+    }
+    else
+    {
+        evict(&closing);
+    }
+    for (std::shared_ptr<CppsshConnection>& con : closing)
+    {
+        con->closeConnection();
+    }
+}
+
+void CppsshConnectionPool::maintenanceThread()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running == true)
+    {
+        _cond.wait_for(lock, std::chrono::seconds(1));
+        if ((_running == true) && (_maxChannels > 0))
+        {
+            std::vector<std::shared_ptr<CppsshConnection> > closing;
+            lock.unlock();
+            evict(&closing);
+            for (std::shared_ptr<CppsshConnection>& connection : closing)
+            {
+                connection->closeConnection();
+            }
+            checkHealth();
+            fillTargets();
+            lock.lock();
+        }
+    }
+}
+
+// Idle connections that failed, or were not used for too long, are taken out
+// of the pool and returned in closing. Pre-connect targets keep theirs.
+void CppsshConnectionPool::evict(std::vector<std::shared_ptr<CppsshConnection> >* closing)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::map<std::string, size_t> keep;
+    for (const Target& target : _targets)
+    {
+        keep[target._key] = target._count;
+    }
+    std::vector<Entry>::iterator it = _entries.begin();
+    while (it != _entries.end())
+    {
+        bool remove = false;
+        if (it->_channels == 0)
+        {
+            if ((_maxChannels == 0) || (it->_healthy == false) || (it->_connection->isTransportConnected() == false))
+            {
+                remove = true;
+            }
+            else if (keep[it->_key] > 0)
+            {
+                keep[it->_key]--;
+            }
+            else if ((_idleTime.count() > 0) && ((now - it->_lastUsed) >= _idleTime))
+            {
+                remove = true;
+            }
+        }
+        if (remove == true)
+        {
+            cdLog(LogLevel::Debug) << "Closing pooled connection to " << it->_key.substr(0, it->_key.find(':'));
+            closing->push_back(it->_connection);
+            it = _entries.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+// Only idle connections are checked, the ones in use find out on their own
+void CppsshConnectionPool::checkHealth()
+{
+    std::vector<std::shared_ptr<CppsshConnection> > checking;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (_healthCheckTime.count() > 0)
+        {
+            for (Entry& entry : _entries)
+            {
+                if ((entry._channels == 0) && ((now - entry._lastCheck) >= _healthCheckTime))
+                {
+                    entry._lastCheck = now;
+                    checking.push_back(entry._connection);
+                }
+            }
+        }
+    }
+    for (std::shared_ptr<CppsshConnection>& connection : checking)
+    {
+        if (connection->ping() == false)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (Entry& entry : _entries)
+            {
+                if (entry._connection == connection)
+                {
+                    entry._healthy = false;
+                }
+            }
+        }
+    }
+}
+
+// One new connection per target and pass, so stopping never waits long
+void CppsshConnectionPool::fillTargets()
+{
+    std::vector<Target> targets;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (const Target& target : _targets)
+        {
+            size_t count = 0;
+            for (const Entry& entry : _entries)
+            {
+                if ((entry._key == target._key) && (entry._channels == 0) && (entry._healthy == true))
+                {
+                    count++;
+                }
+            }
+            if ((count < target._count) && (now >= target._retryAt))
+            {
+                targets.push_back(target);
+            }
+        }
+    }
+    for (const Target& target : targets)
+    {
+        std::shared_ptr<CppsshConnection> connection(new CppsshConnection(_nextConnectionId(), target._timeout));
+        CppsshConnectStatus_t status = connection->connectTransport(target._host.c_str(), target._port,
+                                                                    target._username.c_str(),
+                                                                    target._privKeyFile.empty() ? nullptr : target._privKeyFile.c_str(),
+                                                                    target._hasPassword ? target._password.c_str() : nullptr,
+                                                                    false);
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (status == CPPSSH_CONNECT_OK)
+        {
+            _entries.push_back(Entry(target._key, connection, 0));
+        }
+        else
+        {
+            cdLog(LogLevel::Error) << "Unable to pre-connect to " << target._host << ": " << status;
+            for (Target& t : _targets)
+            {
+                if (t._key == target._key)
+                {
+                    t._retryAt = std::chrono::steady_clock::now() + std::chrono::seconds(CPPSSH_POOL_RETRY_SECONDS);
+                }
+            }
+            lock.unlock();
+            connection->closeConnection();
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _CONNECTION_POOL_Hxx
+#define _CONNECTION_POOL_Hxx
+
+#include "connection.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#define CPPSSH_POOL_MAX_CHANNELS 64
+#define CPPSSH_POOL_RETRY_SECONDS 30
+
+// Authenticated connections kept open after their sessions close, so the
+// next connect to the same host, user and credentials only has to open a
+// channel. Connections are keyed on everything that went into authenticating
+// them, a password is only kept as a hash in the key.
+class CppsshConnectionPool
+{
+public:
+    // Pre-connected connections get their ids from nextConnectionId
+    explicit CppsshConnectionPool(const std::function<int()>& nextConnectionId);
+    CppsshConnectionPool() = delete;
+    CppsshConnectionPool(const CppsshConnectionPool&) = delete;
+    ~CppsshConnectionPool();
+    // Closes every pooled connection, the pool can't be used after this
+    void stop();
+
+    // maxChannels of 0 disables the pool and closes the idle connections
+    void configure(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds);
+    bool isEnabled();
+    // Keep count idle connections for these credentials, opened in the background
+    bool preconnect(const char* host, const short port, const char* username, const char* privKeyFile, const char* password, unsigned int timeout, size_t count);
+
+    static std::string makeKey(const char* host, const short port, const char* username, const char* privKeyFile, const char* password);
+    // A connection for key with a free channel, counted as in use, or nullptr
+    std::shared_ptr<CppsshConnection> acquire(const std::string& key);
+    // A connection just opened by connect, with one session in use
+    void add(const std::string& key, const std::shared_ptr<CppsshConnection>& connection);
+    // One more session on a connection already handed out, false when it has no free channel
+    bool reserve(const std::shared_ptr<CppsshConnection>& connection);
+    // A session on the connection was closed, healthy is false when opening it failed
+    void release(const std::shared_ptr<CppsshConnection>& connection, bool healthy = true);
+
+private:
+    class Entry
+    {
+    public:
+        Entry(const std::string& key, const std::shared_ptr<CppsshConnection>& connection, size_t channels)
+            : _key(key),
+            _connection(connection),
+            _channels(channels),
+            _healthy(true),
+            _lastUsed(std::chrono::steady_clock::now()),
+            _lastCheck(_lastUsed)
+        {
+        }
+
+        std::string _key;
+        std::shared_ptr<CppsshConnection> _connection;
+        size_t _channels;
+        bool _healthy;
+        std::chrono::steady_clock::time_point _lastUsed;
+        std::chrono::steady_clock::time_point _lastCheck;
+    };
+
+    class Target
+    {
+    public:
+        std::string _key;
+        std::string _host;
+        short _port;
+        std::string _username;
+        std::string _privKeyFile;
+        // A key without a password is not the same as an empty password
+        bool _hasPassword;
+        std::string _password;
+        unsigned int _timeout;
+        size_t _count;
+        std::chrono::steady_clock::time_point _retryAt;
+    };
+
+    void maintenanceThread();
+    void evict(std::vector<std::shared_ptr<CppsshConnection> >* closing);
+    void checkHealth();
+    void fillTargets();
+
+    const std::function<int()> _nextConnectionId;
+    std::vector<Entry> _entries;
+    std::vector<Target> _targets;
+    size_t _maxChannels;
+    std::chrono::seconds _idleTime;
+    std::chrono::seconds _healthCheckTime;
+    bool _running;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _maintenanceThread;
+};
+
+#endif
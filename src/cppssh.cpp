@@ -139,6 +139,243 @@ bool Cppssh::close(const int connectionId)
     return ret;
 }
 
+bool Cppssh::openChannel(const int connectionId, int* channelId, const bool x11Forwarded, const char* term)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->openChannel(connectionId, channelId, x11Forwarded, term, nullptr, nullptr);
+    }
+    return ret;
+}
+
+bool Cppssh::exec(const int connectionId, int* channelId, const char* command)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->openChannel(connectionId, channelId, false, nullptr, command, nullptr);
+    }
+    return ret;
+}
+
+bool Cppssh::readStderr(const int channelId, CppsshMessage* data)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->readStderr(channelId, data);
+    }
+    return ret;
+}
+
+bool Cppssh::getExitStatus(const int channelId, int* exitStatus)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->getExitStatus(channelId, exitStatus);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpOpen(const int connectionId, int* sftpId)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpOpen(connectionId, sftpId);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpGet(const int sftpId, const char* remotePath, const char* localPath)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpGet(sftpId, remotePath, localPath);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpPut(const int sftpId, const char* localPath, const char* remotePath, uint32_t mode)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpPut(sftpId, localPath, remotePath, mode);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpMkdir(const int sftpId, const char* path, uint32_t mode)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpMkdir(sftpId, path, mode);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpRemove(const int sftpId, const char* path)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpRemove(sftpId, path);
+    }
+    return ret;
+}
+
+bool Cppssh::sftpGetFileSize(const int sftpId, const char* path, uint64_t* size)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->sftpGetFileSize(sftpId, path, size);
+    }
+    return ret;
+}
+
+bool Cppssh::transferGet(const int* connectionIds, size_t connections, size_t streamsPerConnection,
+                         const char* remotePath, const char* localPath)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->transfer(connectionIds, connections, streamsPerConnection, true, remotePath, localPath);
+    }
+    return ret;
+}
+
+bool Cppssh::transferPut(const int* connectionIds, size_t connections, size_t streamsPerConnection,
+                         const char* localPath, const char* remotePath)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->transfer(connectionIds, connections, streamsPerConnection, false, localPath, remotePath);
+    }
+    return ret;
+}
+
+size_t Cppssh::getTransferRates(char* rates)
+{
+    size_t ret = 0;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->getTransferRates(rates);
+    }
+    return ret;
+}
+
+bool Cppssh::scpPut(const int connectionId, const char* localPath, const char* remotePath, uint32_t mode,
+                    double* mbps)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->scp(connectionId, false, localPath, remotePath, mode, mbps);
+    }
+    return ret;
+}
+
+bool Cppssh::scpGet(const int connectionId, const char* remotePath, const char* localPath, double* mbps)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->scp(connectionId, true, localPath, remotePath, 0, mbps);
+    }
+    return ret;
+}
+
+bool Cppssh::forwardLocal(const int connectionId, const char* listen, const short listenPort, const char* remote,
+                          const short remotePort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->forwardLocal(connectionId, listen, listenPort, remote, remotePort);
+    }
+    return ret;
+}
+
+bool Cppssh::cancelForwardLocal(const int connectionId, const char* listen, const short listenPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->cancelForwardLocal(connectionId, listen, listenPort);
+    }
+    return ret;
+}
+
+bool Cppssh::forwardRemote(const int connectionId, const char* bindAddress, const short bindPort, const char* local,
+                           const short localPort, short* boundPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->forwardRemote(connectionId, bindAddress, bindPort, local, localPort, boundPort);
+    }
+    return ret;
+}
+
+bool Cppssh::cancelForwardRemote(const int connectionId, const char* bindAddress, const short bindPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->cancelForwardRemote(connectionId, bindAddress, bindPort);
+    }
+    return ret;
+}
+
+bool Cppssh::setConnectionPool(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->setConnectionPool(maxChannels, idleSeconds, healthCheckSeconds);
+    }
+    return ret;
+}
+
+bool Cppssh::preconnect(const char* host, const short port, const char* username, const char* privKeyFile,
+                        const char* password, unsigned int timeout, size_t count)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshImpl> cppsshInst = s_cppsshInst;
+    if (cppsshInst != nullptr)
+    {
+        ret = cppsshInst->preconnect(host, port, username, privKeyFile, password, timeout, count);
+    }
+    return ret;
+}
+
 bool Cppssh::setPreferredCipher(const char* prefCipher)
 {
     return CppsshImpl::setPreferredCipher(prefCipher);
@@ -149,6 +386,61 @@ bool Cppssh::setPreferredHmac(const char* prefHmac)
     return CppsshImpl::setPreferredHmac(prefHmac);
 }
 
+bool Cppssh::setCtrKeystreamPrefill(size_t bufferSize, bool refillWhenIdle)
+{
+    return CppsshImpl::setCtrKeystreamPrefill(bufferSize, refillWhenIdle);
+}
+
+bool Cppssh::setParallelCtr(unsigned int threads, size_t minChunkSize)
+{
+    return CppsshImpl::setParallelCtr(threads, minChunkSize);
+}
+
+bool Cppssh::tuneAlgorithms(CppsshTuneMode_t mode)
+{
+    return CppsshImpl::tuneAlgorithms(mode);
+}
+
+size_t Cppssh::getAlgorithmRates(char* rates)
+{
+    return CppsshImpl::getAlgorithmRates(rates);
+}
+
+bool Cppssh::setKexKeyPool(size_t depth, size_t lowWater, bool wipeAfterUse)
+{
+    return CppsshImpl::setKexKeyPool(depth, lowWater, wipeAfterUse);
+}
+
+void Cppssh::getKexKeyPoolStats(uint64_t* hits, uint64_t* misses)
+{
+    CppsshImpl::getKexKeyPoolStats(hits, misses);
+}
+
+void Cppssh::setRekeyLimits(uint64_t bytes, uint32_t seconds)
+{
+    CppsshImpl::setRekeyLimits(bytes, seconds);
+}
+
+void Cppssh::setKexGuess(bool enable)
+{
+    CppsshImpl::setKexGuess(enable);
+}
+
+void Cppssh::setKexPipeline(bool enable)
+{
+    CppsshImpl::setKexPipeline(enable);
+}
+
+void Cppssh::setImmediateKeyAuth(bool enable)
+{
+    CppsshImpl::setImmediateKeyAuth(enable);
+}
+
+bool Cppssh::setSftpPipeline(size_t requests, uint32_t requestSize)
+{
+    return CppsshImpl::setSftpPipeline(requests, requestSize);
+}
+
 size_t Cppssh::getSupportedCiphers(char* ciphers)
 {
     return CppsshImpl::getSupportedCiphers(ciphers);
@@ -192,12 +484,19 @@ const uint8_t* CppsshMessage::message() const
 
 CppsshMessage& CppsshMessage::operator=(const CppsshMessage& other)
 {
-    setMessage(other._message, other._len);
+    if (this != &other)
+    {
+        setMessage(other._message, other._len);
+    }
     return *this;
 }
 
 void CppsshMessage::setMessage(const uint8_t* message, size_t bytes)
 {
+    if (_message != nullptr)
+    {
+        delete[] _message;
+    }
     _message = new uint8_t[bytes + 1];
     _len = bytes;
     memcpy(_message, message, _len);
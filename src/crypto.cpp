@@ -20,20 +20,24 @@
 #include "crypto.h"
 #include "packet.h"
 #include "impl.h"
+#include "umac.h"
 #include "strtrim.h"
 #include "botan/pubkey.h"
 #include "botan/cbc.h"
-#include "botan/cipher_filter.h"
 #include "botan/stream_mode.h"
 #include "botan/ctr.h"
+#include "botan/aead.h"
+#include "botan/mem_ops.h"
+#include "botan/loadstor.h"
 #include <string>
+#include <algorithm>
 
 CppsshCrypto::CppsshCrypto(const std::shared_ptr<CppsshSession>& session)
     : _session(session),
-    _encryptFilter(nullptr),
-    _decryptFilter(nullptr),
     _encryptBlockSize(0),
     _decryptBlockSize(0),
+    _encryptAadLen(0),
+    _decryptAadLen(0),
     _c2sMacDigestLen(0),
     _s2cMacDigestLen(0),
     _c2sMacMethod(macMethods::HMAC_MD5),
@@ -47,40 +51,132 @@ CppsshCrypto::CppsshCrypto(const std::shared_ptr<CppsshSession>& session)
 {
 }
 
-void CppsshCrypto::setNonce(Botan::Keyed_Filter* filter, Botan::secure_vector<Botan::byte>& nonce) const
+bool CppsshCrypto::isEtm(macMethods macMethod)
 {
-    // reset the IV (nonce)
-    for (int i = nonce.size() - 1; i >= 0; i--)
-    {
-        if ((nonce[i] = (nonce[i] + 1)) != 0)
+    return ((macMethod == macMethods::HMAC_SHA256_ETM) || (macMethod == macMethods::HMAC_SHA1_ETM) ||
+            (macMethod == macMethods::UMAC_64_ETM) || (macMethod == macMethods::UMAC_128_ETM));
+}
+
+bool CppsshCrypto::isCurve25519(kexMethods kexMethod)
+{
+    return ((kexMethod == kexMethods::CURVE25519_SHA256) || (kexMethod == kexMethods::CURVE25519_SHA256_LIBSSH));
+}
+
+bool CppsshCrypto::isEcdh(kexMethods kexMethod)
+{
+    return ((kexMethod == kexMethods::ECDH_SHA2_NISTP256) || (kexMethod == kexMethods::ECDH_SHA2_NISTP384) ||
+            (kexMethod == kexMethods::ECDH_SHA2_NISTP521));
+}
+
+bool CppsshCrypto::isUmac(macMethods macMethod)
+{
+    return ((macMethod == macMethods::UMAC_64) || (macMethod == macMethods::UMAC_128) ||
+            (macMethod == macMethods::UMAC_64_ETM) || (macMethod == macMethods::UMAC_128_ETM));
+}
+
+bool CppsshCrypto::isAead(cryptoMethods cryptoMethod)
+{
+    return ((cryptoMethod == cryptoMethods::AES128_GCM) || (cryptoMethod == cryptoMethods::AES256_GCM) ||
+            (cryptoMethod == cryptoMethods::CHACHA20_POLY1305));
+}
+
+void CppsshCrypto::startAead(Botan::Cipher_Mode* cipher, Botan::secure_vector<Botan::byte>* nonce,
+                             const Botan::byte* aad, uint32_t aadLen) const
+{
+    Botan::AEAD_Mode* aead = dynamic_cast<Botan::AEAD_Mode*>(cipher);
+    // The associated data has to be set before the message is started
+    aead->set_associated_data(aad, aadLen);
+    aead->start(*nonce);
+    // RFC 5647: the last 8 bytes of the nonce are a big endian invocation counter
+    for (size_t i = nonce->size(); i > nonce->size() - 8; i--)
+    {
+        if (++(*nonce)[i - 1] != 0)
         {
             break;
         }
     }
-    filter->set_iv(Botan::InitializationVector(nonce));
+}
+
+// HMAC takes the sequence number as the start of the message, UMAC takes it
+// as a 64 bit big endian nonce.
+void CppsshCrypto::startMac(Botan::MessageAuthenticationCode* mac, macMethods macMethod, uint32_t seq) const
+{
+    if (isUmac(macMethod) == true)
+    {
+        Botan::byte nonce[CppsshUmac::NONCE_LEN];
+        Botan::store_be((uint64_t)seq, nonce);
+        mac->start(nonce, sizeof(nonce));
+    }
+    else
+    {
+        mac->update_be(seq);
+    }
+}
+
+void CppsshCrypto::encryptBlocks(Botan::byte* data, uint32_t len)
+{
+    if (_encryptCtr != nullptr)
+    {
+        _encryptCtr->process(data, len);
+    }
+    else
+    {
+        _encrypt->process(data, len);
+    }
+}
+
+void CppsshCrypto::decryptBlocks(Botan::byte* data, uint32_t len)
+{
+    if (_decryptCtr != nullptr)
+    {
+        _decryptCtr->process(data, len);
+    }
+    else
+    {
+        _decrypt->process(data, len);
+    }
 }
 
 bool CppsshCrypto::encryptPacket(Botan::secure_vector<Botan::byte>* encrypted, Botan::secure_vector<Botan::byte>* hmac,
                                  const Botan::byte* decrypted, uint32_t len, uint32_t seq)
 {
     bool ret = false;
-    Botan::secure_vector<Botan::byte> macStr;
 
     try
     {
-        uint32_t encryptBlockSize = getEncryptBlockSize();
-        for (uint32_t pktIndex = 0; pktIndex < len; pktIndex += encryptBlockSize)
+        // Encrypt the whole packet in place at the end of the output buffer
+        size_t offset = encrypted->size();
+        encrypted->insert(encrypted->end(), decrypted, decrypted + len);
+        if (_encryptChaChaPoly != nullptr)
+        {
+            _encryptChaChaPoly->encrypt(encrypted->data() + offset, len, seq, hmac);
+        }
+        else if (isAead(_c2sCryptoMethod) == true)
+        {
+            // The packet length goes out in the clear, and the tag takes the place of the mac
+            startAead(_encrypt.get(), &_encryptNonce, encrypted->data() + offset, _encryptAadLen);
+            _encrypt->process(encrypted->data() + offset + _encryptAadLen, len - _encryptAadLen);
+            hmac->clear();
+            _encrypt->finish(*hmac);
+        }
+        else
         {
-            _encrypt->process_msg(decrypted + pktIndex, encryptBlockSize);
-            *encrypted += _encrypt->read_all(_encrypt->message_count() - 1);
-            setNonce(_encryptFilter, _c2sNonce);
+            // With encrypt-then-mac the packet length is left in the clear
+            encryptBlocks(encrypted->data() + offset + _encryptAadLen, len - _encryptAadLen);
         }
         if (_hmacOut != nullptr)
         {
-            CppsshPacket mac(&macStr);
-            mac.addInt(seq);
-            mac.addRawData(decrypted, len);
-            *hmac = _hmacOut->process(macStr);
+            startMac(_hmacOut.get(), _c2sMacMethod, seq);
+            if (isEtm(_c2sMacMethod) == true)
+            {
+                _hmacOut->update(encrypted->data() + offset, len);
+            }
+            else
+            {
+                _hmacOut->update(decrypted, len);
+            }
+            hmac->resize(_c2sMacDigestLen);
+            _hmacOut->final(hmac->data());
         }
 
         ret = true;
@@ -93,24 +189,20 @@ bool CppsshCrypto::encryptPacket(Botan::secure_vector<Botan::byte>* encrypted, B
     return ret;
 }
 
-bool CppsshCrypto::decryptPacket(Botan::secure_vector<Botan::byte>* decrypted,
-                                 const Botan::byte* encrypted, uint32_t len)
+bool CppsshCrypto::decryptHeader(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t seq)
 {
     bool ret = false;
-    uint32_t decryptBlockSize = getDecryptBlockSize();
-    if (len % decryptBlockSize)
-    {
-        len = len + (len % decryptBlockSize);
-    }
 
     try
     {
-        for (uint32_t pktIndex = 0; pktIndex < len; pktIndex += decryptBlockSize)
+        std::copy(encrypted, encrypted + getDecryptHeaderLen(), decrypted);
+        if (_decryptChaChaPoly != nullptr)
+        {
+            _decryptChaChaPoly->cryptLength(decrypted, encrypted, seq);
+        }
+        else if (_decryptAadLen == 0)
         {
-            Botan::secure_vector<Botan::byte> e(encrypted + pktIndex, encrypted + pktIndex + decryptBlockSize);
-            _decrypt->process_msg(e);
-            *decrypted += _decrypt->read_all(_decrypt->message_count() - 1);
-            setNonce(_decryptFilter, _s2cNonce);
+            decryptBlocks(decrypted, getDecryptHeaderLen());
         }
         ret = true;
     }
@@ -122,28 +214,81 @@ bool CppsshCrypto::decryptPacket(Botan::secure_vector<Botan::byte>* decrypted,
     return ret;
 }
 
-void CppsshCrypto::computeMac(Botan::secure_vector<Botan::byte>* hmac, const Botan::secure_vector<Botan::byte>& packet,
-                              uint32_t seq) const
+// Decrypt the rest of a packet whose header has already been through decryptHeader.
+// Both pointers address the start of the packet, and for AEAD ciphers the tag
+// is expected immediately after the encrypted packet.
+bool CppsshCrypto::decryptPacket(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t len, uint32_t seq)
 {
-    Botan::secure_vector<Botan::byte> macStr;
-    try
+    bool ret = false;
+    const uint32_t headerLen = getDecryptHeaderLen();
+
+    if ((len < headerLen) || (((len - _decryptAadLen) % getDecryptBlockSize()) != 0))
     {
-        if (_hmacIn)
+        cdLog(LogLevel::Error) << "Encrypted data is not a multiple of the block size: " << len;
+    }
+    else
+    {
+        try
         {
-            CppsshPacket mac(&macStr);
-            mac.addInt(seq);
-            macStr += packet;
-            *hmac = _hmacIn->process(macStr);
+            if (_decryptChaChaPoly != nullptr)
+            {
+                ret = _decryptChaChaPoly->decrypt(decrypted, encrypted, len, encrypted + len, seq);
+                if (ret == false)
+                {
+                    cdLog(LogLevel::Error) << "Mismatched poly1305 tags.";
+                }
+            }
+            else if (isAead(_s2cCryptoMethod) == true)
+            {
+                std::copy(encrypted + headerLen, encrypted + len, decrypted + headerLen);
+                startAead(_decrypt.get(), &_decryptNonce, encrypted, _decryptAadLen);
+                _decrypt->process(decrypted + headerLen, len - headerLen);
+                _decryptTag.assign(encrypted + len, encrypted + len + _s2cMacDigestLen);
+                // Throws when the tag does not match
+                _decrypt->finish(_decryptTag);
+                ret = true;
+            }
+            else if ((isEtm(_s2cMacMethod) == true) && (verifyMac(encrypted, len, encrypted + len, seq) == false))
+            {
+                // Corrupt packets are rejected without spending time decrypting them
+                cdLog(LogLevel::Error) << "Mismatched HMACs.";
+            }
+            else
+            {
+                std::copy(encrypted + headerLen, encrypted + len, decrypted + headerLen);
+                decryptBlocks(decrypted + headerLen, len - headerLen);
+                ret = true;
+            }
         }
-        else
+        catch (const std::exception& ex)
         {
-            hmac->clear();
+            cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
+        }
+    }
+
+    return ret;
+}
+
+// The mac is fed the sequence number and then the packet straight from the
+// caller's buffer. final() leaves the keyed state ready for the next packet.
+bool CppsshCrypto::verifyMac(const Botan::byte* packet, uint32_t len, const Botan::byte* mac, uint32_t seq)
+{
+    bool ret = false;
+    try
+    {
+        if (_hmacIn != nullptr)
+        {
+            startMac(_hmacIn.get(), _s2cMacMethod, seq);
+            _hmacIn->update(packet, len);
+            _hmacIn->final(_macIn.data());
+            ret = Botan::same_mem(_macIn.data(), mac, _s2cMacDigestLen);
         }
     }
     catch (const std::exception& ex)
     {
         cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
     }
+    return ret;
 }
 
 bool CppsshCrypto::setNegotiatedKex(const kexMethods kexAlgo)
@@ -161,11 +306,17 @@ bool CppsshCrypto::setNegotiatedKex(const kexMethods kexAlgo)
     return ret;
 }
 
-bool CppsshCrypto::setNegotiatedMac(const macMethods macAlgo, macMethods* macMethod)
+bool CppsshCrypto::setNegotiatedMac(const macMethods macAlgo, cryptoMethods cryptoMethod, macMethods* macMethod)
 {
     bool ret = false;
 
-    if (macAlgo == macMethods::MAX_VALS)
+    if (isAead(cryptoMethod) == true)
+    {
+        // AEAD ciphers authenticate the packet themselves, the negotiated mac is not used
+        *macMethod = macMethods::HMAC_NONE;
+        ret = true;
+    }
+    else if (macAlgo == macMethods::MAX_VALS)
     {
         cdLog(LogLevel::Error) << "Mac algorithm not defined.";
     }
@@ -235,12 +386,12 @@ bool CppsshCrypto::setNegotiatedCryptoS2c(const cryptoMethods cryptoAlgo)
 
 bool CppsshCrypto::setNegotiatedMacC2s(const macMethods macAlgo)
 {
-    return setNegotiatedMac(macAlgo, &_c2sMacMethod);
+    return setNegotiatedMac(macAlgo, _c2sCryptoMethod, &_c2sMacMethod);
 }
 
 bool CppsshCrypto::setNegotiatedMacS2c(const macMethods macAlgo)
 {
-    return setNegotiatedMac(macAlgo, &_s2cMacMethod);
+    return setNegotiatedMac(macAlgo, _s2cCryptoMethod, &_s2cMacMethod);
 }
 
 bool CppsshCrypto::setNegotiatedCmprsC2s(const compressionMethods cmprsAlgo)
@@ -253,52 +404,81 @@ bool CppsshCrypto::setNegotiatedCmprsS2c(const compressionMethods cmprsAlgo)
     return setNegotiatedCmprs(cmprsAlgo, &_s2cCmprsMethod);
 }
 
-bool CppsshCrypto::getKexPublic(Botan::BigInt& publicKey)
+bool CppsshCrypto::getKexPublic(Botan::secure_vector<Botan::byte>* publicKey)
 {
-    bool ret = true;
-    std::string dlGroup(CppsshImpl::KEX_ALGORITHMS.enum2botan(_kexMethod));
-    if (dlGroup.length() == 0)
+    bool ret = false;
+    std::string group(CppsshImpl::KEX_ALGORITHMS.enum2botan(_kexMethod));
+    if (group.length() == 0)
     {
         cdLog(LogLevel::Error) << "Undefined DH Group: '" << (int)_kexMethod << "'.";
-        ret = false;
     }
-    try
+    else
     {
-        if (ret == true)
+        try
         {
-            _privKexKey.reset(new Botan::DH_PrivateKey(*CppsshImpl::RNG, Botan::DL_Group(dlGroup)));
-            Botan::DH_PublicKey pubKexKey = *_privKexKey;
-
-            publicKey = pubKexKey.get_y();
-            ret = !publicKey.is_zero();
+            std::vector<Botan::byte> value;
+            publicKey->clear();
+            _privKexKey = CppsshImpl::KEX_KEY_POOL.take(_kexMethod);
+            if (_privKexKey != nullptr)
+            {
+                value = _privKexKey->public_value();
+                if ((isCurve25519(_kexMethod) == true) || (isEcdh(_kexMethod) == true))
+                {
+                    // RFC 5656: Q_C is the uncompressed point
+                    publicKey->assign(value.begin(), value.end());
+                }
+                else
+                {
+                    CppsshConstPacket::bn2vector(publicKey, Botan::BigInt(value.data(), value.size()));
+                }
+            }
+            ret = (publicKey->empty() == false);
+        }
+        catch (const std::exception& ex)
+        {
+            cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
         }
-    }
-    catch (const std::exception& ex)
-    {
-        cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
     }
 
     return ret;
 }
 
-bool CppsshCrypto::makeKexSecret(Botan::secure_vector<Botan::byte>* result, Botan::BigInt& f)
+bool CppsshCrypto::makeKexSecret(Botan::secure_vector<Botan::byte>* result, const Botan::secure_vector<Botan::byte>& f)
 {
     bool ret = false;
     try
     {
-        Botan::PK_Key_Agreement pkka(*_privKexKey, *CppsshImpl::RNG, "Raw");
-        std::vector<Botan::byte> buf;
-        buf.resize(f.bytes());
-        Botan::BigInt::encode(buf.data(), f);
-        Botan::SymmetricKey negotiated = pkka.derive_key(f.bytes(), buf);
-
-        if (negotiated.length() > 0)
+        if (_privKexKey == nullptr)
         {
-            Botan::BigInt Kint(negotiated.begin(), negotiated.length());
-            CppsshConstPacket::bn2vector(result, Kint);
-            _K = *result;
-            _privKexKey.reset();
-            ret = true;
+            cdLog(LogLevel::Error) << "No key exchange in progress.";
+        }
+        else if ((isCurve25519(_kexMethod) == true) && (f.size() != 32))
+        {
+            cdLog(LogLevel::Error) << "Invalid curve25519 public key length: " << f.size();
+        }
+        else
+        {
+            Botan::PK_Key_Agreement pkka(*_privKexKey, *CppsshImpl::RNG, "Raw");
+            Botan::SymmetricKey negotiated = pkka.derive_key(0, f.data(), f.size());
+
+            if (negotiated.length() > 0)
+            {
+                // The DH secret, the X25519 output (RFC 8731) and the ECDH x coordinate
+                // (RFC 5656) are all sent to the hash as an mpint
+                Botan::BigInt Kint(negotiated.begin(), negotiated.length());
+                if (Kint.is_zero() == true)
+                {
+                    cdLog(LogLevel::Error) << "Key exchange produced an all zero secret.";
+                }
+                else
+                {
+                    result->clear();
+                    CppsshConstPacket::bn2vector(result, Kint);
+                    _K = *result;
+                    ret = true;
+                }
+            }
+            CppsshImpl::KEX_KEY_POOL.release(_kexMethod, std::move(_privKexKey));
         }
     }
     catch (const std::exception& ex)
@@ -343,7 +523,6 @@ bool CppsshCrypto::verifySig(const Botan::secure_vector<Botan::byte>& hostKey,
     {
         Botan::secure_vector<Botan::byte> sigType, sigData;
         const CppsshConstPacket signaturePacket(&sig);
-        std::string emsa;
 
         if (_H.empty() == true)
         {
@@ -360,17 +539,18 @@ bool CppsshCrypto::verifySig(const Botan::secure_vector<Botan::byte>& hostKey,
         else
         {
             std::shared_ptr<Botan::Public_Key> publicKey;
+            const std::string& sigName = CppsshImpl::HOSTKEY_ALGORITHMS.enum2ssh(_hostkeyMethod);
 
             switch (_hostkeyMethod)
             {
                 case hostkeyMethods::SSH_DSS:
                     publicKey = getDSAKey(hostKey);
-                    emsa = "EMSA1(SHA-1)";
                     break;
 
                 case hostkeyMethods::SSH_RSA:
+                case hostkeyMethods::RSA_SHA2_256:
+                case hostkeyMethods::RSA_SHA2_512:
                     publicKey = getRSAKey(hostKey);
-                    emsa = "EMSA3(SHA-1)";
                     break;
 
                 default:
@@ -380,29 +560,15 @@ bool CppsshCrypto::verifySig(const Botan::secure_vector<Botan::byte>& hostKey,
             {
                 cdLog(LogLevel::Error) << "Public key not generated.";
             }
+            else if (std::string(sigType.begin(), sigType.end()) != sigName)
+            {
+                cdLog(LogLevel::Error) << "Host signature type does not match " << sigName;
+            }
             else
             {
-                std::unique_ptr<Botan::PK_Verifier> verifier;
-
-                switch (_kexMethod)
-                {
-                    case kexMethods::DIFFIE_HELLMAN_GROUP1_SHA1:
-                    case kexMethods::DIFFIE_HELLMAN_GROUP14_SHA1:
-                        verifier.reset(new Botan::PK_Verifier(*publicKey, emsa));
-                        break;
-
-                    default:
-                        break;
-                }
-                if (verifier == nullptr)
-                {
-                    cdLog(LogLevel::Error) << "Key Exchange algorithm: " << (int)_kexMethod << " not supported.";
-                }
-                else
-                {
-                    result = verifier->verify_message(_H, sigData);
-                    verifier.reset();
-                }
+                // The host key signs H whatever the kex method, the hash comes from the host key algorithm
+                Botan::PK_Verifier verifier(*publicKey, CppsshImpl::HOSTKEY_ALGORITHMS.enum2botan(_hostkeyMethod));
+                result = verifier.verify_message(_H, sigData);
                 publicKey.reset();
 
                 if (result == false)
@@ -429,9 +595,9 @@ std::shared_ptr<Botan::DSA_PublicKey> CppsshCrypto::getDSAKey(const Botan::secur
 
     if (hKeyPacket.getString(&field) == true)
     {
-        if (CppsshImpl::HOSTKEY_ALGORITHMS.ssh2enum(field, &_hostkeyMethod) == false)
+        if (field != "ssh-dss")
         {
-            cdLog(LogLevel::Error) << "Host key algorithm: '" << field << "' not defined.";
+            cdLog(LogLevel::Error) << "Host key type: '" << field << "' is not a DSA key.";
         }
         else if ((hKeyPacket.getBigInt(&p) == true) &&
                  (hKeyPacket.getBigInt(&q) == true) &&
@@ -462,9 +628,10 @@ std::shared_ptr<Botan::RSA_PublicKey> CppsshCrypto::getRSAKey(const Botan::secur
 
     if (hKeyPacket.getString(&field) == true)
     {
-        if (CppsshImpl::HOSTKEY_ALGORITHMS.ssh2enum(field, &_hostkeyMethod) == false)
+        // The rsa-sha2 methods use the same "ssh-rsa" key
+        if (field != "ssh-rsa")
         {
-            cdLog(LogLevel::Error) << "Host key algorithm: '" << field << "' not defined.";
+            cdLog(LogLevel::Error) << "Host key type: '" << field << "' is not an RSA key.";
         }
         else if ((hKeyPacket.getBigInt(&e) == true) && (hKeyPacket.getBigInt(&n) == true))
         {
@@ -516,6 +683,17 @@ const char* CppsshCrypto::getHashAlgo() const
         case kexMethods::DIFFIE_HELLMAN_GROUP14_SHA1:
             return "SHA-1";
 
+        case kexMethods::CURVE25519_SHA256:
+        case kexMethods::CURVE25519_SHA256_LIBSSH:
+        case kexMethods::ECDH_SHA2_NISTP256:
+            return "SHA-256";
+
+        case kexMethods::ECDH_SHA2_NISTP384:
+            return "SHA-384";
+
+        case kexMethods::ECDH_SHA2_NISTP521:
+            return "SHA-512";
+
         default:
             cdLog(LogLevel::Error) << "DH Group: " << (int)_kexMethod << " was not defined.";
             return nullptr;
@@ -580,24 +758,31 @@ bool CppsshCrypto::computeKey(const std::string& keyType, Botan::secure_vector<B
     return ret;
 }
 
-std::unique_ptr<Botan::HashFunction> CppsshCrypto::getMacHashAlgo(macMethods macMethod, uint32_t* macDigestLen) const
+std::unique_ptr<Botan::MessageAuthenticationCode> CppsshCrypto::createMac(macMethods macMethod, uint32_t* macKeyLen)
 {
-    std::unique_ptr<Botan::HashFunction> hashAlgo;
+    std::unique_ptr<Botan::MessageAuthenticationCode> mac;
     std::string algo;
     algo = CppsshImpl::MAC_ALGORITHMS.enum2botan(macMethod);
     if (algo.length() == 0)
     {
         cdLog(LogLevel::Error) << "Unknown mac algo";
     }
+    else if (isUmac(macMethod) == true)
+    {
+        mac.reset(new CppsshUmac(((macMethod == macMethods::UMAC_64) || (macMethod == macMethods::UMAC_64_ETM)) ? 8 : 16));
+        *macKeyLen = CppsshUmac::KEY_LEN;
+    }
     else
     {
-        hashAlgo = Botan::HashFunction::create(algo);
+        std::unique_ptr<Botan::HashFunction> hashAlgo(Botan::HashFunction::create(algo));
         if (hashAlgo != nullptr)
         {
-            *macDigestLen = hashAlgo->output_length();
+            // The hmac key is as long as the digest
+            *macKeyLen = hashAlgo->output_length();
+            mac.reset(new Botan::HMAC(hashAlgo.release()));
         }
     }
-    return hashAlgo;
+    return mac;
 }
 
 std::unique_ptr<Botan::BlockCipher> CppsshCrypto::getBlockCipher(cryptoMethods cryptoMethod) const
@@ -620,7 +805,7 @@ std::unique_ptr<Botan::BlockCipher> CppsshCrypto::getBlockCipher(cryptoMethods c
     return blockCipher;
 }
 
-bool CppsshCrypto::buildCipherPipe(
+bool CppsshCrypto::buildCipher(
     Botan::Cipher_Dir direction,
     Botan::byte ivID,
     Botan::byte keyID,
@@ -629,16 +814,48 @@ bool CppsshCrypto::buildCipherPipe(
     macMethods macMethod,
     uint32_t* macDigestLen,
     uint32_t* blockSize,
-    Botan::Keyed_Filter** filter,
-    std::unique_ptr<Botan::Pipe>& pipe,
-    std::unique_ptr<Botan::HMAC>& hmac,
-    Botan::secure_vector<Botan::byte>& nonce) const
+    uint32_t* aadLen,
+    std::unique_ptr<Botan::Cipher_Mode>& cipher,
+    Botan::secure_vector<Botan::byte>* nonce,
+    std::unique_ptr<CppsshChaChaPoly>& chachaPoly,
+    std::unique_ptr<CppsshCtrProcessor>& ctrProcessor,
+    std::unique_ptr<Botan::MessageAuthenticationCode>& hmac) const
 {
     bool ret = false;
-    std::unique_ptr<Botan::HashFunction> hashAlgo;
-
-    hashAlgo = getMacHashAlgo(macMethod, macDigestLen);
-    if (hashAlgo != nullptr)
+    std::unique_ptr<Botan::MessageAuthenticationCode> macAlgo;
+    uint32_t macKeyLen = 0;
+    const bool aead = isAead(cryptoMethod);
+
+    *macDigestLen = 0;
+    *aadLen = 0;
+    chachaPoly.reset();
+    ctrProcessor.reset();
+    if ((aead == false) && (macMethod != macMethods::HMAC_NONE))
+    {
+        macAlgo = createMac(macMethod, &macKeyLen);
+        if (macAlgo != nullptr)
+        {
+            *macDigestLen = macAlgo->output_length();
+        }
+    }
+    if (cryptoMethod == cryptoMethods::CHACHA20_POLY1305)
+    {
+        // No IV is used, the nonce is the packet sequence number
+        Botan::secure_vector<Botan::byte> symmetricKeyBuf;
+        if (computeKey("symmetric", &symmetricKeyBuf, keyID, CppsshChaChaPoly::KEY_LEN) == true)
+        {
+            chachaPoly.reset(new CppsshChaChaPoly());
+            chachaPoly->setKey(symmetricKeyBuf);
+            cipher.reset();
+            hmac.reset();
+            nonce->clear();
+            *blockSize = CppsshChaChaPoly::BLOCK_SIZE;
+            *aadLen = sizeof(uint32_t);
+            *macDigestLen = CppsshChaChaPoly::TAG_LEN;
+            ret = true;
+        }
+    }
+    else if ((aead == true) || (macMethod == macMethods::HMAC_NONE) || (macAlgo != nullptr))
     {
         std::unique_ptr<Botan::BlockCipher> blockCipher(getBlockCipher(cryptoMethod));
         if (blockCipher != nullptr)
@@ -647,46 +864,80 @@ bool CppsshCrypto::buildCipherPipe(
             Botan::secure_vector<Botan::byte> symmetricKeyBuf;
             Botan::secure_vector<Botan::byte> macIdBuf;
             *blockSize = blockCipher->block_size();
-            if ((computeKey("nonce", &ivbuf, ivID, *blockSize) == true) &&
+            // AEAD modes take a 12 byte nonce (RFC 5647) rather than a block sized IV
+            if ((computeKey("nonce", &ivbuf, ivID, (aead == true) ? 12 : *blockSize) == true) &&
                 (computeKey("symmetric", &symmetricKeyBuf, keyID, maxKeyLengthOf(blockCipher->name(), cryptoMethod)) == true) &&
-                (computeKey("mac", &macIdBuf, macID, *macDigestLen) == true))
+                ((macAlgo == nullptr) || (computeKey("mac", &macIdBuf, macID, macKeyLen) == true)))
             {
-                Botan::InitializationVector iv(ivbuf);
                 Botan::SymmetricKey symmetricKey(symmetricKeyBuf);
-                Botan::SymmetricKey mac(macIdBuf);
 
-                hmac.reset(new Botan::HMAC(hashAlgo->clone()));
-                hmac->set_key(mac);
+                hmac = std::move(macAlgo);
+                if (hmac != nullptr)
+                {
+                    hmac->set_key(Botan::SymmetricKey(macIdBuf));
+                }
 
-                if ((cryptoMethod == cryptoMethods::AES128_CTR) || (cryptoMethod == cryptoMethods::AES192_CTR) ||
-                    (cryptoMethod == cryptoMethods::AES256_CTR))
+                nonce->clear();
+                if (aead == true)
                 {
-                    // Save the nonce for use by CTR ciphers
-                    nonce = ivbuf;
-                    *filter = new Botan::Transformation_Filter(
-                        new Botan::Stream_Cipher_Mode(new Botan::CTR_BE(blockCipher->clone())));
+                    cipher = Botan::AEAD_Mode::create(blockCipher->name() + "/GCM", direction);
+                }
+                else if ((cryptoMethod == cryptoMethods::AES128_CTR) || (cryptoMethod == cryptoMethods::AES192_CTR) ||
+                         (cryptoMethod == cryptoMethods::AES256_CTR))
+                {
+                    size_t keystreamSize;
+                    bool refillWhenIdle;
+                    unsigned int threads;
+                    size_t minChunk;
+                    CppsshImpl::getCtrKeystreamPrefill(&keystreamSize, &refillWhenIdle);
+                    CppsshImpl::getParallelCtr(&threads, &minChunk);
+                    if (threads > 1)
+                    {
+                        ctrProcessor.reset(new CppsshParallelCtr(*blockCipher, symmetricKey, ivbuf, threads, minChunk));
+                    }
+                    else if (keystreamSize > 0)
+                    {
+                        std::unique_ptr<Botan::StreamCipher> ctr(new Botan::CTR_BE(blockCipher->clone()));
+                        ctr->set_key(symmetricKey);
+                        ctr->set_iv(ivbuf.data(), ivbuf.size());
+                        ctrProcessor.reset(new CppsshKeystream(std::move(ctr), keystreamSize, refillWhenIdle));
+                    }
+                    // The counter carries over from one packet to the next inside CTR_BE
+                    cipher.reset(new Botan::Stream_Cipher_Mode(new Botan::CTR_BE(blockCipher->clone())));
+                }
+                else if (direction == Botan::ENCRYPTION)
+                {
+                    cipher.reset(new Botan::CBC_Encryption(blockCipher->clone(), new Botan::Null_Padding));
+                }
+                else
+                {
+                    cipher.reset(new Botan::CBC_Decryption(blockCipher->clone(), new Botan::Null_Padding));
+                }
+
+                if (cipher == nullptr)
+                {
+                    cdLog(LogLevel::Error) << "Unable to create cipher mode for " << blockCipher->name();
                 }
                 else
                 {
-                    // Clear the nonce for normal block ciphers
-                    // botan handles the nonce carry over in the CBC layer
-                    nonce.clear();
-                    if (direction == Botan::ENCRYPTION)
+                    cipher->set_key(symmetricKey);
+                    if (aead == true)
                     {
-                        *filter = new Botan::Transformation_Filter(
-                            new Botan::CBC_Encryption(blockCipher->clone(), new Botan::Null_Padding));
+                        // The packet length is sent in the clear and the tag follows the packet
+                        *nonce = ivbuf;
+                        *aadLen = sizeof(uint32_t);
+                        *macDigestLen = cipher->tag_size();
                     }
                     else
                     {
-                        *filter = new Botan::Transformation_Filter(
-                            new Botan::CBC_Decryption(blockCipher->clone(), new Botan::Null_Padding));
+                        if (isEtm(macMethod) == true)
+                        {
+                            *aadLen = sizeof(uint32_t);
+                        }
+                        cipher->start(ivbuf);
                     }
+                    ret = true;
                 }
-
-                (*filter)->set_key(symmetricKey);
-                (*filter)->set_iv(iv);
-                pipe.reset(new Botan::Pipe(*filter));
-                ret = true;
             }
         }
     }
@@ -694,19 +945,28 @@ bool CppsshCrypto::buildCipherPipe(
 }
 
 bool CppsshCrypto::makeNewKeys()
+{
+    return makeKeys('B', 'D', 'F');
+}
+
+bool CppsshCrypto::makeLoopbackKeys()
+{
+    return makeKeys('A', 'C', 'E');
+}
+
+bool CppsshCrypto::makeKeys(Botan::byte rxIvID, Botan::byte rxKeyID, Botan::byte rxMacID)
 {
     bool ret = false;
-    std::string algo;
-    Botan::secure_vector<Botan::byte> key;
-    std::unique_ptr<Botan::HashFunction> hashAlgo;
-    std::unique_ptr<Botan::BlockCipher> blockCipher;
     try
     {
-        if (buildCipherPipe(Botan::ENCRYPTION, 'A', 'C', 'E', _c2sCryptoMethod, _c2sMacMethod, &_c2sMacDigestLen,
-                            &_encryptBlockSize, &_encryptFilter, _encrypt, _hmacOut, _c2sNonce) == true)
+        if (buildCipher(Botan::ENCRYPTION, 'A', 'C', 'E', _c2sCryptoMethod, _c2sMacMethod, &_c2sMacDigestLen,
+                        &_encryptBlockSize, &_encryptAadLen, _encrypt, &_encryptNonce,
+                        _encryptChaChaPoly, _encryptCtr, _hmacOut) == true)
         {
-            ret = buildCipherPipe(Botan::DECRYPTION, 'B', 'D', 'F', _s2cCryptoMethod, _s2cMacMethod, &_s2cMacDigestLen,
-                                  &_decryptBlockSize, &_decryptFilter, _decrypt, _hmacIn, _s2cNonce);
+            ret = buildCipher(Botan::DECRYPTION, rxIvID, rxKeyID, rxMacID, _s2cCryptoMethod, _s2cMacMethod,
+                              &_s2cMacDigestLen, &_decryptBlockSize, &_decryptAadLen, _decrypt, &_decryptNonce,
+                              _decryptChaChaPoly, _decryptCtr, _hmacIn);
+            _macIn.resize(_s2cMacDigestLen);
         }
     }
     catch (const std::exception& ex)
@@ -23,12 +23,15 @@
 #include "session.h"
 #include "botan/hmac.h"
 #include "botan/dh.h"
+#include "botan/curve25519.h"
+#include "botan/ecdh.h"
 #include "botan/dsa.h"
 #include "botan/rsa.h"
-#include "botan/key_filt.h"
-#include "botan/pipe.h"
-#include "botan/cbc.h"
+#include "botan/cipher_mode.h"
 #include "cryptoalgos.h"
+#include "chachapoly.h"
+#include "keystream.h"
+#include "parallelctr.h"
 #include <memory>
 
 class CppsshCrypto
@@ -46,10 +49,48 @@ public:
         return _decryptBlockSize;
     }
 
+    // Number of bytes at the start of each packet that are sent in the clear
+    // as associated data (AEAD ciphers and encrypt-then-mac), and so are left
+    // out of the cipher block alignment.
+    uint32_t getEncryptAadLen() const
+    {
+        return _encryptAadLen;
+    }
+
+    uint32_t getDecryptAadLen() const
+    {
+        return _decryptAadLen;
+    }
+
+    // Number of bytes that have to be decrypted before the packet length is known
+    uint32_t getDecryptHeaderLen() const
+    {
+        return (_decryptAadLen > 0) ? _decryptAadLen : _decryptBlockSize;
+    }
+
+    bool isAeadIn() const
+    {
+        return isAead(_s2cCryptoMethod);
+    }
+
+    bool isEtmIn() const
+    {
+        return isEtm(_s2cMacMethod);
+    }
+
+    static bool isAead(cryptoMethods cryptoMethod);
+    static bool isEtm(macMethods macMethod);
+    static bool isUmac(macMethods macMethod);
+    static bool isCurve25519(kexMethods kexMethod);
+    static bool isEcdh(kexMethods kexMethod);
+    // An unkeyed mac for the method and the length of key it takes
+    static std::unique_ptr<Botan::MessageAuthenticationCode> createMac(macMethods macMethod, uint32_t* macKeyLen);
+
     bool encryptPacket(Botan::secure_vector<Botan::byte>* encrypted, Botan::secure_vector<Botan::byte>* hmac, const Botan::byte* decrypted, uint32_t len, uint32_t seq);
-    bool decryptPacket(Botan::secure_vector<Botan::byte>* decrypted, const Botan::byte* encrypted, uint32_t len);
+    bool decryptHeader(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t seq);
+    bool decryptPacket(Botan::byte* decrypted, const Botan::byte* encrypted, uint32_t len, uint32_t seq);
 
-    void computeMac(Botan::secure_vector<Botan::byte>* hmac, const Botan::secure_vector<Botan::byte>& packet, uint32_t seq)  const;
+    bool verifyMac(const Botan::byte* packet, uint32_t len, const Botan::byte* mac, uint32_t seq);
     bool computeH(Botan::secure_vector<Botan::byte>* result, const Botan::secure_vector<Botan::byte>& val);
 
     bool verifySig(const Botan::secure_vector<Botan::byte>& hostKey, const Botan::secure_vector<Botan::byte>& sig);
@@ -63,9 +104,14 @@ public:
     bool setNegotiatedCmprsC2s(const compressionMethods cmprsAlgo);
     bool setNegotiatedCmprsS2c(const compressionMethods cmprsAlgo);
 
-    bool getKexPublic(Botan::BigInt& publicKey);
-    bool makeKexSecret(Botan::secure_vector<Botan::byte>* result, Botan::BigInt& f);
+    // The public value as it goes on the wire: an mpint for the modp groups,
+    // the raw point for the curves
+    bool getKexPublic(Botan::secure_vector<Botan::byte>* publicKey);
+    bool makeKexSecret(Botan::secure_vector<Botan::byte>* result, const Botan::secure_vector<Botan::byte>& f);
     bool makeNewKeys();
+    // Only for the benchmarks: the receive direction is keyed like the transmit
+    // direction, so the object decrypts its own packets.
+    bool makeLoopbackKeys();
 
     uint32_t getMacOutLen() const
     {
@@ -78,35 +124,49 @@ public:
     }
 
 private:
-    std::unique_ptr<Botan::HashFunction> getMacHashAlgo(macMethods macMethod, uint32_t* macDigestLen) const;
+    bool makeKeys(Botan::byte rxIvID, Botan::byte rxKeyID, Botan::byte rxMacID);
     std::unique_ptr<Botan::BlockCipher> getBlockCipher(cryptoMethods cryptoMethod) const;
-    bool buildCipherPipe(Botan::Cipher_Dir direction, Botan::byte ivID, Botan::byte keyID, Botan::byte macID, cryptoMethods cryptoMethod, macMethods macMethod, uint32_t* macDigestLen, uint32_t* blockSize, Botan::Keyed_Filter** filter, std::unique_ptr<Botan::Pipe>& pipe,
-                         std::unique_ptr<Botan::HMAC>& hmac, Botan::secure_vector<Botan::byte>& nonce) const;
+    bool buildCipher(Botan::Cipher_Dir direction, Botan::byte ivID, Botan::byte keyID, Botan::byte macID, cryptoMethods cryptoMethod, macMethods macMethod, uint32_t* macDigestLen, uint32_t* blockSize, uint32_t* aadLen,
+                     std::unique_ptr<Botan::Cipher_Mode>& cipher, Botan::secure_vector<Botan::byte>* nonce, std::unique_ptr<CppsshChaChaPoly>& chachaPoly,
+                     std::unique_ptr<CppsshCtrProcessor>& ctrProcessor, std::unique_ptr<Botan::MessageAuthenticationCode>& hmac) const;
+    void encryptBlocks(Botan::byte* data, uint32_t len);
+    void decryptBlocks(Botan::byte* data, uint32_t len);
+    void startMac(Botan::MessageAuthenticationCode* mac, macMethods macMethod, uint32_t seq) const;
+    void startAead(Botan::Cipher_Mode* cipher, Botan::secure_vector<Botan::byte>* nonce, const Botan::byte* aad, uint32_t aadLen) const;
 
     std::shared_ptr<Botan::DSA_PublicKey> getDSAKey(const Botan::secure_vector<Botan::byte>& hostKey);
     std::shared_ptr<Botan::RSA_PublicKey> getRSAKey(const Botan::secure_vector<Botan::byte>& hostKey);
     bool computeKey(const std::string& keyType, Botan::secure_vector<Botan::byte>* key, Botan::byte ID, uint32_t nBytes) const;
     bool setNegotiatedCrypto(const cryptoMethods cryptoAlgo, cryptoMethods* cryptoMethod) const;
-    bool setNegotiatedMac(const macMethods macAlgo, macMethods* macMethod);
+    bool setNegotiatedMac(const macMethods macAlgo, cryptoMethods cryptoMethod, macMethods* macMethod);
     bool setNegotiatedCmprs(const compressionMethods cmprsAlgo, compressionMethods* cmprsMethod) const;
     //std::string getCryptAlgo(cryptoMethods crypto) const;
     const char* getHashAlgo() const;
     //const std::string& getHmacAlgo(macMethods method) const;
     size_t maxKeyLengthOf(const std::string& name, cryptoMethods method) const;
-    void setNonce(Botan::Keyed_Filter* filter, Botan::secure_vector<Botan::byte>& nonce) const;
 
     std::shared_ptr<CppsshSession> _session;
-    std::unique_ptr<Botan::Pipe> _encrypt;
-    std::unique_ptr<Botan::Pipe> _decrypt;
-    std::unique_ptr<Botan::HMAC> _hmacOut;
-    std::unique_ptr<Botan::HMAC> _hmacIn;
-    Botan::Keyed_Filter* _encryptFilter;
-    Botan::Keyed_Filter* _decryptFilter;
-    Botan::secure_vector<Botan::byte> _c2sNonce;
-    Botan::secure_vector<Botan::byte> _s2cNonce;
+    // The cipher modes keep the CTR counter and CBC chaining state
+    // between calls, so each packet is processed in a single pass.
+    std::unique_ptr<Botan::Cipher_Mode> _encrypt;
+    std::unique_ptr<Botan::Cipher_Mode> _decrypt;
+    std::unique_ptr<Botan::MessageAuthenticationCode> _hmacOut;
+    std::unique_ptr<Botan::MessageAuthenticationCode> _hmacIn;
+    Botan::secure_vector<Botan::byte> _macIn;
+    // AEAD modes are restarted for each packet with an incrementing nonce
+    Botan::secure_vector<Botan::byte> _encryptNonce;
+    Botan::secure_vector<Botan::byte> _decryptNonce;
+    Botan::secure_vector<Botan::byte> _decryptTag;
+    std::unique_ptr<CppsshChaChaPoly> _encryptChaChaPoly;
+    std::unique_ptr<CppsshChaChaPoly> _decryptChaChaPoly;
+    // Optional prefilled or parallel CTR engine, used instead of _encrypt/_decrypt when set
+    std::unique_ptr<CppsshCtrProcessor> _encryptCtr;
+    std::unique_ptr<CppsshCtrProcessor> _decryptCtr;
 
     uint32_t _encryptBlockSize;
     uint32_t _decryptBlockSize;
+    uint32_t _encryptAadLen;
+    uint32_t _decryptAadLen;
     uint32_t _c2sMacDigestLen;
     uint32_t _s2cMacDigestLen;
 
@@ -119,7 +179,7 @@ private:
     compressionMethods _c2sCmprsMethod;
     compressionMethods _s2cCmprsMethod;
 
-    std::unique_ptr<Botan::DH_PrivateKey> _privKexKey;
+    std::unique_ptr<Botan::PK_Key_Agreement_Key> _privKexKey;
     Botan::secure_vector<Botan::byte> _K;
     Botan::secure_vector<Botan::byte> _H;
 };
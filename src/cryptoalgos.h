@@ -150,6 +150,30 @@ public:
         return ret;
     }
 
+    void getMethods(std::vector<T>* methods) const
+    {
+        for (const CryptoStrings<T>& algo : _algos)
+        {
+            methods->push_back(algo._method);
+        }
+    }
+
+    // A CppsshAlgos built from these keeps the order with setOrder(getMethods)
+    void getAlgos(std::vector<CryptoStrings<T> >* algos) const
+    {
+        *algos = _algos;
+    }
+
+    // Move the given methods to the front in the given order, everything
+    // else keeps its current relative order behind them.
+    void setOrder(const std::vector<T>& order)
+    {
+        std::stable_sort(_algos.begin(), _algos.end(), [&order](const CryptoStrings<T>& a, const CryptoStrings<T>& b)
+        {
+            return (std::find(order.begin(), order.end(), a._method) < std::find(order.begin(), order.end(), b._method));
+        });
+    }
+
     void toString(std::string* outstr) const
     {
         for (const CryptoStrings<T>& algo : _algos)
@@ -181,6 +205,12 @@ private:
 
 enum class macMethods
 {
+    HMAC_SHA256_ETM,
+    HMAC_SHA1_ETM,
+    UMAC_64_ETM,
+    UMAC_128_ETM,
+    UMAC_64,
+    UMAC_128,
     HMAC_SHA512,
     HMAC_SHA256,
     HMAC_SHA1,
@@ -194,6 +224,9 @@ typedef CppsshAlgos<macMethods> CppsshMacAlgos;
 
 enum class cryptoMethods
 {
+    AES256_GCM,
+    AES128_GCM,
+    CHACHA20_POLY1305,
     AES256_CTR,
     AES192_CTR,
     AES128_CTR,
@@ -212,6 +245,11 @@ typedef CppsshAlgos<cryptoMethods> CppsshCryptoAlgos;
 
 enum class kexMethods
 {
+    CURVE25519_SHA256,
+    CURVE25519_SHA256_LIBSSH,
+    ECDH_SHA2_NISTP256,
+    ECDH_SHA2_NISTP384,
+    ECDH_SHA2_NISTP521,
     DIFFIE_HELLMAN_GROUP1_SHA1,
     DIFFIE_HELLMAN_GROUP14_SHA1,
     MAX_VALS,
@@ -221,6 +259,9 @@ typedef CppsshAlgos<kexMethods> CppsshKexAlgos;
 
 enum class hostkeyMethods
 {
+    // RFC 8332, the "ssh-rsa" key signed with SHA-2
+    RSA_SHA2_512,
+    RSA_SHA2_256,
     SSH_DSS,
     SSH_RSA,
     MAX_VALS
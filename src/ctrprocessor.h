@@ -0,0 +1,37 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _CTR_PROCESSOR_Hxx
+#define _CTR_PROCESSOR_Hxx
+
+#include "botan/secmem.h"
+
+// Alternative engines for the aes*-ctr ciphers. Each one produces exactly the
+// keystream of a CTR_BE instance started at the session IV.
+class CppsshCtrProcessor
+{
+public:
+    virtual ~CppsshCtrProcessor()
+    {
+    }
+
+    // XOR data with the next len bytes of keystream
+    virtual void process(Botan::byte* data, size_t len) = 0;
+};
+
+#endif
@@ -0,0 +1,818 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "forward.h"
+#include "CDLogger/Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#if defined(WIN32)
+#define SHUT_WR SD_SEND
+#define MSG_NOSIGNAL 0
+#define socklen_t int
+#else
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+static bool isConnectInProgress()
+{
+#if defined(WIN32)
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    return ((errno == EINPROGRESS) || (errno == EAGAIN));
+#endif
+}
+
+static bool wouldBlock()
+{
+#if defined(WIN32)
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR));
+#endif
+}
+
+CppsshForwarder::CppsshForwarder(const std::shared_ptr<CppsshConnection>& connection)
+    : _connection(connection),
+    _opens(new ThreadSafeQueue<CppsshForwardedOpen>()),
+    _running(false)
+{
+}
+
+CppsshForwarder::~CppsshForwarder()
+{
+    stop();
+}
+
+bool CppsshForwarder::listen(const std::string& listen, uint16_t listenPort, const std::string& remote,
+                             uint16_t remotePort)
+{
+    bool ret = false;
+    bool exists;
+    Listener listener;
+    listener._name = makeName(listen, listenPort);
+    listener._remote = remote;
+    listener._remotePort = remotePort;
+    listener._sock = CPPSSH_NO_SOCKET;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        exists = (std::find(_names.begin(), _names.end(), listener._name) != _names.end());
+    }
+    if (exists == true)
+    {
+        cdLog(LogLevel::Error) << "Already forwarding " << listener._name;
+    }
+    else if (listenPort == 0)
+    {
+        listener._sock = listenUnix(listen);
+        listener._path = listen;
+    }
+    else
+    {
+        listener._sock = listenTcp(listen, listenPort);
+    }
+    if (listener._sock != CPPSSH_NO_SOCKET)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _names.push_back(listener._name);
+        _newListeners.push_back(listener);
+        start();
+        ret = true;
+    }
+    return ret;
+}
+
+// The listener is closed by the thread, clients it already accepted carry on
+bool CppsshForwarder::cancel(const std::string& listen, uint16_t listenPort)
+{
+    bool ret = false;
+    std::string name(makeName(listen, listenPort));
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<std::string>::iterator it = std::find(_names.begin(), _names.end(), name);
+    if (it != _names.end())
+    {
+        _names.erase(it);
+        _cancelled.push_back(name);
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Not forwarding " << name;
+    }
+    return ret;
+}
+
+// The target is in place before the request goes out, the server can open a channel
+// right after its reply. A port of 0 is fixed up once the reply names the port.
+bool CppsshForwarder::listenRemote(const std::string& address, uint16_t port, const std::string& local,
+                                   uint16_t localPort, uint16_t* boundPort)
+{
+    bool ret = false;
+    uint32_t bound = 0;
+    RemoteTarget target;
+    target._address = address;
+    target._port = port;
+    target._local = local;
+    target._localPort = localPort;
+    // One request at a time, so only one target can be waiting under port 0
+    std::unique_lock<std::mutex> remoteLock(_remoteMutex);
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _remoteTargets.push_back(target);
+        start();
+    }
+    ret = _connection->requestRemoteForward(address, port, &bound, _opens);
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<RemoteTarget>::iterator it = findRemoteTarget(address, port);
+        if (it != _remoteTargets.end())
+        {
+            if (ret == true)
+            {
+                it->_port = (uint16_t)bound;
+            }
+            else
+            {
+                _remoteTargets.erase(it);
+            }
+        }
+    }
+    if ((ret == true) && (boundPort != nullptr))
+    {
+        *boundPort = (uint16_t)bound;
+    }
+    return ret;
+}
+
+bool CppsshForwarder::cancelRemote(const std::string& address, uint16_t port)
+{
+    bool ret = false;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<RemoteTarget>::iterator it = findRemoteTarget(address, port);
+        if (it != _remoteTargets.end())
+        {
+            _remoteTargets.erase(it);
+            ret = true;
+        }
+    }
+    if (ret == true)
+    {
+        ret = _connection->cancelRemoteForward(address, port);
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Not forwarding " << address << ":" << port;
+    }
+    return ret;
+}
+
+// Called with _mutex held
+std::vector<CppsshForwarder::RemoteTarget>::iterator CppsshForwarder::findRemoteTarget(const std::string& address,
+                                                                                        uint16_t port)
+{
+    std::vector<RemoteTarget>::iterator it;
+    for (it = _remoteTargets.begin(); it != _remoteTargets.end(); it++)
+    {
+        if ((it->_address == address) && (it->_port == port))
+        {
+            break;
+        }
+    }
+    return it;
+}
+
+void CppsshForwarder::stop()
+{
+    _running = false;
+    if (_thread.joinable() == true)
+    {
+        _thread.join();
+    }
+    updateListeners();
+    for (Listener& listener : _listeners)
+    {
+        closeListener(listener);
+    }
+    _listeners.clear();
+    for (Forward& forward : _forwards)
+    {
+        closeForward(forward);
+    }
+    _forwards.clear();
+    std::vector<RemoteTarget> remoteTargets;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _names.clear();
+        _cancelled.clear();
+        remoteTargets.swap(_remoteTargets);
+    }
+    for (const RemoteTarget& target : remoteTargets)
+    {
+        if (_connection->isTransportConnected() == true)
+        {
+            _connection->cancelRemoteForward(target._address, target._port);
+        }
+    }
+    CppsshForwardedOpen open;
+    while ((_opens->size() > 0) && (_opens->dequeue(open, 1) == true))
+    {
+        _connection->refuseForwarded(open._rxChannel, SSH2_OPEN_CONNECT_FAILED);
+    }
+}
+
+// A channel that is still being opened is waited for, so it can be closed again
+void CppsshForwarder::closeForward(const Forward& forward)
+{
+    switch (forward._state)
+    {
+        case ForwardState::OPENING:
+            if ((_connection->isTransportConnected() == true) && (_connection->waitOpen(forward._channel) == true))
+            {
+                _connection->closeSession(forward._channel);
+            }
+            break;
+
+        case ForwardState::CONNECTING:
+            _connection->refuseForwarded(forward._channel, SSH2_OPEN_CONNECT_FAILED);
+            break;
+
+        case ForwardState::OPEN:
+            _connection->closeSession(forward._channel);
+            break;
+
+        default:
+            break;
+    }
+    closeSocket(forward._sock);
+}
+
+std::string CppsshForwarder::makeName(const std::string& listen, uint16_t listenPort)
+{
+    return (listenPort == 0) ? listen : (listen + ":" + std::to_string(listenPort));
+}
+
+// An empty host is the loopback address, like ssh -L, and "*" is every address
+SOCKET CppsshForwarder::listenTcp(const std::string& host, uint16_t port)
+{
+    SOCKET sock = CPPSSH_NO_SOCKET;
+    bool found = true;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (host == "*")
+    {
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    else
+    {
+        hostent* localHost = gethostbyname(host.empty() ? "localhost" : host.c_str());
+        if ((localHost == nullptr) || (localHost->h_length == 0))
+        {
+            cdLog(LogLevel::Error) << "Host " << host << " not found.";
+            found = false;
+        }
+        else
+        {
+            memcpy(&addr.sin_addr, localHost->h_addr_list[0], sizeof(addr.sin_addr));
+        }
+    }
+    if (found == true)
+    {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    if (sock != CPPSSH_NO_SOCKET)
+    {
+        int on = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+        if ((bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0) || (::listen(sock, SOMAXCONN) != 0) ||
+            (setNonBlocking(sock) == false))
+        {
+            cdLog(LogLevel::Error) << "Unable to listen on " << host << ":" << port;
+            closeSocket(sock);
+            sock = CPPSSH_NO_SOCKET;
+        }
+    }
+    return sock;
+}
+
+SOCKET CppsshForwarder::listenUnix(const std::string& path)
+{
+    SOCKET sock = CPPSSH_NO_SOCKET;
+#if defined(WIN32)
+    cdLog(LogLevel::Error) << "Unix sockets are not supported: " << path;
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(addr.sun_path))
+    {
+        cdLog(LogLevel::Error) << "Socket path is too long: " << path;
+    }
+    else
+    {
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((sock != CPPSSH_NO_SOCKET) &&
+            ((bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0) || (::listen(sock, SOMAXCONN) != 0) ||
+             (setNonBlocking(sock) == false)))
+        {
+            cdLog(LogLevel::Error) << "Unable to listen on " << path << " " << strerror(errno);
+            closeSocket(sock);
+            sock = CPPSSH_NO_SOCKET;
+        }
+    }
+#endif
+    return sock;
+}
+
+bool CppsshForwarder::setNonBlocking(SOCKET sock)
+{
+#if defined(WIN32)
+    u_long on = 1;
+    return (ioctlsocket(sock, FIONBIO, &on) == 0);
+#else
+    int options = fcntl(sock, F_GETFL);
+    return ((options >= 0) && (fcntl(sock, F_SETFL, options | O_NONBLOCK) == 0));
+#endif
+}
+
+void CppsshForwarder::closeSocket(SOCKET sock)
+{
+#if defined(WIN32)
+    closesocket(sock);
+#else
+    ::close(sock);
+#endif
+}
+
+void CppsshForwarder::closeListener(const Listener& listener)
+{
+    closeSocket(listener._sock);
+    if (listener._path.empty() == false)
+    {
+        ::remove(listener._path.c_str());
+    }
+}
+
+// Called with _mutex held
+void CppsshForwarder::start()
+{
+    if (_thread.joinable() == false)
+    {
+        _running = true;
+        _thread = std::thread(&CppsshForwarder::run, this);
+    }
+}
+
+void CppsshForwarder::run()
+{
+    cdLog(LogLevel::Debug) << "starting forward thread";
+    while (_running == true)
+    {
+        fd_set readSet;
+        fd_set writeSet;
+        SOCKET maxSock = 0;
+        bool selecting = false;
+        updateListeners();
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+        for (const Listener& listener : _listeners)
+        {
+            FD_SET(listener._sock, &readSet);
+            maxSock = std::max(maxSock, listener._sock);
+            selecting = true;
+        }
+        for (const Forward& forward : _forwards)
+        {
+            if (forward._state == ForwardState::CONNECTING)
+            {
+                FD_SET(forward._sock, &writeSet);
+                selecting = true;
+            }
+            else if ((forward._state == ForwardState::OPEN) && (forward._localEof == false) &&
+                (_connection->getQueuedWrites(forward._channel) < CPPSSH_FORWARD_MAX_QUEUED))
+            {
+                FD_SET(forward._sock, &readSet);
+                selecting = true;
+            }
+            if (forward._out != nullptr)
+            {
+                FD_SET(forward._sock, &writeSet);
+                selecting = true;
+            }
+            maxSock = std::max(maxSock, forward._sock);
+        }
+
+        int res = 0;
+        if (selecting == true)
+        {
+            struct timeval waitTime;
+            waitTime.tv_sec = 0;
+            waitTime.tv_usec = CPPSSH_FORWARD_POLL_MS * 1000;
+            res = select((int)maxSock + 1, &readSet, &writeSet, nullptr, &waitTime);
+        }
+        else
+        {
+            // Windows fails a select without any sockets
+            std::this_thread::sleep_for(std::chrono::milliseconds(CPPSSH_FORWARD_POLL_MS));
+        }
+        if (res < 0)
+        {
+            if (wouldBlock() == false)
+            {
+                cdLog(LogLevel::Error) << "Forward select failed";
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(CPPSSH_FORWARD_POLL_MS));
+            continue;
+        }
+
+        for (std::vector<Forward>::iterator it = _forwards.begin(); it != _forwards.end();)
+        {
+            if (it->_state == ForwardState::OPENING)
+            {
+                checkOpened(&(*it));
+            }
+            else if (it->_state == ForwardState::CONNECTING)
+            {
+                checkConnected(&(*it), ((res > 0) && (FD_ISSET(it->_sock, &writeSet))));
+            }
+            if (it->_state == ForwardState::OPEN)
+            {
+                if ((res > 0) && (FD_ISSET(it->_sock, &readSet)))
+                {
+                    readLocal(&(*it));
+                }
+                writeLocal(&(*it));
+            }
+            if (isDone(&(*it)) == true)
+            {
+                cdLog(LogLevel::Debug) << "forward done, channel " << it->_channel;
+                closeForward(*it);
+                it = _forwards.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        if (res > 0)
+        {
+            for (const Listener& listener : _listeners)
+            {
+                if (FD_ISSET(listener._sock, &readSet))
+                {
+                    accept(listener);
+                }
+            }
+        }
+        CppsshForwardedOpen open;
+        while ((_opens->size() > 0) && (_opens->dequeue(open, 1) == true))
+        {
+            connect(open);
+        }
+    }
+    cdLog(LogLevel::Debug) << "forward thread done";
+}
+
+void CppsshForwarder::updateListeners()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _listeners.insert(_listeners.end(), _newListeners.begin(), _newListeners.end());
+    _newListeners.clear();
+    for (const std::string& name : _cancelled)
+    {
+        for (std::vector<Listener>::iterator it = _listeners.begin(); it != _listeners.end(); it++)
+        {
+            if (it->_name == name)
+            {
+                closeListener(*it);
+                _listeners.erase(it);
+                break;
+            }
+        }
+    }
+    _cancelled.clear();
+}
+
+// The channel open is only sent here, checkOpened picks up the answer
+void CppsshForwarder::accept(const Listener& listener)
+{
+    for (int i = 0; i < CPPSSH_FORWARD_BURST; i++)
+    {
+        sockaddr_in addr;
+        socklen_t addrLen = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        SOCKET sock = ::accept(listener._sock, (sockaddr*)&addr, &addrLen);
+        if (sock == CPPSSH_NO_SOCKET)
+        {
+            break;
+        }
+#if !defined(WIN32)
+        if (sock >= FD_SETSIZE)
+        {
+            cdLog(LogLevel::Error) << "Too many sockets to forward " << listener._name;
+            closeSocket(sock);
+            continue;
+        }
+#endif
+        Forward forward(sock, 0, ForwardState::OPENING);
+        bool opened = false;
+        if (setNonBlocking(sock) == true)
+        {
+            if (listener._remotePort == 0)
+            {
+                opened = _connection->openDirectStreamLocal(&forward._channel, listener._remote);
+            }
+            else
+            {
+                std::string originator("127.0.0.1");
+                uint16_t originatorPort = 0;
+                if (listener._path.empty() == true)
+                {
+                    int on = 1;
+                    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+                    originator = inet_ntoa(addr.sin_addr);
+                    originatorPort = ntohs(addr.sin_port);
+                }
+                opened = _connection->openDirectTcpip(&forward._channel, listener._remote, listener._remotePort,
+                                                      originator, originatorPort);
+            }
+        }
+        if (opened == true)
+        {
+            cdLog(LogLevel::Debug) << "forwarding " << listener._name << " on channel " << forward._channel;
+            _forwards.push_back(forward);
+        }
+        else
+        {
+            cdLog(LogLevel::Error) << "Unable to open a channel for " << listener._name;
+            closeSocket(sock);
+        }
+    }
+}
+
+// The connect is finished by checkConnected, so a slow target doesn't hold up the other forwards
+void CppsshForwarder::connect(const CppsshForwardedOpen& open)
+{
+    bool found = false;
+    RemoteTarget target;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        // A target still waiting under port 0 takes the opens for a port no other target has
+        for (const RemoteTarget& remoteTarget : _remoteTargets)
+        {
+            if ((remoteTarget._port == open._port) || ((remoteTarget._port == 0) && (found == false)))
+            {
+                target = remoteTarget;
+                found = true;
+            }
+        }
+    }
+    SOCKET sock = CPPSSH_NO_SOCKET;
+    if (found == false)
+    {
+        cdLog(LogLevel::Error) << "No forward for " << open._address << ":" << open._port;
+    }
+    else if (target._localPort == 0)
+    {
+        sock = connectUnix(target._local);
+    }
+    else
+    {
+        sock = connectTcp(target._local, target._localPort);
+    }
+#if !defined(WIN32)
+    if ((sock != CPPSSH_NO_SOCKET) && (sock >= FD_SETSIZE))
+    {
+        cdLog(LogLevel::Error) << "Too many sockets to forward " << open._address << ":" << open._port;
+        closeSocket(sock);
+        sock = CPPSSH_NO_SOCKET;
+    }
+#endif
+    if (sock == CPPSSH_NO_SOCKET)
+    {
+        _connection->refuseForwarded(open._rxChannel,
+                                     (found == true) ? SSH2_OPEN_CONNECT_FAILED : SSH2_OPEN_ADMINISTRATIVELY_PROHIBITED);
+    }
+    else
+    {
+        cdLog(LogLevel::Debug) << "forwarding " << open._originator << ":" << open._originatorPort << " on channel " <<
+            open._rxChannel;
+        Forward forward(sock, open._rxChannel, ForwardState::CONNECTING);
+        forward._deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_connection->getTimeout());
+        _forwards.push_back(forward);
+    }
+}
+
+SOCKET CppsshForwarder::connectTcp(const std::string& host, uint16_t port)
+{
+    SOCKET sock = CPPSSH_NO_SOCKET;
+    sockaddr_in addr;
+    hostent* localHost = gethostbyname(host.empty() ? "localhost" : host.c_str());
+    if ((localHost == nullptr) || (localHost->h_length == 0))
+    {
+        cdLog(LogLevel::Error) << "Host " << host << " not found.";
+    }
+    else
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        memcpy(&addr.sin_addr, localHost->h_addr_list[0], sizeof(addr.sin_addr));
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    if (sock != CPPSSH_NO_SOCKET)
+    {
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+        if ((setNonBlocking(sock) == false) ||
+            ((::connect(sock, (sockaddr*)&addr, sizeof(addr)) != 0) && (isConnectInProgress() == false)))
+        {
+            cdLog(LogLevel::Error) << "Unable to connect to " << host << ":" << port;
+            closeSocket(sock);
+            sock = CPPSSH_NO_SOCKET;
+        }
+    }
+    return sock;
+}
+
+SOCKET CppsshForwarder::connectUnix(const std::string& path)
+{
+    SOCKET sock = CPPSSH_NO_SOCKET;
+#if defined(WIN32)
+    cdLog(LogLevel::Error) << "Unix sockets are not supported: " << path;
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(addr.sun_path))
+    {
+        cdLog(LogLevel::Error) << "Socket path is too long: " << path;
+    }
+    else
+    {
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((sock != CPPSSH_NO_SOCKET) &&
+            ((setNonBlocking(sock) == false) ||
+             ((::connect(sock, (sockaddr*)&addr, sizeof(addr)) != 0) && (isConnectInProgress() == false))))
+        {
+            cdLog(LogLevel::Error) << "Unable to connect to " << path << " " << strerror(errno);
+            closeSocket(sock);
+            sock = CPPSSH_NO_SOCKET;
+        }
+    }
+#endif
+    return sock;
+}
+
+// The channel is confirmed once the socket is writable without an error, or refused by closeForward
+void CppsshForwarder::checkConnected(Forward* forward, bool writable)
+{
+    if (writable == true)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if ((getsockopt(forward->_sock, SOL_SOCKET, SO_ERROR, (char*)&error, &len) != 0) || (error != 0))
+        {
+            cdLog(LogLevel::Error) << "Forward connect failed on channel " << forward->_channel;
+            forward->_failed = true;
+        }
+        else
+        {
+            _connection->confirmForwarded(forward->_channel);
+            forward->_state = ForwardState::OPEN;
+        }
+    }
+    else if (std::chrono::steady_clock::now() > forward->_deadline)
+    {
+        cdLog(LogLevel::Error) << "Forward connect timed out on channel " << forward->_channel;
+        forward->_failed = true;
+    }
+}
+
+// The socket isn't read until the server has confirmed the channel
+void CppsshForwarder::checkOpened(Forward* forward)
+{
+    bool opened = false;
+    if (_connection->pollOpen(forward->_channel, &opened) == true)
+    {
+        if (opened == true)
+        {
+            forward->_state = ForwardState::OPEN;
+        }
+        else
+        {
+            cdLog(LogLevel::Error) << "Server refused forward channel " << forward->_channel;
+            forward->_state = ForwardState::REFUSED;
+            forward->_failed = true;
+        }
+    }
+}
+
+// Straight into buffers queued on the channel, while it has room for them
+void CppsshForwarder::readLocal(Forward* forward)
+{
+    const uint32_t maxWrite = _connection->getMaxWrite(forward->_channel);
+    if (maxWrite == 0)
+    {
+        forward->_failed = true;
+    }
+    for (int i = 0; (i < CPPSSH_FORWARD_BURST) && (forward->_localEof == false) && (forward->_failed == false) &&
+         (_connection->getQueuedWrites(forward->_channel) < CPPSSH_FORWARD_MAX_QUEUED); i++)
+    {
+        std::shared_ptr<Botan::secure_vector<Botan::byte> > buf(new Botan::secure_vector<Botan::byte>(maxWrite));
+        int len = recv(forward->_sock, (char*)buf->data(), (int)buf->size(), 0);
+        if (len > 0)
+        {
+            buf->resize(len);
+            forward->_failed = (_connection->write(forward->_channel, buf) == false);
+        }
+        else if ((len == 0) || (wouldBlock() == false))
+        {
+            forward->_localEof = true;
+            _connection->sendEof(forward->_channel);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// A message the socket only took part of is kept, and the channel isn't read
+// again until it is gone
+void CppsshForwarder::writeLocal(Forward* forward)
+{
+    for (int i = 0; (i < CPPSSH_FORWARD_BURST) && (forward->_failed == false); i++)
+    {
+        if (forward->_out == nullptr)
+        {
+            if ((_connection->getQueuedReads(forward->_channel) == 0) ||
+                (_connection->read(forward->_channel, &forward->_out) == false))
+            {
+                forward->_out.reset();
+                break;
+            }
+            forward->_outOffset = 0;
+        }
+        if (forward->_outOffset < forward->_out->length())
+        {
+            int len = send(forward->_sock, (const char*)forward->_out->message() + forward->_outOffset,
+                           (int)(forward->_out->length() - forward->_outOffset), MSG_NOSIGNAL);
+            if (len > 0)
+            {
+                forward->_outOffset += len;
+            }
+            else if (wouldBlock() == false)
+            {
+                forward->_failed = true;
+            }
+        }
+        if (forward->_outOffset < forward->_out->length())
+        {
+            break;
+        }
+        forward->_out.reset();
+    }
+    if ((forward->_out == nullptr) && (forward->_remoteEof == false) &&
+        (_connection->isRemoteDone(forward->_channel) == true))
+    {
+        forward->_remoteEof = true;
+        shutdown(forward->_sock, SHUT_WR);
+    }
+}
+
+bool CppsshForwarder::isDone(Forward* forward)
+{
+    return ((forward->_failed == true) || ((forward->_localEof == true) && (forward->_remoteEof == true)) ||
+            ((forward->_out == nullptr) && (_connection->isConnected(forward->_channel) == false)) ||
+            (_connection->isTransportConnected() == false));
+}
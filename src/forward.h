@@ -0,0 +1,160 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _FORWARD_Hxx
+#define _FORWARD_Hxx
+
+#include "connection.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// Buffers queued on a channel before its socket stops being read, the rest
+// of the back pressure comes from the channel windows
+#define CPPSSH_FORWARD_MAX_QUEUED 8
+// Messages written to one socket per pass, so a busy channel doesn't hold up the others
+#define CPPSSH_FORWARD_BURST 16
+// Channel data can't be waited for with select, this bounds the added latency
+#define CPPSSH_FORWARD_POLL_MS 1
+#define CPPSSH_NO_SOCKET ((SOCKET)-1)
+
+// Local and remote forwarding, the way ssh -L and ssh -R do it. Every listener,
+// accepted client and connection made for the server on a connection id is
+// served by one thread, which selects on all of the sockets and moves data
+// between each socket and its channel. A socket is only read while its channel
+// has room, and a channel is only read as fast as its socket takes the data,
+// which in turn holds back the window given to the server.
+class CppsshForwarder
+{
+public:
+    CppsshForwarder(const std::shared_ptr<CppsshConnection>& connection);
+    CppsshForwarder(const CppsshForwarder&) = delete;
+    ~CppsshForwarder();
+
+    // A listenPort of 0 makes listen a Unix socket path, a remotePort of 0 makes
+    // remote a socket path on the server (direct-streamlocal@openssh.com)
+    bool listen(const std::string& listen, uint16_t listenPort, const std::string& remote, uint16_t remotePort);
+    bool cancel(const std::string& listen, uint16_t listenPort);
+    // The server listens on address:port, a port of 0 lets it pick one, and each
+    // connection it accepts is connected to local:localPort, or the socket path
+    // local when localPort is 0
+    bool listenRemote(const std::string& address, uint16_t port, const std::string& local, uint16_t localPort, uint16_t* boundPort);
+    bool cancelRemote(const std::string& address, uint16_t port);
+    void stop();
+
+private:
+    class Listener
+    {
+    public:
+        SOCKET _sock;
+        std::string _name;
+        // Removed when the listener is closed
+        std::string _path;
+        std::string _remote;
+        uint16_t _remotePort;
+    };
+
+    class RemoteTarget
+    {
+    public:
+        std::string _address;
+        // The port the server listens on
+        uint16_t _port;
+        std::string _local;
+        uint16_t _localPort;
+    };
+
+    enum class ForwardState
+    {
+        // A local client, the channel open is sent but not answered yet
+        OPENING,
+        // A channel the server opened, confirmed once the local connect is done
+        CONNECTING,
+        OPEN,
+        // The server refused the open, there is no channel left to close
+        REFUSED
+    };
+
+    class Forward
+    {
+    public:
+        Forward(SOCKET sock, uint32_t channel, ForwardState state)
+            : _sock(sock),
+            _channel(channel),
+            _state(state),
+            _outOffset(0),
+            _localEof(false),
+            _remoteEof(false),
+            _failed(false)
+        {
+        }
+
+        SOCKET _sock;
+        uint32_t _channel;
+        ForwardState _state;
+        // For CONNECTING
+        std::chrono::steady_clock::time_point _deadline;
+        // What the socket didn't take yet
+        std::shared_ptr<CppsshMessage> _out;
+        size_t _outOffset;
+        bool _localEof;
+        bool _remoteEof;
+        bool _failed;
+    };
+
+    static std::string makeName(const std::string& listen, uint16_t listenPort);
+    static SOCKET listenTcp(const std::string& host, uint16_t port);
+    static SOCKET listenUnix(const std::string& path);
+    static bool setNonBlocking(SOCKET sock);
+    static void closeSocket(SOCKET sock);
+    static void closeListener(const Listener& listener);
+    void closeForward(const Forward& forward);
+    void start();
+    void run();
+    void updateListeners();
+    void accept(const Listener& listener);
+    std::vector<RemoteTarget>::iterator findRemoteTarget(const std::string& address, uint16_t port);
+    void connect(const CppsshForwardedOpen& open);
+    static SOCKET connectTcp(const std::string& host, uint16_t port);
+    static SOCKET connectUnix(const std::string& path);
+    void checkConnected(Forward* forward, bool writable);
+    void checkOpened(Forward* forward);
+    void readLocal(Forward* forward);
+    void writeLocal(Forward* forward);
+    bool isDone(Forward* forward);
+
+    std::shared_ptr<CppsshConnection> _connection;
+    // Listeners and forwards belong to the thread, others hand them over here
+    std::vector<Listener> _newListeners;
+    std::vector<std::string> _cancelled;
+    std::vector<std::string> _names;
+    std::vector<RemoteTarget> _remoteTargets;
+    std::mutex _remoteMutex;
+    std::shared_ptr<ThreadSafeQueue<CppsshForwardedOpen> > _opens;
+    std::mutex _mutex;
+    std::vector<Listener> _listeners;
+    std::vector<Forward> _forwards;
+    std::thread _thread;
+    std::atomic<bool> _running;
+};
+
+#endif
@@ -19,9 +19,26 @@
 
 #include "impl.h"
 #include "keys.h"
+#include "keystream.h"
+#include "parallelctr.h"
+#include "algotuner.h"
 #include "botan/init.h"
+#include <chrono>
 
 std::mutex CppsshImpl::_optionsMutex;
+size_t CppsshImpl::_keystreamBufferSize = 0;
+bool CppsshImpl::_keystreamRefillWhenIdle = false;
+unsigned int CppsshImpl::_parallelCtrThreads = 0;
+size_t CppsshImpl::_parallelCtrMinChunk = 0;
+std::string CppsshImpl::_algorithmRates;
+// RFC 4253 section 9 recommends re-exchanging after 1GB or one hour
+uint64_t CppsshImpl::_rekeyBytes = 1024ULL * 1024ULL * 1024ULL;
+uint32_t CppsshImpl::_rekeySeconds = 60 * 60;
+bool CppsshImpl::_kexGuess = true;
+bool CppsshImpl::_kexPipeline = true;
+bool CppsshImpl::_immediateKeyAuth = false;
+size_t CppsshImpl::_sftpRequests = 64;
+uint32_t CppsshImpl::_sftpRequestSize = 32 * 1024;
 
 CppsshMacAlgos CppsshImpl::MAC_ALGORITHMS(std::vector<CryptoStrings<macMethods> >
 {
@@ -29,7 +46,13 @@ CppsshMacAlgos CppsshImpl::MAC_ALGORITHMS(std::vector<CryptoStrings<macMethods>
     CryptoStrings<macMethods>(macMethods::HMAC_MD5, "hmac-md5", "MD5"),
     CryptoStrings<macMethods>(macMethods::HMAC_NONE, "none", ""),
     CryptoStrings<macMethods>(macMethods::HMAC_SHA256, "hmac-sha2-256", "SHA-256"),
-    CryptoStrings<macMethods>(macMethods::HMAC_SHA256, "hmac-ripemd160", "RIPEMD-160"),
+    CryptoStrings<macMethods>(macMethods::HMAC_RIPEMD160, "hmac-ripemd160", "RIPEMD-160"),
+    CryptoStrings<macMethods>(macMethods::HMAC_SHA256_ETM, "hmac-sha2-256-etm@openssh.com", "SHA-256"),
+    CryptoStrings<macMethods>(macMethods::HMAC_SHA1_ETM, "hmac-sha1-etm@openssh.com", "SHA-1"),
+    CryptoStrings<macMethods>(macMethods::UMAC_64, "umac-64@openssh.com", "UMAC(64)"),
+    CryptoStrings<macMethods>(macMethods::UMAC_128, "umac-128@openssh.com", "UMAC(128)"),
+    CryptoStrings<macMethods>(macMethods::UMAC_64_ETM, "umac-64-etm@openssh.com", "UMAC(64)"),
+    CryptoStrings<macMethods>(macMethods::UMAC_128_ETM, "umac-128-etm@openssh.com", "UMAC(128)"),
     // Removed hmac-sha2-512 support due to bugs in some older version of openssh
     //   fatal: dh_gen_key: group too small: 1024 (2*need 1024) [preauth]
     //CryptoStrings<macMethods>(macMethods::HMAC_SHA512, "hmac-sha2-512", "SHA-512"),
@@ -37,6 +60,9 @@ CppsshMacAlgos CppsshImpl::MAC_ALGORITHMS(std::vector<CryptoStrings<macMethods>
 
 CppsshCryptoAlgos CppsshImpl::CIPHER_ALGORITHMS(std::vector<CryptoStrings<cryptoMethods> >
 {
+    CryptoStrings<cryptoMethods>(cryptoMethods::AES256_GCM, "aes256-gcm@openssh.com", "AES-256"),
+    CryptoStrings<cryptoMethods>(cryptoMethods::AES128_GCM, "aes128-gcm@openssh.com", "AES-128"),
+    CryptoStrings<cryptoMethods>(cryptoMethods::CHACHA20_POLY1305, "chacha20-poly1305@openssh.com", "ChaCha(20)"),
     CryptoStrings<cryptoMethods>(cryptoMethods::AES256_CTR, "aes256-ctr", "AES-256"),
     CryptoStrings<cryptoMethods>(cryptoMethods::AES192_CTR, "aes192-ctr", "AES-192"),
     CryptoStrings<cryptoMethods>(cryptoMethods::AES128_CTR, "aes128-ctr", "AES-128"),
@@ -49,13 +75,20 @@ CppsshCryptoAlgos CppsshImpl::CIPHER_ALGORITHMS(std::vector<CryptoStrings<crypto
 });
 CppsshKexAlgos CppsshImpl::KEX_ALGORITHMS(std::vector<CryptoStrings<kexMethods> >
 {
+    CryptoStrings<kexMethods>(kexMethods::CURVE25519_SHA256, "curve25519-sha256", "Curve25519"),
+    CryptoStrings<kexMethods>(kexMethods::CURVE25519_SHA256_LIBSSH, "curve25519-sha256@libssh.org", "Curve25519"),
+    CryptoStrings<kexMethods>(kexMethods::ECDH_SHA2_NISTP256, "ecdh-sha2-nistp256", "secp256r1"),
+    CryptoStrings<kexMethods>(kexMethods::ECDH_SHA2_NISTP384, "ecdh-sha2-nistp384", "secp384r1"),
+    CryptoStrings<kexMethods>(kexMethods::ECDH_SHA2_NISTP521, "ecdh-sha2-nistp521", "secp521r1"),
     CryptoStrings<kexMethods>(kexMethods::DIFFIE_HELLMAN_GROUP14_SHA1, "diffie-hellman-group14-sha1", "modp/ietf/2048"),
     CryptoStrings<kexMethods>(kexMethods::DIFFIE_HELLMAN_GROUP1_SHA1, "diffie-hellman-group1-sha1", "modp/ietf/1024"),
 });
 CppsshHostkeyAlgos CppsshImpl::HOSTKEY_ALGORITHMS(std::vector<CryptoStrings<hostkeyMethods> >
 {
-    CryptoStrings<hostkeyMethods>(hostkeyMethods::SSH_DSS, "ssh-dss", "ssh-dss"),
-    CryptoStrings<hostkeyMethods>(hostkeyMethods::SSH_RSA, "ssh-rsa", "ssh-rsa"),
+    CryptoStrings<hostkeyMethods>(hostkeyMethods::RSA_SHA2_512, "rsa-sha2-512", "EMSA3(SHA-512)"),
+    CryptoStrings<hostkeyMethods>(hostkeyMethods::RSA_SHA2_256, "rsa-sha2-256", "EMSA3(SHA-256)"),
+    CryptoStrings<hostkeyMethods>(hostkeyMethods::SSH_DSS, "ssh-dss", "EMSA1(SHA-1)"),
+    CryptoStrings<hostkeyMethods>(hostkeyMethods::SSH_RSA, "ssh-rsa", "EMSA3(SHA-1)"),
 });
 CppsshCompressionAlgos CppsshImpl::COMPRESSION_ALGORITHMS(std::vector<CryptoStrings<compressionMethods> >
 {
@@ -63,37 +96,78 @@ CppsshCompressionAlgos CppsshImpl::COMPRESSION_ALGORITHMS(std::vector<CryptoStri
 });
 
 std::shared_ptr<Botan::RandomNumberGenerator> CppsshImpl::RNG;
+CppsshKexKeyPool CppsshImpl::KEX_KEY_POOL;
 
 CppsshImpl::CppsshImpl()
-    : _connectionId(0)
+    : _pool([this]() { return nextConnectionId(); }),
+    _connectionId(0)
 {
     RNG.reset(new Botan::Serialized_RNG(new Botan::AutoSeeded_RNG()));
+    KEX_KEY_POOL.start(RNG);
 }
 
 CppsshImpl::~CppsshImpl()
 {
+    _pool.stop();
+    for (std::pair<const int, Lease>& lease : _connections)
+    {
+        if (lease.second._forwarder != nullptr)
+        {
+            lease.second._forwarder->stop();
+        }
+    }
+    KEX_KEY_POOL.stop();
     RNG.reset();
 }
 
+// With the pool enabled a connection to the same host, user and credentials
+// is reused when it has a free channel, otherwise a new one joins the pool.
 CppsshConnectStatus_t CppsshImpl::connect(int* connectionId, const char* host, const short port, const char* username,
                                           const char* privKeyFile, const char* password, unsigned int timeout,
                                           const bool x11Forwarded, const bool keepAlives, const char* term)
 {
     CppsshConnectStatus_t ret = CPPSSH_CONNECT_ERROR;
     std::shared_ptr<CppsshConnection> con;
-    {// new scope for mutex
-        std::unique_lock<std::mutex> lock(_connectionsMutex);
-        *connectionId = ++_connectionId;
-        con.reset(new CppsshConnection(*connectionId, timeout));
-        _connections[*connectionId] = con;
+    uint32_t channel = 0;
+    bool pooled = _pool.isEnabled();
+    std::string key;
+    *connectionId = nextConnectionId();
+    if (pooled == true)
+    {
+        key = CppsshConnectionPool::makeKey(host, port, username, privKeyFile, password);
+        con = _pool.acquire(key);
+        if (con != nullptr)
+        {
+            if (con->openSession(&channel, x11Forwarded, term) == true)
+            {
+                cdLog(LogLevel::Debug) << "Reusing a pooled connection for " << *connectionId;
+                ret = CPPSSH_CONNECT_OK;
+            }
+            else
+            {
+                _pool.release(con, false);
+                con.reset();
+            }
+        }
     }
-    if (con != nullptr)
+    if (con == nullptr)
     {
+        con.reset(new CppsshConnection(*connectionId, timeout));
         ret = con->connect(host, port, username, privKeyFile, password, x11Forwarded, keepAlives, term);
+        channel = con->getMainChannel();
         if (ret != CPPSSH_CONNECT_OK)
         {
-            close(*connectionId);
+            con->closeConnection();
         }
+        else if (pooled == true)
+        {
+            _pool.add(key, con);
+        }
+    }
+    if (ret == CPPSSH_CONNECT_OK)
+    {
+        std::unique_lock<std::mutex> lock(_connectionsMutex);
+        _connections[*connectionId] = Lease(con, channel, pooled, false);
     }
     return ret;
 }
@@ -101,10 +175,10 @@ CppsshConnectStatus_t CppsshImpl::connect(int* connectionId, const char* host, c
 bool CppsshImpl::isConnected(const int connectionId)
 {
     bool ret = false;
-    std::shared_ptr<CppsshConnection> con = getConnection(connectionId);
-    if (con != nullptr)
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
     {
-        ret = con->isConnected();
+        ret = lease._connection->isConnected(lease._channel);
     }
     return ret;
 }
@@ -112,10 +186,10 @@ bool CppsshImpl::isConnected(const int connectionId)
 bool CppsshImpl::write(const int connectionId, const uint8_t* data, size_t bytes)
 {
     bool ret = false;
-    std::shared_ptr<CppsshConnection> con = getConnection(connectionId);
-    if (con != nullptr)
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
     {
-        ret = con->write(data, bytes);
+        ret = lease._connection->write(lease._channel, data, bytes);
     }
     return ret;
 }
@@ -123,10 +197,32 @@ bool CppsshImpl::write(const int connectionId, const uint8_t* data, size_t bytes
 bool CppsshImpl::read(const int connectionId, CppsshMessage* data)
 {
     bool ret = false;
-    std::shared_ptr<CppsshConnection> con = getConnection(connectionId);
-    if (con != nullptr)
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
     {
-        ret = con->read(data);
+        ret = lease._connection->read(lease._channel, data);
+    }
+    return ret;
+}
+
+bool CppsshImpl::readStderr(const int connectionId, CppsshMessage* data)
+{
+    bool ret = false;
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
+    {
+        ret = lease._connection->readStderr(lease._channel, data);
+    }
+    return ret;
+}
+
+bool CppsshImpl::getExitStatus(const int connectionId, int* exitStatus)
+{
+    bool ret = false;
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
+    {
+        ret = lease._connection->getExitStatus(lease._channel, exitStatus);
     }
     return ret;
 }
@@ -134,26 +230,363 @@ bool CppsshImpl::read(const int connectionId, CppsshMessage* data)
 bool CppsshImpl::windowChange(const int connectionId, const uint32_t cols, const uint32_t rows)
 {
     bool ret = false;
-    std::shared_ptr<CppsshConnection> con = getConnection(connectionId);
-    if (con != nullptr)
+    Lease lease;
+    if (getLease(connectionId, &lease) == true)
     {
-        ret = con->windowChange(cols, rows);
+        ret = lease._connection->windowChange(lease._channel, cols, rows);
     }
     return ret;
 }
 
+// The new channel gets an id of its own, from the same range as connection ids.
+// With a command or subsystem it runs that instead of a shell.
+bool CppsshImpl::openChannel(const int connectionId, int* channelId, const bool x11Forwarded, const char* term,
+                             const char* command, const char* subsystem)
+{
+    bool ret = false;
+    Lease lease;
+    if (getLease(connectionId, &lease) == false)
+    {
+        cdLog(LogLevel::Error) << "Unknown connection: " << connectionId;
+    }
+    else if ((lease._pooled == true) && (_pool.reserve(lease._connection) == false))
+    {
+        cdLog(LogLevel::Error) << "No free channel on connection: " << connectionId;
+    }
+    else
+    {
+        *channelId = nextConnectionId();
+        if (command != nullptr)
+        {
+            ret = lease._connection->openExec(&lease._channel, command);
+        }
+        else if (subsystem != nullptr)
+        {
+            ret = lease._connection->openSubsystem(&lease._channel, subsystem);
+        }
+        else
+        {
+            ret = lease._connection->openSession(&lease._channel, x11Forwarded, term);
+        }
+        if (ret == true)
+        {
+            std::unique_lock<std::mutex> lock(_connectionsMutex);
+            _connections[*channelId] = Lease(lease._connection, lease._channel, lease._pooled, true);
+        }
+        else if (lease._pooled == true)
+        {
+            _pool.release(lease._connection);
+        }
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpOpen(const int connectionId, int* sftpId)
+{
+    bool ret = false;
+    Lease lease;
+    if ((openChannel(connectionId, sftpId, false, nullptr, nullptr, "sftp") == true) &&
+        (getLease(*sftpId, &lease) == true))
+    {
+        size_t requests;
+        uint32_t requestSize;
+        getSftpPipeline(&requests, &requestSize);
+        std::shared_ptr<CppsshSftp> sftp(new CppsshSftp(lease._connection, lease._channel, requests, requestSize));
+        if (sftp->init() == true)
+        {
+            std::unique_lock<std::mutex> lock(_connectionsMutex);
+            if (checkConnectionId(*sftpId) == true)
+            {
+                _connections[*sftpId]._sftp = sftp;
+                ret = true;
+            }
+        }
+        if (ret == false)
+        {
+            close(*sftpId);
+        }
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpGet(const int sftpId, const char* remotePath, const char* localPath)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshSftp> sftp = getSftp(sftpId);
+    if (sftp != nullptr)
+    {
+        ret = sftp->get(remotePath, localPath);
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpPut(const int sftpId, const char* localPath, const char* remotePath, uint32_t mode)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshSftp> sftp = getSftp(sftpId);
+    if (sftp != nullptr)
+    {
+        ret = sftp->put(localPath, remotePath, mode);
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpMkdir(const int sftpId, const char* path, uint32_t mode)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshSftp> sftp = getSftp(sftpId);
+    if (sftp != nullptr)
+    {
+        ret = sftp->mkdir(path, mode);
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpRemove(const int sftpId, const char* path)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshSftp> sftp = getSftp(sftpId);
+    if (sftp != nullptr)
+    {
+        ret = sftp->remove(path);
+    }
+    return ret;
+}
+
+bool CppsshImpl::sftpGetFileSize(const int sftpId, const char* path, uint64_t* size)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshSftp> sftp = getSftp(sftpId);
+    if (sftp != nullptr)
+    {
+        ret = sftp->getFileSize(path, size);
+    }
+    return ret;
+}
+
+// Each stream is an SFTP session of its own, several on one connection share its
+// cipher stream, separate connections don't.
+bool CppsshImpl::transfer(const int* connectionIds, size_t connections, size_t streamsPerConnection, bool download,
+                          const char* from, const char* to)
+{
+    bool ret = false;
+    std::vector<int> sftpIds;
+    std::vector<std::shared_ptr<CppsshSftp> > streams;
+    if ((connections * streamsPerConnection == 0) ||
+        (connections * streamsPerConnection > CPPSSH_TRANSFER_MAX_STREAMS))
+    {
+        cdLog(LogLevel::Error) << "Transfer streams must be 1 to " << CPPSSH_TRANSFER_MAX_STREAMS;
+    }
+    else
+    {
+        ret = true;
+        for (size_t i = 0; (i < connections) && (ret == true); i++)
+        {
+            for (size_t j = 0; (j < streamsPerConnection) && (ret == true); j++)
+            {
+                int sftpId;
+                ret = sftpOpen(connectionIds[i], &sftpId);
+                if (ret == true)
+                {
+                    sftpIds.push_back(sftpId);
+                    streams.push_back(getSftp(sftpId));
+                }
+            }
+        }
+    }
+    if (ret == true)
+    {
+        std::string rates;
+        CppsshTransfer transfer(streams);
+        if (download == true)
+        {
+            ret = transfer.get(from, to);
+        }
+        else
+        {
+            ret = transfer.put(from, to);
+        }
+        transfer.getRates(&rates);
+        std::unique_lock<std::mutex> lock(_transferRatesMutex);
+        _transferRates = rates;
+    }
+    streams.clear();
+    for (int sftpId : sftpIds)
+    {
+        close(sftpId);
+    }
+    return ret;
+}
+
+size_t CppsshImpl::getTransferRates(char* rates)
+{
+    std::unique_lock<std::mutex> lock(_transferRatesMutex);
+    return copyString(_transferRates, rates);
+}
+
+// scp runs on a channel of its own, which is closed again when the copy is done
+bool CppsshImpl::scp(const int connectionId, bool download, const char* localPath, const char* remotePath,
+                     uint32_t mode, double* mbps)
+{
+    bool ret = false;
+    int channelId;
+    Lease lease;
+    const std::string command(std::string(download ? "scp -f " : "scp -t ") + CppsshScp::quote(remotePath));
+    if ((openChannel(connectionId, &channelId, false, nullptr, command.c_str(), nullptr) == true) &&
+        (getLease(channelId, &lease) == true))
+    {
+        uint64_t bytes = 0;
+        CppsshScp scp(lease._connection, lease._channel);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (download == true)
+        {
+            ret = scp.receive(localPath, &bytes);
+        }
+        else
+        {
+            ret = scp.send(localPath, mode, &bytes);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (mbps != nullptr)
+        {
+            *mbps = (seconds > 0) ? ((bytes / (1024.0 * 1024.0)) / seconds) : 0;
+        }
+        close(channelId);
+    }
+    return ret;
+}
+
+bool CppsshImpl::forwardLocal(const int connectionId, const char* listen, const short listenPort, const char* remote,
+                              const short remotePort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshForwarder> forwarder = getForwarder(connectionId, true);
+    if (forwarder != nullptr)
+    {
+        ret = forwarder->listen((listen != nullptr) ? listen : "", (uint16_t)listenPort,
+                                (remote != nullptr) ? remote : "", (uint16_t)remotePort);
+    }
+    return ret;
+}
+
+bool CppsshImpl::cancelForwardLocal(const int connectionId, const char* listen, const short listenPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshForwarder> forwarder = getForwarder(connectionId, false);
+    if (forwarder != nullptr)
+    {
+        ret = forwarder->cancel((listen != nullptr) ? listen : "", (uint16_t)listenPort);
+    }
+    return ret;
+}
+
+bool CppsshImpl::forwardRemote(const int connectionId, const char* bindAddress, const short bindPort, const char* local,
+                               const short localPort, short* boundPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshForwarder> forwarder = getForwarder(connectionId, true);
+    if (forwarder != nullptr)
+    {
+        uint16_t bound = 0;
+        ret = forwarder->listenRemote((bindAddress != nullptr) ? bindAddress : "", (uint16_t)bindPort,
+                                      (local != nullptr) ? local : "", (uint16_t)localPort, &bound);
+        if ((ret == true) && (boundPort != nullptr))
+        {
+            *boundPort = (short)bound;
+        }
+    }
+    return ret;
+}
+
+bool CppsshImpl::cancelForwardRemote(const int connectionId, const char* bindAddress, const short bindPort)
+{
+    bool ret = false;
+    std::shared_ptr<CppsshForwarder> forwarder = getForwarder(connectionId, false);
+    if (forwarder != nullptr)
+    {
+        ret = forwarder->cancelRemote((bindAddress != nullptr) ? bindAddress : "", (uint16_t)bindPort);
+    }
+    return ret;
+}
+
+// A pooled connection only loses the session channel, the connection goes back to the pool.
+// Otherwise closing the id connect returned closes the connection and all of its channels,
+// and the ids of the channels opened on it with openChannel go with them.
 bool CppsshImpl::close(int connectionId)
 {
-    std::unique_lock<std::mutex> lock(_connectionsMutex);
-    if (checkConnectionId(connectionId) == true)
+    Lease lease;
+    std::vector<Lease> closed;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_connectionsMutex);
+        if (checkConnectionId(connectionId) == true)
+        {
+            lease = _connections[connectionId];
+            _connections.erase(connectionId);
+            closed.push_back(lease);
+        }
+        if ((lease._connection != nullptr) && (lease._pooled == false) && (lease._extraChannel == false))
+        {
+            for (std::map<int, Lease>::iterator it = _connections.begin(); it != _connections.end();)
+            {
+                if (it->second._connection == lease._connection)
+                {
+                    closed.push_back(it->second);
+                    it = _connections.erase(it);
+                }
+                else
+                {
+                    it++;
+                }
+            }
+        }
+    }
+    for (const Lease& closedLease : closed)
     {
-        _connections[connectionId]->closeConnection();
-        _connections[connectionId].reset();
-        _connections.erase(connectionId);
+        if (closedLease._forwarder != nullptr)
+        {
+            closedLease._forwarder->stop();
+        }
+    }
+    if (lease._connection != nullptr)
+    {
+        if (lease._pooled == true)
+        {
+            lease._connection->closeSession(lease._channel);
+            _pool.release(lease._connection);
+        }
+        else if (lease._extraChannel == true)
+        {
+            lease._connection->closeSession(lease._channel);
+        }
+        else
+        {
+            lease._connection->closeConnection();
+        }
     }
     return true;
 }
 
+bool CppsshImpl::setConnectionPool(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds)
+{
+    bool ret = false;
+    if (maxChannels > CPPSSH_POOL_MAX_CHANNELS)
+    {
+        cdLog(LogLevel::Error) << "Pool channel count " << maxChannels << " exceeds the maximum of " << CPPSSH_POOL_MAX_CHANNELS;
+    }
+    else
+    {
+        _pool.configure(maxChannels, idleSeconds, healthCheckSeconds);
+        ret = true;
+    }
+    return ret;
+}
+
+bool CppsshImpl::preconnect(const char* host, const short port, const char* username, const char* privKeyFile,
+                            const char* password, unsigned int timeout, size_t count)
+{
+    return _pool.preconnect(host, port, username, privKeyFile, password, timeout, count);
+}
+
 bool CppsshImpl::setPreferredCipher(const char* prefCipher)
 {
     std::unique_lock<std::mutex> lock(_optionsMutex);
@@ -166,11 +599,214 @@ bool CppsshImpl::setPreferredHmac(const char* prefHmac)
     return CppsshImpl::MAC_ALGORITHMS.setPref(prefHmac);
 }
 
+bool CppsshImpl::setCtrKeystreamPrefill(size_t bufferSize, bool refillWhenIdle)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    if (bufferSize > CPPSSH_KEYSTREAM_MAX_BUFFER)
+    {
+        cdLog(LogLevel::Error) << "Keystream buffer size " << bufferSize << " exceeds the maximum of " << CPPSSH_KEYSTREAM_MAX_BUFFER;
+    }
+    else
+    {
+        _keystreamBufferSize = bufferSize;
+        _keystreamRefillWhenIdle = refillWhenIdle;
+        ret = true;
+    }
+    return ret;
+}
+
+void CppsshImpl::getCtrKeystreamPrefill(size_t* bufferSize, bool* refillWhenIdle)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    *bufferSize = _keystreamBufferSize;
+    *refillWhenIdle = _keystreamRefillWhenIdle;
+}
+
+bool CppsshImpl::setParallelCtr(unsigned int threads, size_t minChunkSize)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    if (threads > CPPSSH_PARALLEL_CTR_MAX_THREADS)
+    {
+        cdLog(LogLevel::Error) << "Parallel CTR thread count " << threads << " exceeds the maximum of " << CPPSSH_PARALLEL_CTR_MAX_THREADS;
+    }
+    else
+    {
+        _parallelCtrThreads = threads;
+        _parallelCtrMinChunk = minChunkSize;
+        ret = true;
+    }
+    return ret;
+}
+
+void CppsshImpl::getParallelCtr(unsigned int* threads, size_t* minChunkSize)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    *threads = _parallelCtrThreads;
+    *minChunkSize = _parallelCtrMinChunk;
+}
+
+bool CppsshImpl::tuneAlgorithms(CppsshTuneMode_t mode)
+{
+    bool ret = true;
+    std::vector<cryptoMethods> ciphers;
+    std::vector<macMethods> macs;
+    std::string rates;
+    if (mode == CPPSSH_TUNE_CPUID)
+    {
+        CppsshAlgoTuner::orderByCpuid(&ciphers, &macs);
+    }
+    else if (mode == CPPSSH_TUNE_BENCHMARK)
+    {
+        // The benchmark takes a while, it runs on copies so connects and
+        // rekeys can read the options meanwhile
+        std::vector<CryptoStrings<cryptoMethods> > cipherList;
+        std::vector<CryptoStrings<macMethods> > macList;
+        std::vector<cryptoMethods> cipherOrder;
+        std::vector<macMethods> macOrder;
+        {// new scope for mutex
+            std::unique_lock<std::mutex> lock(_optionsMutex);
+            CIPHER_ALGORITHMS.getAlgos(&cipherList);
+            CIPHER_ALGORITHMS.getMethods(&cipherOrder);
+            MAC_ALGORITHMS.getAlgos(&macList);
+            MAC_ALGORITHMS.getMethods(&macOrder);
+        }
+        CppsshCryptoAlgos cipherAlgos(cipherList);
+        CppsshMacAlgos macAlgos(macList);
+        cipherAlgos.setOrder(cipherOrder);
+        macAlgos.setOrder(macOrder);
+        CppsshAlgoTuner::orderByBenchmark(cipherAlgos, macAlgos, &ciphers, &macs, &rates);
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Unknown tune mode: " << mode;
+        ret = false;
+    }
+    if (ret == true)
+    {
+        std::unique_lock<std::mutex> lock(_optionsMutex);
+        CIPHER_ALGORITHMS.setOrder(ciphers);
+        MAC_ALGORITHMS.setOrder(macs);
+        _algorithmRates = rates;
+    }
+    return ret;
+}
+
+size_t CppsshImpl::getAlgorithmRates(char* rates)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    return copyString(_algorithmRates, rates);
+}
+
+bool CppsshImpl::setKexKeyPool(size_t depth, size_t lowWater, bool wipeAfterUse)
+{
+    bool ret = false;
+    if (depth > CPPSSH_KEX_POOL_MAX_DEPTH)
+    {
+        cdLog(LogLevel::Error) << "Kex key pool depth " << depth << " exceeds the maximum of " << CPPSSH_KEX_POOL_MAX_DEPTH;
+    }
+    else
+    {
+        KEX_KEY_POOL.configure(depth, lowWater, wipeAfterUse);
+        ret = true;
+    }
+    return ret;
+}
+
+void CppsshImpl::getKexKeyPoolStats(uint64_t* hits, uint64_t* misses)
+{
+    KEX_KEY_POOL.getStats(hits, misses);
+}
+
+void CppsshImpl::setRekeyLimits(uint64_t bytes, uint32_t seconds)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    _rekeyBytes = bytes;
+    _rekeySeconds = seconds;
+}
+
+void CppsshImpl::getRekeyLimits(uint64_t* bytes, uint32_t* seconds)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    *bytes = _rekeyBytes;
+    *seconds = _rekeySeconds;
+}
+
+void CppsshImpl::setKexGuess(bool enable)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    _kexGuess = enable;
+}
+
+bool CppsshImpl::getKexGuess()
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    return _kexGuess;
+}
+
+void CppsshImpl::setKexPipeline(bool enable)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    _kexPipeline = enable;
+}
+
+bool CppsshImpl::getKexPipeline()
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    return _kexPipeline;
+}
+
+void CppsshImpl::setImmediateKeyAuth(bool enable)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    _immediateKeyAuth = enable;
+}
+
+bool CppsshImpl::getImmediateKeyAuth()
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    return _immediateKeyAuth;
+}
+
+bool CppsshImpl::setSftpPipeline(size_t requests, uint32_t requestSize)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    if ((requests == 0) || (requests > CPPSSH_SFTP_MAX_REQUESTS))
+    {
+        cdLog(LogLevel::Error) << "SFTP requests in flight must be 1 to " << CPPSSH_SFTP_MAX_REQUESTS;
+    }
+    else if ((requestSize == 0) || (requestSize > CPPSSH_SFTP_MAX_REQUEST_SIZE))
+    {
+        cdLog(LogLevel::Error) << "SFTP request size must be 1 to " << CPPSSH_SFTP_MAX_REQUEST_SIZE;
+    }
+    else
+    {
+        _sftpRequests = requests;
+        _sftpRequestSize = requestSize;
+        ret = true;
+    }
+    return ret;
+}
+
+void CppsshImpl::getSftpPipeline(size_t* requests, uint32_t* requestSize)
+{
+    std::unique_lock<std::mutex> lock(_optionsMutex);
+    *requests = _sftpRequests;
+    *requestSize = _sftpRequestSize;
+}
+
 template<typename T> size_t CppsshImpl::getSupportedAlogs(const T& algos, char* list)
 {
-    size_t ret;
     std::string str;
     algos.toString(&str);
+    return copyString(str, list);
+}
+
+size_t CppsshImpl::copyString(const std::string& str, char* list)
+{
+    size_t ret;
     ret = str.length();
     if (list != nullptr)
     {
@@ -206,17 +842,52 @@ bool CppsshImpl::generateDsaKeyPair(const char* fqdn, const char* privKeyFileNam
     return CppsshKeys::generateDsaKeyPair(fqdn, privKeyFileName, pubKeyFileName, keySize);
 }
 
-std::shared_ptr<CppsshConnection> CppsshImpl::getConnection(const int connectionId)
+bool CppsshImpl::getLease(const int connectionId, Lease* lease)
 {
-    std::shared_ptr<CppsshConnection> con;
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_connectionsMutex);
+    if (checkConnectionId(connectionId) == true)
     {
-        std::unique_lock<std::mutex> lock(_connectionsMutex);
-        if (checkConnectionId(connectionId) == true)
+        *lease = _connections[connectionId];
+        ret = true;
+    }
+    return ret;
+}
+
+std::shared_ptr<CppsshSftp> CppsshImpl::getSftp(const int sftpId)
+{
+    std::shared_ptr<CppsshSftp> sftp;
+    Lease lease;
+    if (getLease(sftpId, &lease) == true)
+    {
+        sftp = lease._sftp;
+    }
+    if (sftp == nullptr)
+    {
+        cdLog(LogLevel::Error) << "Not an SFTP session: " << sftpId;
+    }
+    return sftp;
+}
+
+// One forwarder per connection id, started with its first forward
+std::shared_ptr<CppsshForwarder> CppsshImpl::getForwarder(const int connectionId, bool create)
+{
+    std::shared_ptr<CppsshForwarder> forwarder;
+    std::unique_lock<std::mutex> lock(_connectionsMutex);
+    if (checkConnectionId(connectionId) == true)
+    {
+        Lease& lease = _connections[connectionId];
+        if ((lease._forwarder == nullptr) && (create == true))
         {
-            con = _connections[connectionId];
+            lease._forwarder.reset(new CppsshForwarder(lease._connection));
         }
+        forwarder = lease._forwarder;
+    }
+    if (forwarder == nullptr)
+    {
+        cdLog(LogLevel::Error) << "No forwards on connection: " << connectionId;
     }
-    return con;
+    return forwarder;
 }
 
 bool CppsshImpl::checkConnectionId(const int connectionId)
@@ -229,3 +900,10 @@ bool CppsshImpl::checkConnectionId(const int connectionId)
     }
     return ret;
 }
+
+// Sessions, extra channels and pooled connections all count from the same id
+int CppsshImpl::nextConnectionId()
+{
+    std::unique_lock<std::mutex> lock(_connectionsMutex);
+    return ++_connectionId;
+}
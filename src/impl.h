@@ -21,7 +21,13 @@
 
 #include "botan/auto_rng.h"
 #include "cryptoalgos.h"
+#include "kexkeypool.h"
 #include "connection.h"
+#include "connectionpool.h"
+#include "sftp.h"
+#include "transfer.h"
+#include "scp.h"
+#include "forward.h"
 #include "cppssh.h"
 #include <memory>
 #include <map>
@@ -33,6 +39,24 @@ public:
     static bool setPreferredHmac(const char* prefHmac);
     static size_t getSupportedCiphers(char* ciphers);
     static size_t getSupportedHmacs(char* hmacs);
+    static bool setCtrKeystreamPrefill(size_t bufferSize, bool refillWhenIdle);
+    static void getCtrKeystreamPrefill(size_t* bufferSize, bool* refillWhenIdle);
+    static bool setParallelCtr(unsigned int threads, size_t minChunkSize);
+    static void getParallelCtr(unsigned int* threads, size_t* minChunkSize);
+    static bool tuneAlgorithms(CppsshTuneMode_t mode);
+    static size_t getAlgorithmRates(char* rates);
+    static bool setKexKeyPool(size_t depth, size_t lowWater, bool wipeAfterUse);
+    static void getKexKeyPoolStats(uint64_t* hits, uint64_t* misses);
+    static void setRekeyLimits(uint64_t bytes, uint32_t seconds);
+    static void getRekeyLimits(uint64_t* bytes, uint32_t* seconds);
+    static void setKexGuess(bool enable);
+    static bool getKexGuess();
+    static void setKexPipeline(bool enable);
+    static bool getKexPipeline();
+    static void setImmediateKeyAuth(bool enable);
+    static bool getImmediateKeyAuth();
+    static bool setSftpPipeline(size_t requests, uint32_t requestSize);
+    static void getSftpPipeline(size_t* requests, uint32_t* requestSize);
 
     static bool generateRsaKeyPair(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, short keySize);
     static bool generateDsaKeyPair(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, short keySize);
@@ -42,23 +66,89 @@ public:
     bool isConnected(const int connectionId);
     bool write(const int connectionId, const uint8_t* data, size_t bytes);
     bool read(const int connectionId, CppsshMessage* data);
+    bool readStderr(const int connectionId, CppsshMessage* data);
+    bool getExitStatus(const int connectionId, int* exitStatus);
     bool windowChange(const int connectionId, const uint32_t cols, const uint32_t rows);
+    bool openChannel(const int connectionId, int* channelId, const bool x11Forwarded, const char* term, const char* command, const char* subsystem);
+    bool sftpOpen(const int connectionId, int* sftpId);
+    bool sftpGet(const int sftpId, const char* remotePath, const char* localPath);
+    bool sftpPut(const int sftpId, const char* localPath, const char* remotePath, uint32_t mode);
+    bool sftpMkdir(const int sftpId, const char* path, uint32_t mode);
+    bool sftpRemove(const int sftpId, const char* path);
+    bool sftpGetFileSize(const int sftpId, const char* path, uint64_t* size);
+    bool transfer(const int* connectionIds, size_t connections, size_t streamsPerConnection, bool download, const char* from, const char* to);
+    size_t getTransferRates(char* rates);
+    bool scp(const int connectionId, bool download, const char* localPath, const char* remotePath, uint32_t mode, double* mbps);
+    bool forwardLocal(const int connectionId, const char* listen, const short listenPort, const char* remote, const short remotePort);
+    bool cancelForwardLocal(const int connectionId, const char* listen, const short listenPort);
+    bool forwardRemote(const int connectionId, const char* bindAddress, const short bindPort, const char* local, const short localPort, short* boundPort);
+    bool cancelForwardRemote(const int connectionId, const char* bindAddress, const short bindPort);
     bool close(const int connectionId);
+    bool setConnectionPool(size_t maxChannels, uint32_t idleSeconds, uint32_t healthCheckSeconds);
+    bool preconnect(const char* host, const short port, const char* username, const char* privKeyFile, const char* password, unsigned int timeout, size_t count);
 
     static CppsshMacAlgos MAC_ALGORITHMS;
     static CppsshCryptoAlgos CIPHER_ALGORITHMS;
     static CppsshKexAlgos KEX_ALGORITHMS;
     static CppsshHostkeyAlgos HOSTKEY_ALGORITHMS;
     static CppsshCompressionAlgos COMPRESSION_ALGORITHMS;
+    static CppsshKexKeyPool KEX_KEY_POOL;
 
     static std::shared_ptr<Botan::RandomNumberGenerator> RNG;
 private:
+    // What a connection id refers to, a session channel on a connection that may be shared
+    class Lease
+    {
+    public:
+        Lease()
+            : _channel(0),
+            _pooled(false),
+            _extraChannel(false)
+        {
+        }
+
+        Lease(const std::shared_ptr<CppsshConnection>& connection, uint32_t channel, bool pooled, bool extraChannel)
+            : _connection(connection),
+            _channel(channel),
+            _pooled(pooled),
+            _extraChannel(extraChannel)
+        {
+        }
+
+        std::shared_ptr<CppsshConnection> _connection;
+        uint32_t _channel;
+        bool _pooled;
+        // Opened with openChannel, closing it leaves the connection open
+        bool _extraChannel;
+        std::shared_ptr<CppsshSftp> _sftp;
+        std::shared_ptr<CppsshForwarder> _forwarder;
+    };
+
     bool checkConnectionId(const int connectionId);
+    int nextConnectionId();
     template<typename T> static size_t getSupportedAlogs(const T& algos, char* list);
-    std::shared_ptr<CppsshConnection> getConnection(const int connectionId);
-    std::map<int, std::shared_ptr<CppsshConnection> > _connections;
+    static size_t copyString(const std::string& str, char* list);
+    bool getLease(const int connectionId, Lease* lease);
+    std::shared_ptr<CppsshSftp> getSftp(const int sftpId);
+    std::shared_ptr<CppsshForwarder> getForwarder(const int connectionId, bool create);
+    std::map<int, Lease> _connections;
     std::mutex _connectionsMutex;
+    CppsshConnectionPool _pool;
+    std::string _transferRates;
+    std::mutex _transferRatesMutex;
     static std::mutex _optionsMutex;
+    static size_t _keystreamBufferSize;
+    static bool _keystreamRefillWhenIdle;
+    static unsigned int _parallelCtrThreads;
+    static size_t _parallelCtrMinChunk;
+    static std::string _algorithmRates;
+    static uint64_t _rekeyBytes;
+    static uint32_t _rekeySeconds;
+    static bool _kexGuess;
+    static bool _kexPipeline;
+    static bool _immediateKeyAuth;
+    static size_t _sftpRequests;
+    static uint32_t _sftpRequestSize;
     int _connectionId;
 };
 
@@ -23,12 +23,23 @@
 #include "packet.h"
 #include "crypto.h"
 
+std::set<std::string> CppsshKex::s_guessMisses;
+std::mutex CppsshKex::s_guessMutex;
+
 CppsshKex::CppsshKex(const std::shared_ptr<CppsshSession>& session)
-    : _session(session)
+    : _session(session),
+    _crypto(new CppsshCrypto(session)),
+    _initSent(false),
+    _dhInitSent(false)
 {
 }
 
-void CppsshKex::constructLocalKex()
+std::string CppsshKex::firstAlgo(const std::string& list)
+{
+    return list.substr(0, list.find(','));
+}
+
+void CppsshKex::constructLocalKex(bool guess)
 {
     std::vector<Botan::byte> random;
     std::string kexStr;
@@ -50,6 +61,13 @@ void CppsshKex::constructLocalKex()
     CppsshImpl::CIPHER_ALGORITHMS.toString(&ciphersStr);
     CppsshImpl::MAC_ALGORITHMS.toString(&hmacsStr);
     CppsshImpl::COMPRESSION_ALGORITHMS.toString(&compressors);
+    _guessKex = firstAlgo(kexStr);
+    _guessHostkey = firstAlgo(hostkeyStr);
+    if (_session->getSessionID().empty() == true)
+    {
+        // RFC 8308, asks for SSH2_MSG_EXT_INFO after the first NEWKEYS
+        kexStr.append(",ext-info-c");
+    }
 
     CppsshPacket localKex(&_localKex);
 
@@ -67,32 +85,82 @@ void CppsshKex::constructLocalKex()
     localKex.addString(compressors);
     localKex.addInt(0);
     localKex.addInt(0);
-    localKex.addByte('\0');
+    // first_kex_packet_follows
+    localKex.addByte((guess == true) ? 1 : 0);
     localKex.addInt(0);
 }
 
-bool CppsshKex::sendInit(Botan::secure_vector<Botan::byte>& buf)
+bool CppsshKex::sendInit(const std::string& peer)
 {
     bool ret = false;
-    CppsshPacket packet(&buf);
+    bool guess = false;
 
-    constructLocalKex();
+    _peer = peer;
+    if ((_peer.empty() == false) && (CppsshImpl::getKexGuess() == true))
+    {
+        std::unique_lock<std::mutex> lock(s_guessMutex);
+        guess = (s_guessMisses.find(_peer) == s_guessMisses.end());
+    }
+    constructLocalKex(guess);
 
     if (_session->_transport->sendMessage(_localKex) == true)
     {
-        if ((_session->_channel->waitForGlobalMessage(buf) == true) && (packet.getCommand() == SSH2_MSG_KEXINIT))
+        _initSent = true;
+        ret = true;
+        if (guess == true)
         {
-            ret = true;
-        }
-        else
-        {
-            cdLog(LogLevel::Error) << "Timeout while waiting for key exchange init reply.";
+            // The guess is our own first choice, RFC 4253 section 7
+            kexMethods kexMethod;
+            if ((CppsshImpl::KEX_ALGORITHMS.ssh2enum(_guessKex, &kexMethod) == true) &&
+                (_crypto->setNegotiatedKex(kexMethod) == true) && (sendKexDHInit() == true))
+            {
+                _dhInitSent = true;
+            }
+            else
+            {
+                ret = false;
+            }
         }
     }
 
     return ret;
 }
 
+bool CppsshKex::receiveInit(Botan::secure_vector<Botan::byte>& buf)
+{
+    bool ret = false;
+    CppsshPacket packet(&buf);
+
+    if ((_session->_channel->waitForKexMessage(buf) == true) && (packet.getCommand() == SSH2_MSG_KEXINIT))
+    {
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Timeout while waiting for key exchange init reply.";
+    }
+
+    return ret;
+}
+
+// The server only uses a guessed packet when both sides list the same kex and
+// host key methods first, otherwise it drops it and the exchange starts over.
+void CppsshKex::checkGuess(const Botan::secure_vector<Botan::byte>& remoteKexAlgos)
+{
+    std::string remoteKex;
+    std::string remoteHostkey;
+    const CppsshConstPacket firstAlgosPacket(&remoteKexAlgos);
+
+    if ((firstAlgosPacket.getString(&remoteKex) == false) || (firstAlgosPacket.getString(&remoteHostkey) == false) ||
+        (firstAlgo(remoteKex) != _guessKex) || (firstAlgo(remoteHostkey) != _guessHostkey))
+    {
+        cdLog(LogLevel::Debug) << "Kex guess " << _guessKex << "/" << _guessHostkey << " was wrong";
+        _dhInitSent = false;
+        std::unique_lock<std::mutex> lock(s_guessMutex);
+        s_guessMisses.insert(_peer);
+    }
+}
+
 template <typename T> T CppsshKex::runAgreement(const CppsshConstPacket& remoteKexAlgosPacket,
                                                 const CppsshAlgos<T>& algorithms, const std::string& tag) const
 {
@@ -120,7 +188,7 @@ bool CppsshKex::handleInit()
     bool ret = false;
     Botan::secure_vector<Botan::byte> buf;
     CppsshPacket packet(&buf);
-    if (sendInit(buf) == true)
+    if (((_initSent == true) || (sendInit() == true)) && (receiveInit(buf) == true))
     {
         _remoteKex.clear();
         CppsshPacket remoteKexPacket(&_remoteKex);
@@ -129,30 +197,34 @@ bool CppsshKex::handleInit()
 
         Botan::secure_vector<Botan::byte> remoteKexAlgos(packet.getPayloadBegin() + 17, packet.getPayloadEnd());
         const CppsshConstPacket remoteKexAlgosPacket(&remoteKexAlgos);
+        if (_dhInitSent == true)
+        {
+            checkGuess(remoteKexAlgos);
+        }
 
-        if ((_session->_crypto->setNegotiatedKex(runAgreement<kexMethods>(remoteKexAlgosPacket,
+        if ((_crypto->setNegotiatedKex(runAgreement<kexMethods>(remoteKexAlgosPacket,
                                                                           CppsshImpl::KEX_ALGORITHMS,
                                                                           "Kex")) == true) &&
-            (_session->_crypto->setNegotiatedHostkey(runAgreement<hostkeyMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedHostkey(runAgreement<hostkeyMethods>(remoteKexAlgosPacket,
                                                                                   CppsshImpl::HOSTKEY_ALGORITHMS,
                                                                                   "Hostkey")) == true) &&
-            (_session->_crypto->setNegotiatedCryptoC2s(runAgreement<cryptoMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedCryptoC2s(runAgreement<cryptoMethods>(remoteKexAlgosPacket,
                                                                                    CppsshImpl::CIPHER_ALGORITHMS,
                                                                                    "C2S Cipher")) == true) &&
-            (_session->_crypto->setNegotiatedCryptoS2c(runAgreement<cryptoMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedCryptoS2c(runAgreement<cryptoMethods>(remoteKexAlgosPacket,
                                                                                    CppsshImpl::CIPHER_ALGORITHMS,
                                                                                    "S2C Cipher")) == true) &&
-            (_session->_crypto->setNegotiatedMacC2s(runAgreement<macMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedMacC2s(runAgreement<macMethods>(remoteKexAlgosPacket,
                                                                              CppsshImpl::MAC_ALGORITHMS,
                                                                              "C2S MAC")) == true) &&
-            (_session->_crypto->setNegotiatedMacS2c(runAgreement<macMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedMacS2c(runAgreement<macMethods>(remoteKexAlgosPacket,
                                                                              CppsshImpl::MAC_ALGORITHMS,
                                                                              "S2C MAC")) == true) &&
-            (_session->_crypto->setNegotiatedCmprsC2s(runAgreement<compressionMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedCmprsC2s(runAgreement<compressionMethods>(remoteKexAlgosPacket,
                                                                                        CppsshImpl::
                                                                                        COMPRESSION_ALGORITHMS,
                                                                                        "C2S Compression")) == true) &&
-            (_session->_crypto->setNegotiatedCmprsS2c(runAgreement<compressionMethods>(remoteKexAlgosPacket,
+            (_crypto->setNegotiatedCmprsS2c(runAgreement<compressionMethods>(remoteKexAlgosPacket,
                                                                                        CppsshImpl::
                                                                                        COMPRESSION_ALGORITHMS,
                                                                                        "S2C Compression")) == true))
@@ -163,32 +235,35 @@ bool CppsshKex::handleInit()
     return ret;
 }
 
-bool CppsshKex::sendKexDHInit(Botan::secure_vector<Botan::byte>& buf)
+bool CppsshKex::sendKexDHInit()
 {
     bool ret = false;
-    Botan::BigInt publicKey;
+    Botan::secure_vector<Botan::byte> buf;
 
-    if (_session->_crypto->getKexPublic(publicKey) == true)
+    _e.clear();
+    if (_crypto->getKexPublic(&_e) == true)
     {
+        // SSH2_MSG_KEX_ECDH_INIT has the same number, Q_C takes the place of e
         CppsshPacket dhInit(&buf);
         dhInit.addByte(SSH2_MSG_KEXDH_INIT);
-        dhInit.addBigInt(publicKey);
+        dhInit.addVectorField(_e);
+        ret = _session->_transport->sendMessage(buf);
+    }
+    return ret;
+}
 
-        _e.clear();
-        CppsshConstPacket::bn2vector(&_e, publicKey);
+bool CppsshKex::receiveKexDHReply(Botan::secure_vector<Botan::byte>& buf)
+{
+    bool ret = false;
+    CppsshPacket packet(&buf);
 
-        if (_session->_transport->sendMessage(buf) == true)
-        {
-            if ((_session->_channel->waitForGlobalMessage(buf) == true) &&
-                (dhInit.getCommand() == SSH2_MSG_KEXDH_REPLY))
-            {
-                ret = true;
-            }
-            else
-            {
-                cdLog(LogLevel::Error) << "Timeout while waiting for key exchange DH reply.";
-            }
-        }
+    if ((_session->_channel->waitForKexMessage(buf) == true) && (packet.getCommand() == SSH2_MSG_KEXDH_REPLY))
+    {
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Timeout while waiting for key exchange DH reply.";
     }
     return ret;
 }
@@ -200,25 +275,28 @@ bool CppsshKex::handleKexDHReply()
     Botan::secure_vector<Botan::byte> hSig, kVector, hVector;
     CppsshPacket packet(&buffer);
 
-    if ((sendKexDHInit(buffer) == true) && (buffer.empty() == false))
+    if (((_dhInitSent == true) || (sendKexDHInit() == true)) && (receiveKexDHReply(buffer) == true) &&
+        (buffer.empty() == false))
     {
         packet.skipHeader();
-        Botan::BigInt publicKey;
 
         _hostKey.clear();
-        if ((packet.getString(&_hostKey) == true) && (packet.getBigInt(&publicKey) == true))
+        _f.clear();
+        _k.clear();
+        // f is an mpint and Q_S a string, both are hashed exactly as received
+        if ((packet.getString(&_hostKey) == true) && (packet.getString(&_f) == true))
         {
-            _f.clear();
-            _k.clear();
-            CppsshConstPacket::bn2vector(&_f, publicKey);
-
-            if ((packet.getString(&hSig) == true) && (_session->_crypto->makeKexSecret(&_k, publicKey) == true))
+            if ((packet.getString(&hSig) == true) && (_crypto->makeKexSecret(&_k, _f) == true))
             {
                 makeH(&hVector);
                 if (hVector.empty() == false)
                 {
-                    _session->setSessionID(hVector);
-                    ret = _session->_crypto->verifySig(_hostKey, hSig);
+                    // The H of the first key exchange stays the session id for good
+                    if (_session->getSessionID().empty() == true)
+                    {
+                        _session->setSessionID(hVector);
+                    }
+                    ret = _crypto->verifySig(_hostKey, hSig);
                 }
             }
         }
@@ -240,7 +318,7 @@ void CppsshKex::makeH(Botan::secure_vector<Botan::byte>* hVector)
     hashBytes.addVectorField(_f);
     hashBytes.addVectorField(_k);
 
-    _session->_crypto->computeH(hVector, buf);
+    _crypto->computeH(hVector, buf);
 }
 
 bool CppsshKex::sendKexNewKeys()
@@ -249,22 +327,18 @@ bool CppsshKex::sendKexNewKeys()
     Botan::secure_vector<Botan::byte> buf;
     CppsshPacket packet(&buf);
 
-    if ((_session->_channel->waitForGlobalMessage(buf) == true) && (packet.getCommand() == SSH2_MSG_NEWKEYS))
+    if (_crypto->makeNewKeys() == false)
     {
-        Botan::secure_vector<Botan::byte> newKeys;
-        CppsshPacket newKeysPacket(&newKeys);
-        newKeysPacket.addByte(SSH2_MSG_NEWKEYS);
-        if (_session->_transport->sendMessage(newKeys) == true)
-        {
-            if (_session->_crypto->makeNewKeys() == false)
-            {
-                cdLog(LogLevel::Error) << "Could not make keys.";
-            }
-            else
-            {
-                ret = true;
-            }
-        }
+        cdLog(LogLevel::Error) << "Could not make keys.";
+    }
+    else if (_session->_transport->sendNewKeys(_crypto) == false)
+    {
+        cdLog(LogLevel::Error) << "Could not send key exchange newkeys.";
+    }
+    else if ((_session->_channel->waitForKexMessage(buf) == true) && (packet.getCommand() == SSH2_MSG_NEWKEYS))
+    {
+        _session->_crypto = _crypto;
+        ret = true;
     }
     else
     {
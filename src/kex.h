@@ -23,29 +23,48 @@
 #include "packet.h"
 #include "cryptoalgos.h"
 #include <memory>
+#include <mutex>
+#include <set>
 
 class CppsshKex
 {
 public:
     CppsshKex(const std::shared_ptr<CppsshSession>& session);
+    // Send our KEXINIT without waiting for the server's. With peer set the
+    // first kex packet may be guessed and sent right behind it.
+    bool sendInit(const std::string& peer = std::string());
     bool handleInit();
     bool handleKexDHReply();
     bool sendKexNewKeys();
 
 private:
-    bool sendInit(Botan::secure_vector<Botan::byte>& packet);
-    bool sendKexDHInit(Botan::secure_vector<Botan::byte>& packet);
-    void constructLocalKex();
+    bool receiveInit(Botan::secure_vector<Botan::byte>& packet);
+    bool sendKexDHInit();
+    bool receiveKexDHReply(Botan::secure_vector<Botan::byte>& packet);
+    void constructLocalKex(bool guess);
+    void checkGuess(const Botan::secure_vector<Botan::byte>& remoteKexAlgos);
+    static std::string firstAlgo(const std::string& list);
     void makeH(Botan::secure_vector<Botan::byte>* hVector);
     template <typename T> T runAgreement(const CppsshConstPacket& remoteKexAlgosPacket, const CppsshAlgos<T>& algorithms, const std::string& tag) const;
 
     std::shared_ptr<CppsshSession> _session;
+    // Negotiated and keyed by this exchange, the transport switches to it at NEWKEYS
+    std::shared_ptr<CppsshCrypto> _crypto;
     Botan::secure_vector<Botan::byte> _localKex;
     Botan::secure_vector<Botan::byte> _remoteKex;
     Botan::secure_vector<Botan::byte> _hostKey;
     Botan::secure_vector<Botan::byte> _e;
     Botan::secure_vector<Botan::byte> _f;
     Botan::secure_vector<Botan::byte> _k;
+    std::string _peer;
+    std::string _guessKex;
+    std::string _guessHostkey;
+    bool _initSent;
+    bool _dhInitSent;
+
+    // Peers that did not prefer our first kex and host key methods last time
+    static std::set<std::string> s_guessMisses;
+    static std::mutex s_guessMutex;
 };
 
 #endif
@@ -0,0 +1,266 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "kexkeypool.h"
+#include "crypto.h"
+#include "impl.h"
+#include "botan/dh.h"
+#include "botan/ecdh.h"
+#include "botan/curve25519.h"
+#if defined(WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+CppsshKexKeyPool::CppsshKexKeyPool()
+    : _depth(0),
+    _lowWater(0),
+    _wipeAfterUse(true),
+    _hits(0),
+    _misses(0),
+    _running(false)
+{
+}
+
+CppsshKexKeyPool::~CppsshKexKeyPool()
+{
+    stop();
+}
+
+void CppsshKexKeyPool::start(const std::shared_ptr<Botan::RandomNumberGenerator>& rng)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _rng = rng;
+    if (_running == false)
+    {
+        _running = true;
+        _fillThread = std::thread(&CppsshKexKeyPool::fillThread, this);
+    }
+}
+
+void CppsshKexKeyPool::stop()
+{
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _running = false;
+        // Keys are not kept across a stop, the next start generates new ones
+        for (std::pair<const std::string, Group>& group : _groups)
+        {
+            group.second._keys.clear();
+            group.second._refilling = (_depth > 0);
+        }
+    }
+    _cond.notify_all();
+    if (_fillThread.joinable() == true)
+    {
+        _fillThread.join();
+    }
+}
+
+void CppsshKexKeyPool::configure(size_t depth, size_t lowWater, bool wipeAfterUse)
+{
+    std::vector<kexMethods> methods;
+    CppsshImpl::KEX_ALGORITHMS.getMethods(&methods);
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _depth = depth;
+        _lowWater = std::min(lowWater, depth);
+        _wipeAfterUse = wipeAfterUse;
+        // Aliases such as the two curve25519 names share one pool
+        for (kexMethods method : methods)
+        {
+            Group& group = _groups[CppsshImpl::KEX_ALGORITHMS.enum2botan(method)];
+            group._method = method;
+            group._refilling = (group._keys.size() < _depth);
+            while (group._keys.size() > _depth)
+            {
+                group._keys.pop_back();
+            }
+        }
+    }
+    _cond.notify_all();
+}
+
+void CppsshKexKeyPool::getStats(uint64_t* hits, uint64_t* misses)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    *hits = _hits;
+    *misses = _misses;
+}
+
+std::unique_ptr<Botan::PK_Key_Agreement_Key> CppsshKexKeyPool::take(kexMethods method)
+{
+    std::unique_ptr<Botan::PK_Key_Agreement_Key> ret;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        Group& group = _groups[CppsshImpl::KEX_ALGORITHMS.enum2botan(method)];
+        group._method = method;
+        if (group._keys.empty() == false)
+        {
+            ret = std::move(group._keys.front());
+            group._keys.pop_front();
+            _hits++;
+        }
+        else
+        {
+            _misses++;
+        }
+        if ((_depth > 0) && (group._keys.size() <= _lowWater))
+        {
+            group._refilling = true;
+            _cond.notify_all();
+        }
+    }
+    if (ret == nullptr)
+    {
+        ret = generate(method);
+    }
+    return ret;
+}
+
+void CppsshKexKeyPool::release(kexMethods method, std::unique_ptr<Botan::PK_Key_Agreement_Key> key)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if ((_wipeAfterUse == false) && (key != nullptr))
+    {
+        Group& group = _groups[CppsshImpl::KEX_ALGORITHMS.enum2botan(method)];
+        if (group._keys.size() < std::max<size_t>(_depth, 1))
+        {
+            group._keys.push_back(std::move(key));
+        }
+    }
+    // Anything left in key is destroyed here, Botan keeps private keys in
+    // secure memory that is zeroed when it is freed
+}
+
+bool CppsshKexKeyPool::nextToFill(kexMethods* method)
+{
+    bool ret = false;
+    for (std::pair<const std::string, Group>& group : _groups)
+    {
+        if ((group.second._refilling == true) && (group.second._keys.size() >= _depth))
+        {
+            group.second._refilling = false;
+        }
+        if ((ret == false) && (group.second._refilling == true) && (group.second._method != kexMethods::MAX_VALS))
+        {
+            *method = group.second._method;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+void CppsshKexKeyPool::fillThread()
+{
+#if defined(WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+    // Linux applies the nice value to the calling thread only
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running == true)
+    {
+        kexMethods method;
+        if (nextToFill(&method) == false)
+        {
+            _cond.wait(lock);
+        }
+        else
+        {
+            std::unique_ptr<Botan::PK_Key_Agreement_Key> key;
+            lock.unlock();
+            key = generate(method);
+            lock.lock();
+            if (key == nullptr)
+            {
+                // Do not spin on a group that cannot be generated
+                _groups[CppsshImpl::KEX_ALGORITHMS.enum2botan(method)]._refilling = false;
+            }
+            else if (_running == true)
+            {
+                Group& group = _groups[CppsshImpl::KEX_ALGORITHMS.enum2botan(method)];
+                if (group._keys.size() < _depth)
+                {
+                    group._keys.push_back(std::move(key));
+                }
+            }
+        }
+    }
+}
+
+std::unique_ptr<Botan::PK_Key_Agreement_Key> CppsshKexKeyPool::generate(kexMethods method)
+{
+    std::unique_ptr<Botan::PK_Key_Agreement_Key> ret;
+    const std::string& name = CppsshImpl::KEX_ALGORITHMS.enum2botan(method);
+    std::shared_ptr<Botan::RandomNumberGenerator> rng;
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        rng = _rng;
+    }
+    try
+    {
+        if ((name.length() == 0) || (rng == nullptr))
+        {
+            cdLog(LogLevel::Error) << "Unable to generate a key for kex method " << (int)method;
+        }
+        else if (CppsshCrypto::isCurve25519(method) == true)
+        {
+            ret.reset(new Botan::Curve25519_PrivateKey(*rng));
+        }
+        else if (CppsshCrypto::isEcdh(method) == true)
+        {
+            ret.reset(new Botan::ECDH_PrivateKey(*rng, *getEcGroup(name)));
+        }
+        else
+        {
+            ret.reset(new Botan::DH_PrivateKey(*rng, *getDlGroup(name)));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << CPPSSH_EXCEPTION;
+    }
+    return ret;
+}
+
+std::shared_ptr<Botan::DL_Group> CppsshKexKeyPool::getDlGroup(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(_paramsMutex);
+    std::shared_ptr<Botan::DL_Group>& group = _dlGroups[name];
+    if (group == nullptr)
+    {
+        group.reset(new Botan::DL_Group(name));
+    }
+    return group;
+}
+
+std::shared_ptr<Botan::EC_Group> CppsshKexKeyPool::getEcGroup(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(_paramsMutex);
+    std::shared_ptr<Botan::EC_Group>& group = _ecGroups[name];
+    if (group == nullptr)
+    {
+        group.reset(new Botan::EC_Group(name));
+    }
+    return group;
+}
@@ -0,0 +1,99 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _KEX_KEY_POOL_Hxx
+#define _KEX_KEY_POOL_Hxx
+
+#include "cryptoalgos.h"
+#include "botan/pk_keys.h"
+#include "botan/rng.h"
+#include "botan/dl_group.h"
+#include "botan/ec_group.h"
+#include <memory>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define CPPSSH_KEX_POOL_MAX_DEPTH 64
+
+// Ephemeral key exchange keys generated ahead of time on a low priority
+// thread, one pool per group or curve in KEX_ALGORITHMS, so a connect takes
+// a ready key instead of doing the exponentiation inline. Parsed group
+// parameters are cached whether or not pre-generation is enabled.
+class CppsshKexKeyPool
+{
+public:
+    CppsshKexKeyPool();
+    CppsshKexKeyPool(const CppsshKexKeyPool&) = delete;
+    ~CppsshKexKeyPool();
+
+    // The helper thread only runs between start and stop
+    void start(const std::shared_ptr<Botan::RandomNumberGenerator>& rng);
+    void stop();
+
+    // Keep depth keys per group, refilling once lowWater or fewer are left.
+    // Without wipeAfterUse keys are handed back and reused by later exchanges.
+    void configure(size_t depth, size_t lowWater, bool wipeAfterUse);
+    void getStats(uint64_t* hits, uint64_t* misses);
+
+    // A pooled key when one is ready (a hit), otherwise one generated now (a miss)
+    std::unique_ptr<Botan::PK_Key_Agreement_Key> take(kexMethods method);
+    // The exchange is done with the key, it is destroyed or reused
+    void release(kexMethods method, std::unique_ptr<Botan::PK_Key_Agreement_Key> key);
+
+private:
+    class Group
+    {
+    public:
+        Group()
+            : _method(kexMethods::MAX_VALS),
+            _refilling(false)
+        {
+        }
+
+        kexMethods _method;
+        std::deque<std::unique_ptr<Botan::PK_Key_Agreement_Key> > _keys;
+        bool _refilling;
+    };
+
+    void fillThread();
+    bool nextToFill(kexMethods* method);
+    std::unique_ptr<Botan::PK_Key_Agreement_Key> generate(kexMethods method);
+    std::shared_ptr<Botan::DL_Group> getDlGroup(const std::string& name);
+    std::shared_ptr<Botan::EC_Group> getEcGroup(const std::string& name);
+
+    std::shared_ptr<Botan::RandomNumberGenerator> _rng;
+    std::map<std::string, Group> _groups;
+    size_t _depth;
+    size_t _lowWater;
+    bool _wipeAfterUse;
+    uint64_t _hits;
+    uint64_t _misses;
+    bool _running;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _fillThread;
+
+    std::map<std::string, std::shared_ptr<Botan::DL_Group> > _dlGroups;
+    std::map<std::string, std::shared_ptr<Botan::EC_Group> > _ecGroups;
+    std::mutex _paramsMutex;
+};
+
+#endif
@@ -313,14 +313,38 @@ bool CppsshKeys::getDSAKeys(const std::shared_ptr<Botan::Private_Key>& privKey)
     return ret;
 }
 
+hostkeyMethods CppsshKeys::getSigAlgo(const std::string& serverSigAlgs) const
+{
+    hostkeyMethods ret = _keyAlgo;
+    if (_keyAlgo == hostkeyMethods::SSH_RSA)
+    {
+        // Without server-sig-algs only ssh-rsa is known to work
+        std::vector<std::string> serverAlgos;
+        StrTrim::split(serverSigAlgs, ',', serverAlgos);
+        for (hostkeyMethods method : {hostkeyMethods::RSA_SHA2_512, hostkeyMethods::RSA_SHA2_256})
+        {
+            if (std::find(serverAlgos.begin(), serverAlgos.end(),
+                          CppsshImpl::HOSTKEY_ALGORITHMS.enum2ssh(method)) != serverAlgos.end())
+            {
+                ret = method;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
 const Botan::secure_vector<Botan::byte>& CppsshKeys::generateSignature(
-    const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData)
+    const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData,
+    hostkeyMethods sigAlgo)
 {
     _signature.clear();
-    switch (_keyAlgo)
+    switch (sigAlgo)
     {
         case hostkeyMethods::SSH_RSA:
-            _signature = generateRSASignature(sessionID, signingData);
+        case hostkeyMethods::RSA_SHA2_256:
+        case hostkeyMethods::RSA_SHA2_512:
+            _signature = generateRSASignature(sessionID, signingData, sigAlgo);
             break;
 
         case hostkeyMethods::SSH_DSS:
@@ -336,7 +360,8 @@ const Botan::secure_vector<Botan::byte>& CppsshKeys::generateSignature(
 }
 
 Botan::secure_vector<Botan::byte> CppsshKeys::generateRSASignature(const Botan::secure_vector<Botan::byte>& sessionID,
-                                                                   const Botan::secure_vector<Botan::byte>& signingData)
+                                                                   const Botan::secure_vector<Botan::byte>& signingData,
+                                                                   hostkeyMethods sigAlgo)
 {
     Botan::secure_vector<Botan::byte> ret;
     Botan::secure_vector<Botan::byte> sigRaw;
@@ -354,7 +379,7 @@ Botan::secure_vector<Botan::byte> CppsshKeys::generateRSASignature(const Botan::
         std::vector<Botan::byte> signedRaw;
 
         std::unique_ptr<Botan::PK_Signer> RSASigner(new Botan::PK_Signer(*_rsaPrivateKey, *CppsshImpl::RNG,
-                                                                         "EMSA3(SHA-1)"));
+                                                                         CppsshImpl::HOSTKEY_ALGORITHMS.enum2botan(sigAlgo)));
         signedRaw = RSASigner->sign_message(sigRaw, *CppsshImpl::RNG);
         if (signedRaw.size() == 0)
         {
@@ -363,7 +388,7 @@ Botan::secure_vector<Botan::byte> CppsshKeys::generateRSASignature(const Botan::
         else
         {
             CppsshPacket retPacket(&ret);
-            retPacket.addString("ssh-rsa");
+            retPacket.addString(CppsshImpl::HOSTKEY_ALGORITHMS.enum2ssh(sigAlgo));
             retPacket.addVectorField(Botan::secure_vector<Botan::byte>(signedRaw.begin(), signedRaw.end()));
         }
     }
@@ -32,8 +32,9 @@ public:
     }
 
     bool getKeyPairFromFile(const std::string& privKeyFileName, const char* keyPassword);
-    const Botan::secure_vector<Botan::byte>& generateSignature(const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData);
-    Botan::secure_vector<Botan::byte> generateRSASignature(const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData);
+    // sigAlgo picks the rsa-sha2 hash for RSA keys, it has to suit the key
+    const Botan::secure_vector<Botan::byte>& generateSignature(const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData, hostkeyMethods sigAlgo);
+    Botan::secure_vector<Botan::byte> generateRSASignature(const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData, hostkeyMethods sigAlgo);
     Botan::secure_vector<Botan::byte> generateDSASignature(const Botan::secure_vector<Botan::byte>& sessionID, const Botan::secure_vector<Botan::byte>& signingData);
 
     static bool generateRsaKeyPair(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, short keySize);
@@ -44,6 +45,9 @@ public:
         return _keyAlgo;
     }
 
+    // The signature algorithm to use with the server's server-sig-algs
+    hostkeyMethods getSigAlgo(const std::string& serverSigAlgs) const;
+
     const Botan::secure_vector<Botan::byte>& getPublicKeyBlob()
     {
         return _publicKeyBlob;
@@ -0,0 +1,102 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "keystream.h"
+#include "botan/mem_ops.h"
+#include <algorithm>
+
+CppsshKeystream::CppsshKeystream(std::unique_ptr<Botan::StreamCipher> cipher, size_t bufferSize, bool refillWhenIdle)
+    : _cipher(std::move(cipher)),
+    _buffer(std::min<size_t>(bufferSize, CPPSSH_KEYSTREAM_MAX_BUFFER)),
+    _readPos(0),
+    _available(0),
+    _refillWhenIdle(refillWhenIdle),
+    _running(true),
+    _lastUse(std::chrono::steady_clock::now())
+{
+    _fillThread = std::thread(&CppsshKeystream::fillThread, this);
+}
+
+CppsshKeystream::~CppsshKeystream()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_all();
+    if (_fillThread.joinable() == true)
+    {
+        _fillThread.join();
+    }
+}
+
+void CppsshKeystream::process(Botan::byte* data, size_t len)
+{
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_mutex);
+        _lastUse = std::chrono::steady_clock::now();
+        while ((len > 0) && (_available > 0))
+        {
+            size_t n = std::min(std::min(len, _available), _buffer.size() - _readPos);
+            Botan::xor_buf(data, _buffer.data() + _readPos, n);
+            _readPos = (_readPos + n) % _buffer.size();
+            _available -= n;
+            data += n;
+            len -= n;
+        }
+        if (len > 0)
+        {
+            // The buffer is empty, so the cipher is positioned exactly where the data needs it
+            _cipher->cipher1(data, len);
+        }
+    }
+    _cond.notify_one();
+}
+
+// Called with _mutex held. The chunks are kept small so a packet never waits
+// long behind the helper thread.
+void CppsshKeystream::fill(size_t len)
+{
+    size_t writePos = (_readPos + _available) % _buffer.size();
+    len = std::min(len, _buffer.size() - writePos);
+    std::fill(_buffer.begin() + writePos, _buffer.begin() + writePos + len, 0);
+    _cipher->cipher1(_buffer.data() + writePos, len);
+    _available += len;
+}
+
+void CppsshKeystream::fillThread()
+{
+    const size_t chunk = std::min<size_t>(CPPSSH_KEYSTREAM_CHUNK, _buffer.size());
+    std::unique_lock<std::mutex> lock(_mutex);
+    while ((_running == true) && (chunk > 0))
+    {
+        bool idle = ((std::chrono::steady_clock::now() - _lastUse) >= std::chrono::milliseconds(CPPSSH_KEYSTREAM_IDLE_MS));
+        if (((_buffer.size() - _available) >= chunk) && ((_refillWhenIdle == false) || (idle == true)))
+        {
+            fill(chunk);
+            // Give a waiting packet the chance to take the mutex between chunks
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+        else
+        {
+            _cond.wait_for(lock, std::chrono::milliseconds(CPPSSH_KEYSTREAM_IDLE_MS));
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _KEYSTREAM_Hxx
+#define _KEYSTREAM_Hxx
+
+#include "ctrprocessor.h"
+#include "botan/stream_cipher.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#define CPPSSH_KEYSTREAM_MAX_BUFFER (16 * 1024 * 1024)
+#define CPPSSH_KEYSTREAM_CHUNK      4096
+#define CPPSSH_KEYSTREAM_IDLE_MS    5
+
+// Generates CTR keystream ahead of use on a helper thread, so encrypting or
+// decrypting a packet is an XOR against bytes that are already waiting in a
+// ring buffer. When the buffer runs dry the remainder is produced inline by
+// the same cipher, so the keystream is identical either way.
+class CppsshKeystream : public CppsshCtrProcessor
+{
+public:
+    // The cipher must already be keyed and positioned at the start of the keystream.
+    // With refillWhenIdle the helper only runs once no data has been processed
+    // for CPPSSH_KEYSTREAM_IDLE_MS, otherwise it refills as soon as there is room.
+    CppsshKeystream(std::unique_ptr<Botan::StreamCipher> cipher, size_t bufferSize, bool refillWhenIdle);
+    CppsshKeystream() = delete;
+    CppsshKeystream(const CppsshKeystream&) = delete;
+    virtual ~CppsshKeystream();
+
+    void process(Botan::byte* data, size_t len) override;
+
+private:
+    void fillThread();
+    void fill(size_t len);
+
+    std::unique_ptr<Botan::StreamCipher> _cipher;
+    Botan::secure_vector<Botan::byte> _buffer;
+    size_t _readPos;
+    size_t _available;
+    const bool _refillWhenIdle;
+    bool _running;
+    std::chrono::steady_clock::time_point _lastUse;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _fillThread;
+};
+
+#endif
@@ -31,6 +31,7 @@
 #define SSH2_MSG_DEBUG                                  4
 #define SSH2_MSG_SERVICE_REQUEST                        5
 #define SSH2_MSG_SERVICE_ACCEPT                         6
+#define SSH2_MSG_EXT_INFO                               7
 
 #define SSH2_MSG_USERAUTH_REQUEST                       50
 #define SSH2_MSG_USERAUTH_FAILURE                       51
@@ -54,6 +55,8 @@
 #define SSH2_MSG_CHANNEL_SUCCESS                        99
 #define SSH2_MSG_CHANNEL_FAILURE                        100
 
+#define SSH2_EXTENDED_DATA_STDERR                       1
+
 enum CppsshOpenFailureReason
 {
     SSH2_OPEN_ADMINISTRATIVELY_PROHIBITED               = 1,
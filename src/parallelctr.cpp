@@ -0,0 +1,132 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "parallelctr.h"
+#include "botan/ctr.h"
+#include <algorithm>
+
+CppsshParallelCtr::CppsshParallelCtr(const Botan::BlockCipher& blockCipher, const Botan::SymmetricKey& key,
+                                     const Botan::secure_vector<Botan::byte>& iv, unsigned int threads, size_t minChunk)
+    : _ctr(newCtr(blockCipher, key, iv)),
+    _minChunk(std::max<size_t>(minChunk, 64)),
+    _offset(0),
+    _generation(0),
+    _pending(0),
+    _running(true)
+{
+    threads = std::min<unsigned int>(threads, CPPSSH_PARALLEL_CTR_MAX_THREADS);
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->_ctr = newCtr(blockCipher, key, iv);
+        worker->_data = nullptr;
+        worker->_len = 0;
+        worker->_offset = 0;
+        _workers.push_back(std::move(worker));
+    }
+    for (std::unique_ptr<Worker>& worker : _workers)
+    {
+        worker->_thread = std::thread(&CppsshParallelCtr::workerThread, this, worker.get());
+    }
+}
+
+CppsshParallelCtr::~CppsshParallelCtr()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _startCond.notify_all();
+    for (std::unique_ptr<Worker>& worker : _workers)
+    {
+        if (worker->_thread.joinable() == true)
+        {
+            worker->_thread.join();
+        }
+    }
+}
+
+std::unique_ptr<Botan::StreamCipher> CppsshParallelCtr::newCtr(const Botan::BlockCipher& blockCipher,
+                                                               const Botan::SymmetricKey& key,
+                                                               const Botan::secure_vector<Botan::byte>& iv) const
+{
+    std::unique_ptr<Botan::StreamCipher> ctr(new Botan::CTR_BE(blockCipher.clone()));
+    ctr->set_key(key);
+    ctr->set_iv(iv.data(), iv.size());
+    return ctr;
+}
+
+void CppsshParallelCtr::process(Botan::byte* data, size_t len)
+{
+    size_t parts = std::min<size_t>(_workers.size() + 1, len / _minChunk);
+    if (parts <= 1)
+    {
+        _ctr->cipher1(data, len);
+    }
+    else
+    {
+        // Keep the ranges on 64 byte boundaries so every worker starts on a whole block
+        const size_t partLen = ((len / parts) + 63) & ~((size_t)63);
+        {// new scope for mutex
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (size_t i = 1; i < parts; i++)
+            {
+                Worker* worker = _workers[i - 1].get();
+                size_t start = std::min(i * partLen, len);
+                worker->_data = data + start;
+                worker->_len = std::min(partLen, len - start);
+                worker->_offset = _offset + start;
+                if (worker->_len > 0)
+                {
+                    _pending++;
+                }
+            }
+            _generation++;
+        }
+        _startCond.notify_all();
+        _ctr->cipher1(data, std::min(partLen, len));
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCond.wait(lock, [this] { return (_pending == 0); });
+        _ctr->seek(_offset + len);
+    }
+    _offset += len;
+}
+
+void CppsshParallelCtr::workerThread(Worker* worker)
+{
+    unsigned int generation = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running == true)
+    {
+        _startCond.wait(lock, [this, generation] { return ((_running == false) || (_generation != generation)); });
+        generation = _generation;
+        if ((_running == true) && (worker->_len > 0))
+        {
+            lock.unlock();
+            worker->_ctr->seek(worker->_offset);
+            worker->_ctr->cipher1(worker->_data, worker->_len);
+            lock.lock();
+            worker->_len = 0;
+            if (--_pending == 0)
+            {
+                _doneCond.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PARALLEL_CTR_Hxx
+#define _PARALLEL_CTR_Hxx
+
+#include "ctrprocessor.h"
+#include "botan/block_cipher.h"
+#include "botan/symkey.h"
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define CPPSSH_PARALLEL_CTR_MAX_THREADS 16
+
+// Splits large packets into counter ranges and encrypts them on a small pool
+// of worker threads. Every worker has its own keyed CTR_BE instance and seeks
+// to its range, so the output is the same as a single sequential CTR stream.
+// The calling thread takes the first range itself and waits for the rest.
+class CppsshParallelCtr : public CppsshCtrProcessor
+{
+public:
+    // threads counts the calling thread, ranges are never shorter than minChunk bytes
+    CppsshParallelCtr(const Botan::BlockCipher& blockCipher, const Botan::SymmetricKey& key,
+                      const Botan::secure_vector<Botan::byte>& iv, unsigned int threads, size_t minChunk);
+    CppsshParallelCtr() = delete;
+    CppsshParallelCtr(const CppsshParallelCtr&) = delete;
+    virtual ~CppsshParallelCtr();
+
+    void process(Botan::byte* data, size_t len) override;
+
+private:
+    class Worker
+    {
+    public:
+        std::unique_ptr<Botan::StreamCipher> _ctr;
+        std::thread _thread;
+        Botan::byte* _data;
+        size_t _len;
+        uint64_t _offset;
+    };
+
+    std::unique_ptr<Botan::StreamCipher> newCtr(const Botan::BlockCipher& blockCipher, const Botan::SymmetricKey& key,
+                                                const Botan::secure_vector<Botan::byte>& iv) const;
+    void workerThread(Worker* worker);
+
+    std::unique_ptr<Botan::StreamCipher> _ctr;
+    std::vector<std::unique_ptr<Worker> > _workers;
+    const size_t _minChunk;
+    uint64_t _offset;
+    unsigned int _generation;
+    size_t _pending;
+    bool _running;
+    std::mutex _mutex;
+    std::condition_variable _startCond;
+    std::condition_variable _doneCond;
+};
+
+#endif
@@ -0,0 +1,240 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "scp.h"
+#include "CDLogger/Logger.h"
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+CppsshScp::CppsshScp(const std::shared_ptr<CppsshConnection>& connection, uint32_t channel)
+    : _connection(connection),
+    _channel(channel),
+    _messageOffset(0)
+{
+}
+
+bool CppsshScp::send(const std::string& localPath, uint32_t mode, uint64_t* bytes)
+{
+    bool ret = false;
+    struct stat st;
+    *bytes = 0;
+    int fd = ::open(localPath.c_str(), O_RDONLY | O_BINARY);
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        cdLog(LogLevel::Error) << "Unable to open " << localPath;
+    }
+    else if (waitAck() == true)
+    {
+        char header[64];
+        const uint64_t size = st.st_size;
+        const uint32_t maxWrite = _connection->getMaxWrite(_channel);
+        std::string name(localPath.substr(localPath.find_last_of("/\\") + 1));
+        snprintf(header, sizeof(header), "C%04o %llu ", mode & 07777, (unsigned long long)size);
+        ret = ((writeString(header + name + "\n") == true) && (waitAck() == true) && (maxWrite > 0));
+        while ((ret == true) && (*bytes < size))
+        {
+            std::shared_ptr<Botan::secure_vector<Botan::byte> > block(
+                new Botan::secure_vector<Botan::byte>((size_t)std::min((uint64_t)maxWrite, size - *bytes)));
+            int len = ::read(fd, (char*)block->data(), (unsigned int)block->size());
+            if (len <= 0)
+            {
+                cdLog(LogLevel::Error) << "Unable to read " << localPath;
+                ret = false;
+            }
+            else
+            {
+                block->resize(len);
+                ret = ((waitWritable() == true) && (_connection->write(_channel, block) == true));
+                *bytes += len;
+            }
+        }
+        ret = ((ret == true) && (writeString(std::string(1, '\0')) == true) && (waitAck() == true));
+        _connection->sendEof(_channel);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    return ret;
+}
+
+bool CppsshScp::receive(const std::string& localPath, uint64_t* bytes)
+{
+    bool ret = false;
+    std::string line;
+    *bytes = 0;
+    if (writeString(std::string(1, '\0')) == true)
+    {
+        ret = readLine(&line);
+        // Times come first when the source runs with -p
+        while ((ret == true) && (line.size() > 0) && (line[0] == 'T'))
+        {
+            ret = ((writeString(std::string(1, '\0')) == true) && (readLine(&line) == true));
+        }
+    }
+    if (ret == true)
+    {
+        unsigned int mode = 0;
+        unsigned long long size = 0;
+        int fd = -1;
+        if ((line.size() == 0) || (line[0] != 'C') || (sscanf(line.c_str() + 1, "%o %llu", &mode, &size) != 2))
+        {
+            cdLog(LogLevel::Error) << "scp: " << ((line.size() > 1) ? line.substr(1) : line);
+            ret = false;
+        }
+        else if ((fd = ::open(localPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, mode & 0777)) < 0)
+        {
+            cdLog(LogLevel::Error) << "Unable to create " << localPath;
+            ret = false;
+        }
+        else
+        {
+            ret = writeString(std::string(1, '\0'));
+            while ((ret == true) && (*bytes < size))
+            {
+                ret = fill();
+                if (ret == true)
+                {
+                    size_t len = (size_t)std::min((uint64_t)(_message->length() - _messageOffset), (uint64_t)size - *bytes);
+                    int written = ::write(fd, (const char*)_message->message() + _messageOffset, (unsigned int)len);
+                    if (written != (int)len)
+                    {
+                        cdLog(LogLevel::Error) << "Unable to write " << localPath;
+                        ret = false;
+                    }
+                    _messageOffset += len;
+                    *bytes += len;
+                }
+            }
+            ret = ((ret == true) && (waitAck() == true) && (writeString(std::string(1, '\0')) == true));
+            ::close(fd);
+        }
+    }
+    return ret;
+}
+
+std::string CppsshScp::quote(const std::string& path)
+{
+    std::string ret("'");
+    for (char ch : path)
+    {
+        if (ch == '\'')
+        {
+            ret.append("'\\''");
+        }
+        else
+        {
+            ret.push_back(ch);
+        }
+    }
+    ret.push_back('\'');
+    return ret;
+}
+
+// Makes sure unread data is left in _message, the timeout only runs while nothing arrives
+bool CppsshScp::fill()
+{
+    bool ret = ((_message != nullptr) && (_messageOffset < _message->length()));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::chrono::milliseconds timeout(_connection->getTimeout());
+    while (ret == false)
+    {
+        if (_connection->read(_channel, &_message) == true)
+        {
+            _messageOffset = 0;
+            ret = (_message->length() > 0);
+        }
+        else if ((_connection->isConnected(_channel) == false) ||
+                 ((std::chrono::steady_clock::now() - start) > timeout))
+        {
+            cdLog(LogLevel::Error) << "Timeout waiting for scp.";
+            break;
+        }
+    }
+    return ret;
+}
+
+bool CppsshScp::readByte(char* ch)
+{
+    bool ret = fill();
+    if (ret == true)
+    {
+        *ch = (char)_message->message()[_messageOffset];
+        _messageOffset++;
+    }
+    return ret;
+}
+
+bool CppsshScp::readLine(std::string* line)
+{
+    bool ret = true;
+    char ch = 0;
+    line->clear();
+    while ((ret == true) && ((ret = readByte(&ch)) == true) && (ch != '\n'))
+    {
+        line->push_back(ch);
+    }
+    return ret;
+}
+
+// 0 is success, 1 a warning and 2 an error, both followed by a message line
+bool CppsshScp::waitAck()
+{
+    bool ret = false;
+    char ch;
+    if (readByte(&ch) == true)
+    {
+        ret = (ch == 0);
+        if (ret == false)
+        {
+            std::string message;
+            readLine(&message);
+            cdLog(LogLevel::Error) << "scp: " << message;
+        }
+    }
+    return ret;
+}
+
+bool CppsshScp::writeString(const std::string& str)
+{
+    return _connection->write(_channel, (const uint8_t*)str.data(), (uint32_t)str.size());
+}
+
+bool CppsshScp::waitWritable()
+{
+    bool ret = true;
+    while ((ret == true) && (_connection->getQueuedWrites(_channel) >= CPPSSH_SCP_MAX_QUEUED))
+    {
+        ret = _connection->isConnected(_channel);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return ret;
+}
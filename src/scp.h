@@ -0,0 +1,60 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _SCP_Hxx
+#define _SCP_Hxx
+
+#include "connection.h"
+#include <memory>
+#include <string>
+
+// Buffers queued on the channel before the source waits for the tx thread
+#define CPPSSH_SCP_MAX_QUEUED 32
+
+// The source (scp -t on the remote end) and sink (scp -f) sides of the rcp
+// protocol over an exec channel, one regular file at a time. File blocks are
+// read from the descriptor straight into the buffers queued on the channel,
+// and received messages are written from where they were decrypted to.
+class CppsshScp
+{
+public:
+    CppsshScp(const std::shared_ptr<CppsshConnection>& connection, uint32_t channel);
+    CppsshScp(const CppsshScp&) = delete;
+
+    // The file goes out under the name of localPath, scp -t <remote path> decides
+    // whether that is the target itself or a file in the target directory
+    bool send(const std::string& localPath, uint32_t mode, uint64_t* bytes);
+    bool receive(const std::string& localPath, uint64_t* bytes);
+    // For use in the scp command line
+    static std::string quote(const std::string& path);
+
+private:
+    bool fill();
+    bool readByte(char* ch);
+    bool readLine(std::string* line);
+    bool waitAck();
+    bool writeString(const std::string& str);
+    bool waitWritable();
+
+    std::shared_ptr<CppsshConnection> _connection;
+    uint32_t _channel;
+    std::shared_ptr<CppsshMessage> _message;
+    size_t _messageOffset;
+};
+
+#endif
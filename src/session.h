@@ -72,6 +72,17 @@ public:
         return _sessionID;
     }
 
+    // From the server's SSH2_MSG_EXT_INFO, empty if it did not send one
+    void setServerSigAlgs(const std::string& sigAlgs)
+    {
+        _serverSigAlgs = sigAlgs;
+    }
+
+    const std::string& getServerSigAlgs() const
+    {
+        return _serverSigAlgs;
+    }
+
     unsigned int getTimeout() const
     {
         return _timeout;
@@ -89,6 +100,7 @@ private:
     std::string _remoteVer;
     std::string _localVer;
     Botan::secure_vector<Botan::byte> _sessionID;
+    std::string _serverSigAlgs;
     unsigned int _timeout;
     const int _connectionId;
     CppsshSession& operator=(const CppsshSession&) = delete;
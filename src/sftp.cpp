@@ -0,0 +1,620 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sftp.h"
+#include "packet.h"
+#include "CDLogger/Logger.h"
+#include <fstream>
+#include <map>
+#include <set>
+#include <deque>
+#include <chrono>
+
+CppsshSftp::CppsshSftp(const std::shared_ptr<CppsshConnection>& connection, uint32_t channel, size_t maxRequests,
+                       uint32_t requestSize)
+    : _connection(connection),
+    _channel(channel),
+    _maxRequests(maxRequests),
+    _requestSize(requestSize),
+    _nextId(0)
+{
+}
+
+bool CppsshSftp::init()
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    packet.addInt(1 + sizeof(uint32_t));
+    packet.addByte(SSH_FXP_INIT);
+    packet.addInt(CPPSSH_SFTP_VERSION);
+    if (_connection->write(_channel, buf.data(), buf.size()) == true)
+    {
+        Botan::secure_vector<Botan::byte> reply;
+        Botan::byte type;
+        uint32_t version;
+        if ((receive(&reply, &type, &version) == true) && (type == SSH_FXP_VERSION))
+        {
+            cdLog(LogLevel::Debug) << "SFTP server version " << version;
+            ret = (version >= CPPSSH_SFTP_VERSION);
+        }
+        if (ret == false)
+        {
+            cdLog(LogLevel::Error) << "No SFTP version 3 server.";
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::get(const std::string& remotePath, const std::string& localPath)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t bytes;
+    std::ofstream out(localPath, std::ios::binary | std::ios::trunc);
+    if (out.is_open() == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to open " << localPath;
+    }
+    else
+    {
+        ret = download(remotePath, &out, 0, CPPSSH_SFTP_TO_EOF, &bytes);
+    }
+    return ret;
+}
+
+bool CppsshSftp::put(const std::string& localPath, const std::string& remotePath, uint32_t mode)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t bytes;
+    std::ifstream in(localPath, std::ios::binary);
+    if (in.is_open() == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to open " << localPath;
+    }
+    else
+    {
+        ret = upload(&in, remotePath, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, mode, 0, CPPSSH_SFTP_TO_EOF, &bytes);
+    }
+    return ret;
+}
+
+bool CppsshSftp::getRange(const std::string& remotePath, const std::string& localPath, uint64_t offset,
+                          uint64_t length, uint64_t* bytes)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::ofstream out(localPath, std::ios::binary | std::ios::in | std::ios::out);
+    if (out.is_open() == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to open " << localPath;
+    }
+    else
+    {
+        ret = download(remotePath, &out, offset, length, bytes);
+    }
+    return ret;
+}
+
+bool CppsshSftp::putRange(const std::string& localPath, const std::string& remotePath, uint64_t offset,
+                          uint64_t length, uint64_t* bytes)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::ifstream in(localPath, std::ios::binary);
+    if (in.is_open() == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to open " << localPath;
+    }
+    else
+    {
+        ret = upload(&in, remotePath, SSH_FXF_WRITE, 0, offset, length, bytes);
+    }
+    return ret;
+}
+
+bool CppsshSftp::create(const std::string& path, uint32_t mode)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> handle;
+    return ((openHandle(path, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, mode, &handle) == true) &&
+            (closeHandle(handle) == true));
+}
+
+// Reads past the end come back as EOF, short reads are asked for again from where they stopped
+bool CppsshSftp::download(const std::string& remotePath, std::ofstream* out, uint64_t offset, uint64_t length,
+                          uint64_t* bytes)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> handle;
+    const uint64_t end = (length == CPPSSH_SFTP_TO_EOF) ? CPPSSH_SFTP_TO_EOF : (offset + length);
+    *bytes = 0;
+    if (openHandle(remotePath, SSH_FXF_READ, 0, &handle) == true)
+    {
+        std::map<uint32_t, std::pair<uint64_t, uint32_t> > pending;
+        std::deque<std::pair<uint64_t, uint32_t> > retries;
+        uint64_t nextOffset = offset;
+        bool eof = (nextOffset >= end);
+        ret = true;
+        while ((ret == true) && ((pending.size() > 0) || (retries.size() > 0) || (eof == false)))
+        {
+            while ((ret == true) && (pending.size() < _maxRequests) && ((retries.size() > 0) || (eof == false)))
+            {
+                std::pair<uint64_t, uint32_t> range(nextOffset, (uint32_t)std::min((uint64_t)_requestSize, end - nextOffset));
+                if (retries.size() > 0)
+                {
+                    range = retries.front();
+                    retries.pop_front();
+                }
+                else
+                {
+                    nextOffset += range.second;
+                    // The end of the range is as good as the end of the file
+                    eof = (nextOffset >= end);
+                }
+                Botan::secure_vector<Botan::byte> payload;
+                CppsshPacket request(&payload);
+                uint32_t id;
+                request.addVectorField(handle);
+                addInt64(&request, range.first);
+                request.addInt(range.second);
+                ret = sendRequest(SSH_FXP_READ, payload, &id);
+                pending[id] = range;
+            }
+            if ((ret == true) && (pending.size() > 0))
+            {
+                Botan::secure_vector<Botan::byte> reply;
+                Botan::byte type;
+                uint32_t id;
+                ret = receive(&reply, &type, &id);
+                std::map<uint32_t, std::pair<uint64_t, uint32_t> >::iterator it = pending.find(id);
+                if ((ret == true) && (it != pending.end()))
+                {
+                    std::pair<uint64_t, uint32_t> range = it->second;
+                    pending.erase(it);
+                    if (type == SSH_FXP_DATA)
+                    {
+                        Botan::secure_vector<Botan::byte> data;
+                        CppsshConstPacket packet(&reply);
+                        packet.getInt();
+                        packet.getByte();
+                        packet.getInt();
+                        packet.getString(&data);
+                        if (data.size() > range.second)
+                        {
+                            data.resize(range.second);
+                        }
+                        if ((data.size() > 0) && (data.size() < range.second))
+                        {
+                            retries.push_back(std::pair<uint64_t, uint32_t>(range.first + data.size(),
+                                                                            range.second - (uint32_t)data.size()));
+                        }
+                        out->seekp(range.first);
+                        out->write((const char*)data.data(), data.size());
+                        *bytes += data.size();
+                        ret = out->good();
+                    }
+                    else
+                    {
+                        uint32_t code = SSH_FX_OK;
+                        if (checkStatus(reply, type, "read " + remotePath, &code) == false)
+                        {
+                            eof = (code == SSH_FX_EOF);
+                            ret = eof;
+                        }
+                    }
+                }
+            }
+        }
+        if ((closeHandle(handle) == false) || (ret == false))
+        {
+            ret = false;
+            cdLog(LogLevel::Error) << "Unable to get " << remotePath;
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::upload(std::ifstream* in, const std::string& remotePath, uint32_t pflags, uint32_t mode,
+                        uint64_t offset, uint64_t length, uint64_t* bytes)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> handle;
+    *bytes = 0;
+    in->seekg(offset);
+    if (openHandle(remotePath, pflags, mode, &handle) == true)
+    {
+        std::set<uint32_t> pending;
+        std::vector<char> chunk(_requestSize);
+        bool done = false;
+        ret = true;
+        while ((ret == true) && ((pending.size() > 0) || (done == false)))
+        {
+            while ((ret == true) && (done == false) && (pending.size() < _maxRequests))
+            {
+                uint32_t want = (uint32_t)std::min((uint64_t)chunk.size(), length - *bytes);
+                in->read(chunk.data(), want);
+                uint32_t len = (uint32_t)in->gcount();
+                done = ((len < chunk.size()) || ((*bytes + len) >= length));
+                if (len > 0)
+                {
+                    Botan::secure_vector<Botan::byte> payload;
+                    CppsshPacket request(&payload);
+                    uint32_t id;
+                    request.addVectorField(handle);
+                    addInt64(&request, offset + *bytes);
+                    request.addInt(len);
+                    request.addRawData((const uint8_t*)chunk.data(), len);
+                    ret = sendRequest(SSH_FXP_WRITE, payload, &id);
+                    pending.insert(id);
+                    *bytes += len;
+                }
+            }
+            if ((ret == true) && (pending.size() > 0))
+            {
+                Botan::secure_vector<Botan::byte> reply;
+                Botan::byte type;
+                uint32_t id;
+                ret = ((receive(&reply, &type, &id) == true) && (pending.erase(id) == 1) &&
+                       (checkStatus(reply, type, "write " + remotePath) == true));
+            }
+        }
+        if ((closeHandle(handle) == false) || (ret == false))
+        {
+            ret = false;
+            cdLog(LogLevel::Error) << "Unable to put " << remotePath;
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::mkdir(const std::string& path, uint32_t mode)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addString(path);
+    addAttrs(&request, mode);
+    return ((doRequest(SSH_FXP_MKDIR, payload, &reply, &type) == true) &&
+            (checkStatus(reply, type, "mkdir " + path) == true));
+}
+
+bool CppsshSftp::remove(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addString(path);
+    return ((doRequest(SSH_FXP_REMOVE, payload, &reply, &type) == true) &&
+            (checkStatus(reply, type, "remove " + path) == true));
+}
+
+bool CppsshSftp::getFileSize(const std::string& path, uint64_t* size)
+{
+    uint32_t permissions;
+    return stat(path, size, &permissions);
+}
+
+bool CppsshSftp::stat(const std::string& path, uint64_t* size, uint32_t* permissions)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addString(path);
+    if (doRequest(SSH_FXP_STAT, payload, &reply, &type) == true)
+    {
+        if (type == SSH_FXP_ATTRS)
+        {
+            CppsshConstPacket packet(&reply);
+            packet.getInt();
+            packet.getByte();
+            packet.getInt();
+            getAttrs(packet, size, permissions);
+            ret = true;
+        }
+        else
+        {
+            checkStatus(reply, type, "stat " + path);
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::readDir(const std::string& path, std::vector<std::pair<std::string, uint32_t> >* entries)
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    Botan::secure_vector<Botan::byte> handle;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addString(path);
+    if (doRequest(SSH_FXP_OPENDIR, payload, &reply, &type) == true)
+    {
+        CppsshConstPacket packet(&reply);
+        packet.getInt();
+        packet.getByte();
+        packet.getInt();
+        if ((type == SSH_FXP_HANDLE) && (packet.getString(&handle) == true))
+        {
+            bool more = true;
+            ret = true;
+            payload.clear();
+            request.addVectorField(handle);
+            while ((ret == true) && (more == true))
+            {
+                ret = doRequest(SSH_FXP_READDIR, payload, &reply, &type);
+                if ((ret == true) && (type == SSH_FXP_NAME))
+                {
+                    CppsshConstPacket names(&reply);
+                    names.getInt();
+                    names.getByte();
+                    names.getInt();
+                    uint32_t count = names.getInt();
+                    for (uint32_t i = 0; (i < count) && (ret == true); i++)
+                    {
+                        std::string name;
+                        std::string longName;
+                        uint64_t size = 0;
+                        uint32_t permissions = 0;
+                        ret = ((names.getString(&name) == true) && (names.getString(&longName) == true));
+                        getAttrs(names, &size, &permissions);
+                        if ((ret == true) && (name != ".") && (name != ".."))
+                        {
+                            entries->push_back(std::pair<std::string, uint32_t>(name, permissions));
+                        }
+                    }
+                }
+                else if (ret == true)
+                {
+                    uint32_t code = SSH_FX_OK;
+                    checkStatus(reply, type, "readdir " + path, &code);
+                    more = false;
+                    ret = (code == SSH_FX_EOF);
+                }
+            }
+            if (closeHandle(handle) == false)
+            {
+                ret = false;
+            }
+        }
+        else
+        {
+            checkStatus(reply, type, "opendir " + path);
+        }
+    }
+    return ret;
+}
+
+// Skips everything but the size and permissions, which are 0 when not sent
+bool CppsshSftp::getAttrs(const CppsshConstPacket& packet, uint64_t* size, uint32_t* permissions)
+{
+    uint32_t flags = packet.getInt();
+    *size = 0;
+    *permissions = 0;
+    if ((flags & SSH_FILEXFER_ATTR_SIZE) != 0)
+    {
+        uint64_t high = packet.getInt();
+        *size = (high << 32) | packet.getInt();
+    }
+    if ((flags & SSH_FILEXFER_ATTR_UIDGID) != 0)
+    {
+        packet.getInt();
+        packet.getInt();
+    }
+    if ((flags & SSH_FILEXFER_ATTR_PERMISSIONS) != 0)
+    {
+        *permissions = packet.getInt();
+    }
+    if ((flags & SSH_FILEXFER_ATTR_ACMODTIME) != 0)
+    {
+        packet.getInt();
+        packet.getInt();
+    }
+    if ((flags & SSH_FILEXFER_ATTR_EXTENDED) != 0)
+    {
+        uint32_t count = packet.getInt();
+        for (uint32_t i = 0; i < (count * 2); i++)
+        {
+            std::string unused;
+            packet.getString(&unused);
+        }
+    }
+    return ((flags & SSH_FILEXFER_ATTR_SIZE) != 0);
+}
+
+bool CppsshSftp::sendRequest(Botan::byte type, const Botan::secure_vector<Botan::byte>& payload, uint32_t* id)
+{
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+    *id = _nextId++;
+    packet.addInt(1 + sizeof(uint32_t) + payload.size());
+    packet.addByte(type);
+    packet.addInt(*id);
+    packet.addVector(payload);
+    return _connection->write(_channel, buf.data(), buf.size());
+}
+
+// The timeout only runs while nothing arrives, a long transfer is fine
+bool CppsshSftp::receive(Botan::secure_vector<Botan::byte>* reply, Botan::byte* type, uint32_t* id)
+{
+    bool ret = false;
+    std::chrono::steady_clock::time_point lastData = std::chrono::steady_clock::now();
+    const std::chrono::milliseconds timeout(_connection->getTimeout());
+    while (ret == false)
+    {
+        if (_in.size() >= sizeof(uint32_t))
+        {
+            CppsshConstPacket packet(&_in);
+            uint32_t len = packet.getInt();
+            if ((len < (1 + sizeof(uint32_t))) || (len > (CPPSSH_SFTP_MAX_REQUEST_SIZE + 1024)))
+            {
+                cdLog(LogLevel::Error) << "Invalid SFTP packet length " << len;
+                break;
+            }
+            if (_in.size() >= (sizeof(uint32_t) + len))
+            {
+                CppsshConstPacket replyPacket(reply);
+                reply->assign(_in.begin(), _in.begin() + sizeof(uint32_t) + len);
+                _in.erase(_in.begin(), _in.begin() + sizeof(uint32_t) + len);
+                replyPacket.getInt();
+                *type = replyPacket.getByte();
+                *id = replyPacket.getInt();
+                ret = true;
+                break;
+            }
+        }
+        CppsshMessage message;
+        if (_connection->read(_channel, &message) == true)
+        {
+            _in.insert(_in.end(), message.message(), message.message() + message.length());
+            lastData = std::chrono::steady_clock::now();
+        }
+        else if ((_connection->isConnected(_channel) == false) ||
+                 ((std::chrono::steady_clock::now() - lastData) > timeout))
+        {
+            cdLog(LogLevel::Error) << "Timeout waiting for an SFTP reply.";
+            break;
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::waitReply(uint32_t id, Botan::secure_vector<Botan::byte>* reply, Botan::byte* type)
+{
+    bool ret = false;
+    uint32_t replyId;
+    while (receive(reply, type, &replyId) == true)
+    {
+        if (replyId == id)
+        {
+            ret = true;
+            break;
+        }
+        cdLog(LogLevel::Debug) << "Dropping SFTP reply " << replyId;
+    }
+    return ret;
+}
+
+bool CppsshSftp::doRequest(Botan::byte type, const Botan::secure_vector<Botan::byte>& payload,
+                           Botan::secure_vector<Botan::byte>* reply, Botan::byte* replyType)
+{
+    uint32_t id;
+    return ((sendRequest(type, payload, &id) == true) && (waitReply(id, reply, replyType) == true));
+}
+
+bool CppsshSftp::checkStatus(const Botan::secure_vector<Botan::byte>& reply, Botan::byte type, const std::string& what,
+                             uint32_t* code)
+{
+    bool ret = false;
+    if (type == SSH_FXP_STATUS)
+    {
+        std::string message;
+        CppsshConstPacket packet(&reply);
+        packet.getInt();
+        packet.getByte();
+        packet.getInt();
+        uint32_t status = packet.getInt();
+        if (code != nullptr)
+        {
+            *code = status;
+        }
+        ret = (status == SSH_FX_OK);
+        if ((ret == false) && (status != SSH_FX_EOF))
+        {
+            packet.getString(&message);
+            cdLog(LogLevel::Error) << "SFTP " << what << " failed (" << status << "): " << message;
+        }
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Unexpected SFTP reply " << (int)type << " to " << what;
+    }
+    return ret;
+}
+
+bool CppsshSftp::openHandle(const std::string& path, uint32_t pflags, uint32_t mode,
+                            Botan::secure_vector<Botan::byte>* handle)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addString(path);
+    request.addInt(pflags);
+    addAttrs(&request, mode);
+    if (doRequest(SSH_FXP_OPEN, payload, &reply, &type) == true)
+    {
+        if (type == SSH_FXP_HANDLE)
+        {
+            CppsshConstPacket packet(&reply);
+            packet.getInt();
+            packet.getByte();
+            packet.getInt();
+            ret = packet.getString(handle);
+        }
+        else
+        {
+            checkStatus(reply, type, "open " + path);
+        }
+    }
+    return ret;
+}
+
+bool CppsshSftp::closeHandle(const Botan::secure_vector<Botan::byte>& handle)
+{
+    Botan::secure_vector<Botan::byte> payload;
+    Botan::secure_vector<Botan::byte> reply;
+    CppsshPacket request(&payload);
+    Botan::byte type;
+    request.addVectorField(handle);
+    return ((doRequest(SSH_FXP_CLOSE, payload, &reply, &type) == true) &&
+            (checkStatus(reply, type, "close") == true));
+}
+
+void CppsshSftp::addInt64(CppsshPacket* packet, uint64_t value)
+{
+    packet->addInt((uint32_t)(value >> 32));
+    packet->addInt((uint32_t)value);
+}
+
+// Only the permissions are ever set, a mode of 0 leaves them to the server
+void CppsshSftp::addAttrs(CppsshPacket* packet, uint32_t mode)
+{
+    if (mode == 0)
+    {
+        packet->addInt(0);
+    }
+    else
+    {
+        packet->addInt(SSH_FILEXFER_ATTR_PERMISSIONS);
+        packet->addInt(mode);
+    }
+}
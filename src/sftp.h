@@ -0,0 +1,123 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _SFTP_Hxx
+#define _SFTP_Hxx
+
+#include "connection.h"
+#include "botan/secmem.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#define CPPSSH_SFTP_VERSION             3
+#define CPPSSH_SFTP_MAX_REQUESTS        1024
+// What OpenSSH's sftp-server accepts in one READ or WRITE
+#define CPPSSH_SFTP_MAX_REQUEST_SIZE    (255 * 1024)
+
+#define SSH_FXP_INIT                    1
+#define SSH_FXP_VERSION                 2
+#define SSH_FXP_OPEN                    3
+#define SSH_FXP_CLOSE                   4
+#define SSH_FXP_READ                    5
+#define SSH_FXP_WRITE                   6
+#define SSH_FXP_OPENDIR                 11
+#define SSH_FXP_READDIR                 12
+#define SSH_FXP_REMOVE                  13
+#define SSH_FXP_MKDIR                   14
+#define SSH_FXP_STAT                    17
+#define SSH_FXP_STATUS                  101
+#define SSH_FXP_HANDLE                  102
+#define SSH_FXP_DATA                    103
+#define SSH_FXP_NAME                    104
+#define SSH_FXP_ATTRS                   105
+
+#define SSH_FXF_READ                    0x00000001
+#define SSH_FXF_WRITE                   0x00000002
+#define SSH_FXF_CREAT                   0x00000008
+#define SSH_FXF_TRUNC                   0x00000010
+
+#define SSH_FILEXFER_ATTR_SIZE          0x00000001
+#define SSH_FILEXFER_ATTR_UIDGID        0x00000002
+#define SSH_FILEXFER_ATTR_PERMISSIONS   0x00000004
+#define SSH_FILEXFER_ATTR_ACMODTIME     0x00000008
+#define SSH_FILEXFER_ATTR_EXTENDED      0x80000000
+
+#define CPPSSH_SFTP_TYPE_MASK           0170000
+#define CPPSSH_SFTP_TYPE_DIR            0040000
+#define CPPSSH_SFTP_TYPE_FILE           0100000
+#define CPPSSH_SFTP_TO_EOF              (~(uint64_t)0)
+
+#define SSH_FX_OK                       0
+#define SSH_FX_EOF                      1
+
+// SFTP version 3 (draft-ietf-secsh-filexfer-02) over a subsystem channel.
+// Transfers keep up to maxRequests READ or WRITE requests of requestSize
+// bytes in flight, so they aren't limited to one request per round trip.
+// One operation runs at a time.
+class CppsshSftp
+{
+public:
+    CppsshSftp(const std::shared_ptr<CppsshConnection>& connection, uint32_t channel, size_t maxRequests, uint32_t requestSize);
+    CppsshSftp(const CppsshSftp&) = delete;
+
+    bool init();
+    bool get(const std::string& remotePath, const std::string& localPath);
+    bool put(const std::string& localPath, const std::string& remotePath, uint32_t mode);
+    bool mkdir(const std::string& path, uint32_t mode);
+    bool remove(const std::string& path);
+    bool getFileSize(const std::string& path, uint64_t* size);
+
+    // Length bytes from offset, or up to the end with CPPSSH_SFTP_TO_EOF, into the same range of
+    // an existing local file. bytes is what was transferred.
+    bool getRange(const std::string& remotePath, const std::string& localPath, uint64_t offset, uint64_t length, uint64_t* bytes);
+    // The same range of the local file into an existing remote file
+    bool putRange(const std::string& localPath, const std::string& remotePath, uint64_t offset, uint64_t length, uint64_t* bytes);
+    // Create or truncate a remote file
+    bool create(const std::string& path, uint32_t mode);
+    bool stat(const std::string& path, uint64_t* size, uint32_t* permissions);
+    // Names in the directory with their permissions (which hold the file type), without . and ..
+    bool readDir(const std::string& path, std::vector<std::pair<std::string, uint32_t> >* entries);
+
+private:
+    bool download(const std::string& remotePath, std::ofstream* out, uint64_t offset, uint64_t length, uint64_t* bytes);
+    bool upload(std::ifstream* in, const std::string& remotePath, uint32_t pflags, uint32_t mode, uint64_t offset, uint64_t length, uint64_t* bytes);
+    static bool getAttrs(const CppsshConstPacket& packet, uint64_t* size, uint32_t* permissions);
+    bool sendRequest(Botan::byte type, const Botan::secure_vector<Botan::byte>& payload, uint32_t* id);
+    // The next whole packet, [length][type][id]... replies can come in any order
+    bool receive(Botan::secure_vector<Botan::byte>* reply, Botan::byte* type, uint32_t* id);
+    bool waitReply(uint32_t id, Botan::secure_vector<Botan::byte>* reply, Botan::byte* type);
+    bool doRequest(Botan::byte type, const Botan::secure_vector<Botan::byte>& payload, Botan::secure_vector<Botan::byte>* reply, Botan::byte* replyType);
+    bool checkStatus(const Botan::secure_vector<Botan::byte>& reply, Botan::byte type, const std::string& what, uint32_t* code = nullptr);
+    bool openHandle(const std::string& path, uint32_t pflags, uint32_t mode, Botan::secure_vector<Botan::byte>* handle);
+    bool closeHandle(const Botan::secure_vector<Botan::byte>& handle);
+    static void addInt64(CppsshPacket* packet, uint64_t value);
+    static void addAttrs(CppsshPacket* packet, uint32_t mode);
+
+    std::shared_ptr<CppsshConnection> _connection;
+    uint32_t _channel;
+    size_t _maxRequests;
+    uint32_t _requestSize;
+    uint32_t _nextId;
+    Botan::secure_vector<Botan::byte> _in;
+    std::mutex _mutex;
+};
+
+#endif
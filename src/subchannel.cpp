@@ -22,32 +22,57 @@
 #include "messages.h"
 
 #define CPPSSH_RX_WINDOW_SIZE (CPPSSH_MAX_PACKET_LEN * 150)
+// Packets one channel may send per flush, so a bulk transfer doesn't hold up the other channels
+#define CPPSSH_FLUSH_PACKETS 16
 
 CppsshSubChannel::CppsshSubChannel(const std::shared_ptr<CppsshSession>& session, const std::string& channelName)
     : _session(session),
     _windowRecv(CPPSSH_RX_WINDOW_SIZE),
+    _unread(0),
+    _windowOnRead(false),
     _windowSend(0),
     _txChannel(0),
     _maxPacket(0),
-    _channelName(channelName)
+    _channelName(channelName),
+    _closeSent(false),
+    _remoteClosed(false),
+    _remoteEof(false),
+    _exitStatusReceived(false),
+    _exitStatus(-1),
+    _pendingOffset(0)
 {
 }
 
+// Called from both the rx thread and the reader, the mutex keeps them from giving the same bytes back twice
 void CppsshSubChannel::sendAdjustWindow()
 {
-    uint32_t len = CPPSSH_RX_WINDOW_SIZE - _windowRecv;
-    Botan::secure_vector<Botan::byte> buf;
-    CppsshPacket packet(&buf);
-    packet.addByte(SSH2_MSG_CHANNEL_WINDOW_ADJUST);
-    packet.addInt(_txChannel);
-    packet.addInt(len);
-    _windowRecv += len;
-    _session->_transport->sendMessage(buf);
+    std::unique_lock<std::mutex> lock(_windowMutex);
+    if ((_windowRecv + _unread) < (CPPSSH_RX_WINDOW_SIZE / 2))
+    {
+        uint32_t len = CPPSSH_RX_WINDOW_SIZE - _windowRecv - _unread;
+        Botan::secure_vector<Botan::byte> buf;
+        CppsshPacket packet(&buf);
+        packet.addByte(SSH2_MSG_CHANNEL_WINDOW_ADJUST);
+        packet.addInt(_txChannel);
+        packet.addInt(len);
+        _windowRecv += len;
+        _session->_transport->sendMessage(buf);
+    }
 }
 
 void CppsshSubChannel::handleEof()
 {
     cdLog(LogLevel::Debug) << "handleeof " << _channelName << " txChannel: " << _txChannel;
+    _remoteEof = true;
+    // A forwarded channel can still have data to send, it sends its own EOF when the socket is done
+    if (_windowOnRead == false)
+    {
+        sendEof();
+    }
+}
+
+void CppsshSubChannel::sendEof()
+{
     Botan::secure_vector<Botan::byte> buf;
     CppsshPacket packet(&buf);
     packet.addByte(SSH2_MSG_CHANNEL_EOF);
@@ -58,10 +83,21 @@ void CppsshSubChannel::handleEof()
 void CppsshSubChannel::handleClose()
 {
     cdLog(LogLevel::Debug) << "handleclose " << _channelName << " txChannel: " << _txChannel;
+    _remoteClosed = true;
+    // Only answered when the server closed first
+    if (_closeSent == false)
+    {
+        sendClose();
+    }
+}
+
+void CppsshSubChannel::sendClose()
+{
     Botan::secure_vector<Botan::byte> buf;
     CppsshPacket packet(&buf);
     packet.addByte(SSH2_MSG_CHANNEL_CLOSE);
     packet.addInt(_txChannel);
+    _closeSent = true;
     _session->_transport->sendMessage(buf);
 }
 
@@ -77,12 +113,20 @@ void CppsshSubChannel::handleChannelRequest(const Botan::secure_vector<Botan::by
     Botan::byte wantReply = packet.getByte();
     if (request == "exit-status")
     {
+        _exitStatus = (int)packet.getInt();
+        _exitStatusReceived = true;
+        cdLog(LogLevel::Debug) << "exit-status " << _exitStatus << " txChannel: " << _txChannel;
         response = SSH2_MSG_CHANNEL_SUCCESS;
     }
+    else if (request == "exit-signal")
+    {
+        std::string signal;
+        packet.getString(&signal);
+        cdLog(LogLevel::Info) << "Remote command killed by signal " << signal;
+    }
     else if ((request == "pty-req") || (request == "x11-req") || (request == "env") ||
              (request == "shell") || (request == "exec") || (request == "subsystem") ||
-             (request == "window-change") || (request == "xon-xoff") || (request == "signal") ||
-             (request == "exit-status") || (request == "exit-signal"))
+             (request == "window-change") || (request == "xon-xoff") || (request == "signal"))
     {
         cdLog(LogLevel::Error) << "Unhandled channel request: " << request;
     }
@@ -109,13 +153,36 @@ void CppsshSubChannel::handleIncomingChannelData(const Botan::secure_vector<Bota
     /*uint32_t rxChannel = */ packet.getInt();
     packet.getChannelData(message.get());
     _windowRecv -= message->length();
-    if (_windowRecv < (CPPSSH_RX_WINDOW_SIZE / 2))
+    if (_windowOnRead == true)
     {
-        sendAdjustWindow();
+        _unread += message->length();
     }
+    sendAdjustWindow();
     _incomingChannelData.enqueue(message);
 }
 
+// Only stderr (data type 1) is defined, anything else is dropped after the window is accounted for
+void CppsshSubChannel::handleIncomingExtendedData(const Botan::secure_vector<Botan::byte>& buf)
+{
+    CppsshConstPacket packet(&buf);
+    std::shared_ptr<CppsshMessage> message(new CppsshMessage());
+    packet.skipHeader();
+    // rx channel
+    packet.getInt();
+    uint32_t dataType = packet.getInt();
+    packet.getChannelData(message.get());
+    _windowRecv -= message->length();
+    if ((_windowOnRead == true) && (dataType == SSH2_EXTENDED_DATA_STDERR))
+    {
+        _unread += message->length();
+    }
+    sendAdjustWindow();
+    if (dataType == SSH2_EXTENDED_DATA_STDERR)
+    {
+        _incomingStderrData.enqueue(message);
+    }
+}
+
 void CppsshSubChannel::handleIncomingControlData(const Botan::secure_vector<Botan::byte>& buf)
 {
     _incomingControlData.enqueue(buf);
@@ -129,28 +196,33 @@ void CppsshSubChannel::setParameters(uint32_t windowSend, uint32_t txChannel, ui
     _maxPacket = maxPacket;
 }
 
+// Never sends past the window the server gave us, the rest waits for a window adjust
 bool CppsshSubChannel::flushOutgoingChannelData()
 {
     bool ret = true;
-    while (_outgoingChannelData.size() > 0)
+    for (int packets = 0; (packets < CPPSSH_FLUSH_PACKETS) && (_windowSend > 0); packets++)
     {
-        std::shared_ptr<Botan::secure_vector<Botan::byte> > message;
-        if ((_outgoingChannelData.dequeue(message, 1) == true) && (message->size() > 0))
+        if ((_pendingOut == nullptr) || (_pendingOffset >= _pendingOut->size()))
         {
-            _windowSend -= message->size();
-            Botan::secure_vector<Botan::byte> buf;
-            CppsshPacket packet(&buf);
-            packet.addByte(SSH2_MSG_CHANNEL_DATA);
-            packet.addInt(_txChannel);
-            packet.addInt(message->size());
-            packet.addVector(*message);
-            ret = _session->_transport->sendMessage(buf);
-            if (ret == false)
+            _pendingOut.reset();
+            _pendingOffset = 0;
+            if ((_outgoingChannelData.size() == 0) || (_outgoingChannelData.dequeue(_pendingOut, 1) == false) ||
+                (_pendingOut->size() == 0))
             {
                 break;
             }
         }
-        else
+        uint32_t len = std::min((uint32_t)(_pendingOut->size() - _pendingOffset), (uint32_t)_windowSend);
+        Botan::secure_vector<Botan::byte> buf;
+        CppsshPacket packet(&buf);
+        packet.addByte(SSH2_MSG_CHANNEL_DATA);
+        packet.addInt(_txChannel);
+        packet.addInt(len);
+        packet.addRawData(_pendingOut->data() + _pendingOffset, len);
+        _windowSend -= len;
+        _pendingOffset += len;
+        ret = _session->_transport->sendMessage(buf);
+        if (ret == false)
         {
             break;
         }
@@ -162,23 +234,57 @@ bool CppsshSubChannel::writeChannel(const uint8_t* data, uint32_t bytes)
 {
     uint32_t totalBytesSent = 0;
     std::shared_ptr<Botan::secure_vector<Botan::byte> > message;
-    uint32_t maxPacketSize = _maxPacket - 64;
-    while (totalBytesSent < bytes)
+    uint32_t maxPacketSize = getMaxWrite();
+    if (maxPacketSize == 0)
     {
-        uint32_t bytesSent = std::min(bytes, maxPacketSize);
+        cdLog(LogLevel::Error) << "Channel " << _channelName << " is not open.";
+    }
+    while ((totalBytesSent < bytes) && (maxPacketSize > 0))
+    {
+        uint32_t bytesSent = std::min(bytes - totalBytesSent, maxPacketSize);
         message.reset(new Botan::secure_vector<Botan::byte>());
         CppsshPacket packet(message.get());
-        packet.addRawData(data, bytesSent);
+        packet.addRawData(data + totalBytesSent, bytesSent);
         totalBytesSent += bytesSent;
         _outgoingChannelData.enqueue(message);
     }
     return (totalBytesSent == bytes);
 }
 
+bool CppsshSubChannel::writeChannel(const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message)
+{
+    bool ret = false;
+    if ((message->size() > 0) && (message->size() <= getMaxWrite()))
+    {
+        _outgoingChannelData.enqueue(message);
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Write of " << message->size() << " bytes does not fit channel " << _channelName;
+    }
+    return ret;
+}
+
+uint32_t CppsshSubChannel::getMaxWrite() const
+{
+    return (_maxPacket > 64) ? (_maxPacket - 64) : _maxPacket;
+}
+
+size_t CppsshSubChannel::getQueuedWrites()
+{
+    return _outgoingChannelData.size();
+}
+
+size_t CppsshSubChannel::getQueuedReads()
+{
+    return _incomingChannelData.size();
+}
+
 bool CppsshSubChannel::readChannel(CppsshMessage* data)
 {
     std::shared_ptr<CppsshMessage> m;
-    bool ret = _incomingChannelData.dequeue(m, 1);
+    bool ret = readChannel(&m);
     if (ret == true)
     {
         *data = *m;
@@ -186,6 +292,52 @@ bool CppsshSubChannel::readChannel(CppsshMessage* data)
     return ret;
 }
 
+bool CppsshSubChannel::readChannel(std::shared_ptr<CppsshMessage>* message)
+{
+    bool ret = _incomingChannelData.dequeue(*message, 1);
+    if (ret == true)
+    {
+        messageRead(**message);
+    }
+    return ret;
+}
+
+bool CppsshSubChannel::readStderr(CppsshMessage* data)
+{
+    std::shared_ptr<CppsshMessage> m;
+    bool ret = _incomingStderrData.dequeue(m, 1);
+    if (ret == true)
+    {
+        messageRead(*m);
+        *data = *m;
+    }
+    return ret;
+}
+
+void CppsshSubChannel::messageRead(const CppsshMessage& message)
+{
+    if (_windowOnRead == true)
+    {
+        _unread -= message.length();
+        sendAdjustWindow();
+    }
+}
+
+bool CppsshSubChannel::getExitStatus(int* exitStatus) const
+{
+    bool ret = _exitStatusReceived;
+    if (ret == true)
+    {
+        *exitStatus = _exitStatus;
+    }
+    return ret;
+}
+
+bool CppsshSubChannel::isReadable()
+{
+    return ((_remoteClosed == false) || (_incomingChannelData.size() > 0) || (_incomingStderrData.size() > 0));
+}
+
 bool CppsshSubChannel::windowChange(const uint32_t cols, const uint32_t rows)
 {
     bool ret;
@@ -212,19 +364,38 @@ bool CppsshSubChannel::handleChannelConfirm()
     }
     else
     {
-        const CppsshConstPacket packet(&buf);
+        ret = parseChannelConfirm(buf);
+    }
+    return ret;
+}
 
-        if (packet.getCommand() == SSH2_MSG_CHANNEL_OPEN_CONFIRMATION)
-        {
-            packet.skipHeader();
-            // Receive Channel
-            //uint32_t rxChannel = packet.getInt();
-            packet.getInt();
-            _txChannel = packet.getInt();
-            _windowSend = packet.getInt();
-            _maxPacket = packet.getInt();
-            ret = true;
-        }
+bool CppsshSubChannel::pollChannelConfirm(bool* confirmed)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    if ((_incomingControlData.size() > 0) && (_incomingControlData.dequeue(buf, 1) == true))
+    {
+        *confirmed = parseChannelConfirm(buf);
+        ret = true;
+    }
+    return ret;
+}
+
+bool CppsshSubChannel::parseChannelConfirm(const Botan::secure_vector<Botan::byte>& buf)
+{
+    bool ret = false;
+    const CppsshConstPacket packet(&buf);
+
+    if (packet.getCommand() == SSH2_MSG_CHANNEL_OPEN_CONFIRMATION)
+    {
+        packet.skipHeader();
+        // Receive Channel
+        //uint32_t rxChannel = packet.getInt();
+        packet.getInt();
+        _txChannel = packet.getInt();
+        _windowSend = packet.getInt();
+        _maxPacket = packet.getInt();
+        ret = true;
     }
     return ret;
 }
@@ -232,7 +403,17 @@ bool CppsshSubChannel::handleChannelConfirm()
 bool CppsshSubChannel::doChannelRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& reqdata,
                                         bool wantReply)
 {
-    bool ret = false;
+    bool ret = sendChannelRequest(req, reqdata, wantReply);
+    if ((ret == true) && (wantReply == true))
+    {
+        ret = waitChannelReply(req);
+    }
+    return ret;
+}
+
+bool CppsshSubChannel::sendChannelRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& reqdata,
+                                          bool wantReply)
+{
     Botan::secure_vector<Botan::byte> buf;
     CppsshPacket packet(&buf);
     packet.addByte(SSH2_MSG_CHANNEL_REQUEST);
@@ -241,24 +422,24 @@ bool CppsshSubChannel::doChannelRequest(const std::string& req, const Botan::sec
     packet.addByte(wantReply);// want reply == true
     packet.addVector(reqdata);
 
-    if (_session->_transport->sendMessage(buf) == true)
+    return _session->_transport->sendMessage(buf);
+}
+
+// The server answers requests in the order they were sent
+bool CppsshSubChannel::waitChannelReply(const std::string& req)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> buf;
+    CppsshPacket packet(&buf);
+
+    if ((_incomingControlData.dequeue(buf, _session->getTimeout()) == true) &&
+        (packet.getCommand() == SSH2_MSG_CHANNEL_SUCCESS))
     {
-        if (wantReply == true)
-        {
-            if ((_incomingControlData.dequeue(buf, _session->getTimeout()) == true) &&
-                (packet.getCommand() == SSH2_MSG_CHANNEL_SUCCESS))
-            {
-                ret = true;
-            }
-            else
-            {
-                cdLog(LogLevel::Error) << "Unable to send channel request: " << req;
-            }
-        }
-        else
-        {
-            ret = true;
-        }
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Unable to send channel request: " << req;
     }
     return ret;
 }
@@ -23,6 +23,8 @@
 #include "transport.h"
 #include "threadsafequeue.h"
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 class CppsshSubChannel
 {
@@ -66,31 +68,90 @@ public:
     }
 
     virtual bool doChannelRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& request, bool wantReply = true);
+    // The two halves of doChannelRequest, so several requests can be sent before waiting
+    bool sendChannelRequest(const std::string& req, const Botan::secure_vector<Botan::byte>& request, bool wantReply);
+    bool waitChannelReply(const std::string& req);
+    void sendClose();
     virtual void handleIncomingChannelData(const Botan::secure_vector<Botan::byte>& buf);
+    void handleIncomingExtendedData(const Botan::secure_vector<Botan::byte>& buf);
     virtual void handleIncomingControlData(const Botan::secure_vector<Botan::byte>& buf);
     virtual bool handleChannelConfirm();
+    // Doesn't wait, returns true once the confirmation or failure is in
+    bool pollChannelConfirm(bool* confirmed);
     void handleChannelRequest(const Botan::secure_vector<Botan::byte>& buf);
     virtual void handleEof();
     virtual void handleClose();
+    // Sends a window adjust once half the receive window is used up
     void sendAdjustWindow();
     bool flushOutgoingChannelData();
     bool writeChannel(const uint8_t* data, uint32_t bytes);
+    // Queues a buffer the caller filled, of at most getMaxWrite bytes, without copying it
+    bool writeChannel(const std::shared_ptr<Botan::secure_vector<Botan::byte> >& message);
+    uint32_t getMaxWrite() const;
+    size_t getQueuedWrites();
+    size_t getQueuedReads();
     bool readChannel(CppsshMessage* data);
+    // The next incoming message itself rather than a copy of it
+    bool readChannel(std::shared_ptr<CppsshMessage>* message);
+    void sendEof();
+    bool readStderr(CppsshMessage* data);
+    bool getExitStatus(int* exitStatus) const;
+    // Open, or closed by the server with data not read yet
+    bool isReadable();
+
+    bool isCloseSent() const
+    {
+        return _closeSent;
+    }
+
+    bool isRemoteClosed() const
+    {
+        return _remoteClosed;
+    }
+
+    bool isRemoteEof() const
+    {
+        return ((_remoteEof == true) || (_remoteClosed == true));
+    }
+
+    // Only give the server more window once the data has been read, so a slow reader holds the sender back
+    void setWindowOnRead(bool windowOnRead)
+    {
+        _windowOnRead = windowOnRead;
+    }
+
     bool windowChange(const uint32_t cols, const uint32_t rows);
     void setParameters(uint32_t windowSend, uint32_t txChannel, uint32_t maxPacket);
     void handleBanner(const std::shared_ptr<CppsshMessage>& banner);
     static uint32_t getRxWindowSize();
 
 protected:
+    void messageRead(const CppsshMessage& message);
+    bool parseChannelConfirm(const Botan::secure_vector<Botan::byte>& buf);
+
     ThreadSafeQueue<std::shared_ptr<Botan::secure_vector<Botan::byte> > > _outgoingChannelData;
     ThreadSafeQueue<std::shared_ptr<CppsshMessage> > _incomingChannelData;
+    ThreadSafeQueue<std::shared_ptr<CppsshMessage> > _incomingStderrData;
     ThreadSafeQueue<Botan::secure_vector<Botan::byte> > _incomingControlData;
 
     std::shared_ptr<CppsshSession> _session;
-    uint32_t _windowRecv;
-    uint32_t _windowSend;
+    std::atomic<uint32_t> _windowRecv;
+    // Received but not read yet, only counted with _windowOnRead
+    std::atomic<uint32_t> _unread;
+    bool _windowOnRead;
+    std::mutex _windowMutex;
+    // Grown by the rx thread, used up by the tx thread
+    std::atomic<uint32_t> _windowSend;
     uint32_t _txChannel;
     uint32_t _maxPacket;
     std::string _channelName;
+    bool _closeSent;
+    std::atomic<bool> _remoteClosed;
+    std::atomic<bool> _remoteEof;
+    std::atomic<bool> _exitStatusReceived;
+    std::atomic<int> _exitStatus;
+    // The part of a write that didn't fit in the send window yet
+    std::shared_ptr<Botan::secure_vector<Botan::byte> > _pendingOut;
+    size_t _pendingOffset;
 };
 #endif
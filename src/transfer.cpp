@@ -0,0 +1,320 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "transfer.h"
+#include "CDLogger/Logger.h"
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(WIN32)
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#endif
+
+CppsshTransfer::CppsshTransfer(const std::vector<std::shared_ptr<CppsshSftp> >& streams)
+    : _streams(streams),
+    _failed(false)
+{
+}
+
+bool CppsshTransfer::get(const std::string& remotePath, const std::string& localPath)
+{
+    _files.clear();
+    _jobs.clear();
+    _failed = false;
+    return ((planGet(remotePath, localPath) == true) && (run(true) == true) && (verify(true) == true));
+}
+
+bool CppsshTransfer::put(const std::string& localPath, const std::string& remotePath)
+{
+    _files.clear();
+    _jobs.clear();
+    _failed = false;
+    return ((planPut(localPath, remotePath) == true) && (run(false) == true) && (verify(false) == true));
+}
+
+void CppsshTransfer::getRates(std::string* rates) const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < _bytes.size(); i++)
+    {
+        if (i > 0)
+        {
+            ss << ",";
+        }
+        ss << i << "=" << ((_seconds[i] > 0) ? ((_bytes[i] / (1024.0 * 1024.0)) / _seconds[i]) : 0);
+    }
+    *rates = ss.str();
+}
+
+// Directories are created on the way, files are created empty so ranges can be written into them
+bool CppsshTransfer::planGet(const std::string& remotePath, const std::string& localPath)
+{
+    bool ret = false;
+    uint64_t size;
+    uint32_t permissions;
+    if (_streams[0]->stat(remotePath, &size, &permissions) == true)
+    {
+        if ((permissions & CPPSSH_SFTP_TYPE_MASK) == CPPSSH_SFTP_TYPE_DIR)
+        {
+            std::vector<std::pair<std::string, uint32_t> > entries;
+            ret = ((localMkdir(localPath) == true) && (_streams[0]->readDir(remotePath, &entries) == true));
+            for (size_t i = 0; (i < entries.size()) && (ret == true); i++)
+            {
+                uint32_t type = entries[i].second & CPPSSH_SFTP_TYPE_MASK;
+                if ((type == CPPSSH_SFTP_TYPE_DIR) || (type == CPPSSH_SFTP_TYPE_FILE))
+                {
+                    ret = planGet(remotePath + "/" + entries[i].first, localPath + "/" + entries[i].first);
+                }
+                else
+                {
+                    cdLog(LogLevel::Debug) << "Skipping " << remotePath << "/" << entries[i].first;
+                }
+            }
+        }
+        else
+        {
+            std::ofstream out(localPath, std::ios::binary | std::ios::trunc);
+            ret = out.is_open();
+            if (ret == true)
+            {
+                addFile(remotePath, localPath, size);
+            }
+            else
+            {
+                cdLog(LogLevel::Error) << "Unable to create " << localPath;
+            }
+        }
+    }
+    return ret;
+}
+
+bool CppsshTransfer::planPut(const std::string& localPath, const std::string& remotePath)
+{
+    bool ret = false;
+    uint64_t size;
+    uint32_t mode;
+    bool isDir;
+    if (localStat(localPath, &size, &mode, &isDir) == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to stat " << localPath;
+    }
+    else if (isDir == true)
+    {
+        std::vector<std::string> names;
+        uint64_t remoteSize;
+        uint32_t permissions;
+        // An existing directory is fine
+        ret = (((_streams[0]->stat(remotePath, &remoteSize, &permissions) == true) &&
+                ((permissions & CPPSSH_SFTP_TYPE_MASK) == CPPSSH_SFTP_TYPE_DIR)) ||
+               (_streams[0]->mkdir(remotePath, mode) == true));
+        ret = ((ret == true) && (localList(localPath, &names) == true));
+        for (size_t i = 0; (i < names.size()) && (ret == true); i++)
+        {
+            ret = planPut(localPath + "/" + names[i], remotePath + "/" + names[i]);
+        }
+    }
+    else if (_streams[0]->create(remotePath, mode) == true)
+    {
+        addFile(remotePath, localPath, size);
+        ret = true;
+    }
+    return ret;
+}
+
+void CppsshTransfer::addFile(const std::string& remotePath, const std::string& localPath, uint64_t size)
+{
+    File file;
+    file._remote = remotePath;
+    file._local = localPath;
+    file._size = size;
+    _files.push_back(file);
+    uint64_t offset = 0;
+    do
+    {
+        Job job;
+        job._remote = remotePath;
+        job._local = localPath;
+        job._offset = offset;
+        job._length = std::min(size - offset, (uint64_t)CPPSSH_TRANSFER_RANGE_SIZE);
+        _jobs.push_back(job);
+        offset += job._length;
+    } while (offset < size);
+}
+
+bool CppsshTransfer::run(bool download)
+{
+    std::vector<std::thread> threads;
+    _bytes.assign(_streams.size(), 0);
+    _seconds.assign(_streams.size(), 0);
+    for (size_t i = 0; i < _streams.size(); i++)
+    {
+        threads.push_back(std::thread(&CppsshTransfer::worker, this, i, download));
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return (_failed == false);
+}
+
+void CppsshTransfer::worker(size_t stream, bool download)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (true)
+    {
+        Job job;
+        {// new scope for mutex
+            std::unique_lock<std::mutex> lock(_mutex);
+            if ((_failed == true) || (_jobs.empty() == true))
+            {
+                break;
+            }
+            job = _jobs.front();
+            _jobs.pop_front();
+        }
+        uint64_t bytes = 0;
+        bool ok;
+        if (download == true)
+        {
+            ok = _streams[stream]->getRange(job._remote, job._local, job._offset, job._length, &bytes);
+        }
+        else
+        {
+            ok = _streams[stream]->putRange(job._local, job._remote, job._offset, job._length, &bytes);
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _bytes[stream] += bytes;
+        if ((ok == false) || (bytes != job._length))
+        {
+            cdLog(LogLevel::Error) << "Transfer of " << job._remote << " at " << job._offset << " failed, " << bytes <<
+                " of " << job._length << " bytes";
+            _failed = true;
+        }
+    }
+    _seconds[stream] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool CppsshTransfer::verify(bool download)
+{
+    bool ret = true;
+    for (const File& file : _files)
+    {
+        uint64_t size = 0;
+        uint32_t mode;
+        bool isDir;
+        bool ok;
+        if (download == true)
+        {
+            ok = localStat(file._local, &size, &mode, &isDir);
+        }
+        else
+        {
+            ok = _streams[0]->stat(file._remote, &size, &mode);
+        }
+        if ((ok == false) || (size != file._size))
+        {
+            cdLog(LogLevel::Error) << "Size of " << file._remote << " is " << size << " instead of " << file._size;
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+bool CppsshTransfer::localStat(const std::string& path, uint64_t* size, uint32_t* mode, bool* isDir)
+{
+    bool ret = false;
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0)
+    {
+        *size = st.st_size;
+        *mode = st.st_mode & 0777;
+        *isDir = ((st.st_mode & S_IFMT) == S_IFDIR);
+        ret = true;
+    }
+    return ret;
+}
+
+bool CppsshTransfer::localList(const std::string& path, std::vector<std::string>* names)
+{
+    bool ret = false;
+#if defined(WIN32)
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            std::string name(data.cFileName);
+            if ((name != ".") && (name != ".."))
+            {
+                names->push_back(name);
+            }
+        } while (FindNextFileA(find, &data) != 0);
+        FindClose(find);
+        ret = true;
+    }
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir != nullptr)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            std::string name(entry->d_name);
+            if ((name != ".") && (name != ".."))
+            {
+                names->push_back(name);
+            }
+        }
+        closedir(dir);
+        ret = true;
+    }
+#endif
+    if (ret == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to list " << path;
+    }
+    return ret;
+}
+
+bool CppsshTransfer::localMkdir(const std::string& path)
+{
+    uint64_t size;
+    uint32_t mode;
+    bool isDir = false;
+#if defined(WIN32)
+    _mkdir(path.c_str());
+#else
+    ::mkdir(path.c_str(), 0755);
+#endif
+    bool ret = ((localStat(path, &size, &mode, &isDir) == true) && (isDir == true));
+    if (ret == false)
+    {
+        cdLog(LogLevel::Error) << "Unable to create " << path;
+    }
+    return ret;
+}
@@ -0,0 +1,86 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _TRANSFER_Hxx
+#define _TRANSFER_Hxx
+
+#include "sftp.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+// Files at least this big are split into ranges of this size
+#define CPPSSH_TRANSFER_RANGE_SIZE  (8 * 1024 * 1024)
+#define CPPSSH_TRANSFER_MAX_STREAMS 64
+
+// Moves a file or a directory tree over several SFTP sessions at once, one
+// thread per session. Large files are split into ranges that the sessions
+// take in turn, so the faster ones do more. Every file is checked against
+// the size on the other end once all of it has been transferred.
+class CppsshTransfer
+{
+public:
+    CppsshTransfer(const std::vector<std::shared_ptr<CppsshSftp> >& streams);
+    CppsshTransfer(const CppsshTransfer&) = delete;
+
+    bool get(const std::string& remotePath, const std::string& localPath);
+    bool put(const std::string& localPath, const std::string& remotePath);
+    // "stream=MB/s,..." for each session of the last get or put
+    void getRates(std::string* rates) const;
+
+private:
+    class Job
+    {
+    public:
+        std::string _remote;
+        std::string _local;
+        uint64_t _offset;
+        uint64_t _length;
+    };
+
+    class File
+    {
+    public:
+        std::string _remote;
+        std::string _local;
+        uint64_t _size;
+    };
+
+    bool planGet(const std::string& remotePath, const std::string& localPath);
+    bool planPut(const std::string& localPath, const std::string& remotePath);
+    void addFile(const std::string& remotePath, const std::string& localPath, uint64_t size);
+    bool run(bool download);
+    void worker(size_t stream, bool download);
+    bool verify(bool download);
+
+    static bool localStat(const std::string& path, uint64_t* size, uint32_t* mode, bool* isDir);
+    static bool localList(const std::string& path, std::vector<std::string>* names);
+    static bool localMkdir(const std::string& path);
+
+    std::vector<std::shared_ptr<CppsshSftp> > _streams;
+    std::vector<File> _files;
+    std::deque<Job> _jobs;
+    std::vector<uint64_t> _bytes;
+    std::vector<double> _seconds;
+    bool _failed;
+    std::mutex _mutex;
+};
+
+#endif
@@ -19,14 +19,21 @@
 #include "transportcrypto.h"
 #include "crypto.h"
 #include "channel.h"
+#include "kex.h"
+#include "impl.h"
+#include "messages.h"
 #include "debug.h"
 
-CppsshTransportCrypto::CppsshTransportCrypto(const std::shared_ptr<CppsshSession>& session, SOCKET sock)
+CppsshTransportCrypto::CppsshTransportCrypto(const std::shared_ptr<CppsshSession>& session)
     : CppsshTransportThreaded(session),
-    _txSeq(3),
-    _rxSeq(3)
+    _kexInProgress(true),
+    _rekeyRequested(false),
+    _kexBytes(0),
+    _kexTime(std::chrono::steady_clock::now()),
+    _txSeq(0),
+    _rxSeq(0)
 {
-    _sock = sock;
+    CppsshImpl::getRekeyLimits(&_rekeyBytes, &_rekeySeconds);
 }
 
 CppsshTransportCrypto::~CppsshTransportCrypto()
@@ -35,55 +42,224 @@ CppsshTransportCrypto::~CppsshTransportCrypto()
     stopThreads();
 }
 
+// RFC 4253 section 7.1, between sending KEXINIT and NEWKEYS only transport
+// layer messages other than the service request/accept may be sent.
+bool CppsshTransportCrypto::isKexMessage(Botan::byte cmd)
+{
+    return ((cmd < 50) && (cmd != SSH2_MSG_SERVICE_REQUEST) && (cmd != SSH2_MSG_SERVICE_ACCEPT));
+}
+
 bool CppsshTransportCrypto::sendMessage(const Botan::secure_vector<Botan::byte>& buffer)
 {
     bool ret = true;
-    Botan::secure_vector<Botan::byte> crypted;
-    Botan::secure_vector<Botan::byte> hmac;
+    std::unique_lock<std::mutex> lock(_txMutex);
+    if ((_kexInProgress == true) && (buffer.empty() == false) && (isKexMessage(buffer[0]) == false))
+    {
+        _deferred.push_back(buffer);
+    }
+    else
+    {
+        ret = sendPacket(buffer);
+    }
+    return ret;
+}
+
+// Called with _txMutex held
+bool CppsshTransportCrypto::sendPacket(const Botan::secure_vector<Botan::byte>& buffer)
+{
+    bool ret = true;
     Botan::secure_vector<Botan::byte> buf;
-    setupMessage(buffer, &buf);
-    if (_session->_crypto->encryptPacket(&crypted, &hmac, buf.data(), buf.size(), _txSeq) == false)
+    setupMessage(buffer, &buf, _txCrypto.get());
+    if (_txCrypto != nullptr)
+    {
+        Botan::secure_vector<Botan::byte> crypted;
+        Botan::secure_vector<Botan::byte> hmac;
+        if (_txCrypto->encryptPacket(&crypted, &hmac, buf.data(), buf.size(), _txSeq) == false)
+        {
+            cdLog(LogLevel::Error) << "Failure to encrypt the payload.";
+            ret = false;
+        }
+        else
+        {
+            crypted += hmac;
+            buf.swap(crypted);
+        }
+    }
+    if ((ret == true) && (CppsshTransport::sendMessage(buf) == false))
     {
-        cdLog(LogLevel::Error) << "Failure to encrypt the payload.";
         ret = false;
     }
+    if (ret == true)
+    {
+        _txSeq++;
+        _kexBytes += buf.size();
+    }
+    return ret;
+}
+
+bool CppsshTransportCrypto::sendNewKeys(const std::shared_ptr<CppsshCrypto>& crypto)
+{
+    bool ret;
+    Botan::secure_vector<Botan::byte> newKeys;
+    CppsshPacket packet(&newKeys);
+    packet.addByte(SSH2_MSG_NEWKEYS);
+
+    {// new scope for mutex
+        std::unique_lock<std::mutex> lock(_rxKeysMutex);
+        _pendingRxCrypto = crypto;
+    }
+    _rxKeysCondition.notify_all();
+
+    std::unique_lock<std::mutex> lock(_txMutex);
+    ret = sendPacket(newKeys);
+    if (ret == true)
+    {
+        _txCrypto = crypto;
+        CppsshImpl::getRekeyLimits(&_rekeyBytes, &_rekeySeconds);
+        _kexBytes = 0;
+        _kexTime = std::chrono::steady_clock::now();
+        _kexInProgress = false;
+        for (const Botan::secure_vector<Botan::byte>& deferred : _deferred)
+        {
+            ret = sendPacket(deferred);
+            if (ret == false)
+            {
+                break;
+            }
+        }
+        _deferred.clear();
+    }
+    return ret;
+}
+
+// Everything after the server's NEWKEYS uses the new keys, so the rx thread
+// has to wait until the key exchange has made them.
+bool CppsshTransportCrypto::activateRxKeys()
+{
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_rxKeysMutex);
+    if (_rxKeysCondition.wait_for(lock, std::chrono::milliseconds(_session->getTimeout()),
+                                  [this] { return _pendingRxCrypto != nullptr; }) == true)
+    {
+        _rxCrypto = std::move(_pendingRxCrypto);
+        ret = true;
+    }
     else
     {
-        crypted += hmac;
-        if (CppsshTransport::sendMessage(crypted) == false)
+        cdLog(LogLevel::Error) << "Timeout while waiting for the new keys.";
+    }
+    return ret;
+}
+
+bool CppsshTransportCrypto::rekeyDue() const
+{
+    bool ret = false;
+    if (_kexInProgress == false)
+    {
+        if ((_rekeyBytes > 0) && (_kexBytes >= _rekeyBytes))
         {
-            ret = false;
+            ret = true;
         }
-        if (ret == true)
+        else if ((_rekeySeconds > 0) &&
+                 (std::chrono::steady_clock::now() >= (_kexTime + std::chrono::seconds(_rekeySeconds))))
         {
-            _txSeq++;
+            ret = true;
         }
     }
     return ret;
 }
 
+bool CppsshTransportCrypto::rekey()
+{
+    bool ret = false;
+    CppsshKex kex(_session);
+
+    cdLog(LogLevel::Info) << "Re-exchanging keys";
+    if ((kex.handleInit() == true) && (kex.handleKexDHReply() == true) && (kex.sendKexNewKeys() == true))
+    {
+        ret = true;
+    }
+    else
+    {
+        cdLog(LogLevel::Error) << "Key re-exchange failed.";
+        disconnect();
+    }
+    return ret;
+}
+
+void CppsshTransportCrypto::txThread()
+{
+    cdLog(LogLevel::Debug) << "starting crypto tx thread";
+    try
+    {
+        while (_running == true)
+        {
+            if ((_rekeyRequested.exchange(false) == true) ||
+                ((rekeyDue() == true) && (_kexInProgress.exchange(true) == false)))
+            {
+                if (rekey() == false)
+                {
+                    break;
+                }
+            }
+            // Channel data stays queued in the channels until the new keys are in use
+            if ((_kexInProgress == false) && (_session->_channel->flushOutgoingChannelData() == false))
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            sendKeepAlive();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        cdLog(LogLevel::Error) << "txThread exception: " << ex.what();
+        CppsshDebug::dumpStack(_session->getConnectionId());
+    }
+    cdLog(LogLevel::Debug) << "crypto tx thread done";
+}
+
 void CppsshTransportCrypto::rxThread()
 {
     cdLog(LogLevel::Debug) << "starting crypto rx thread";
     try
     {
-        Botan::secure_vector<Botan::byte> decrypted;
-        const uint32_t decryptBlockSize = _session->_crypto->getDecryptBlockSize();
-        const uint32_t macSize = _session->_crypto->getMacInLen();
         while (_running == true)
         {
             uint32_t cryptoLen = 0;
+            CppsshCrypto* crypto = _rxCrypto.get();
+            // Until the first NEWKEYS packets are in the clear and have no mac
+            const uint32_t headerLen = (crypto != nullptr) ? crypto->getDecryptHeaderLen() : sizeof(uint32_t);
+            const uint32_t macSize = (crypto != nullptr) ? crypto->getMacInLen() : 0;
 
-            if (_in.size() < decryptBlockSize)
+            if (_in.size() < headerLen)
             {
-                if (receiveMessage(&_in, decryptBlockSize) == false)
+                if (receiveMessage(&_in, headerLen) == false)
                 {
                     break;
                 }
             }
-            _session->_crypto->decryptPacket(&decrypted, _in.data(), decryptBlockSize);
-            CppsshConstPacket cpacket(&decrypted);
+            // _decrypted keeps its capacity between packets, so after the first few
+            // packets nothing on this path touches the heap.
+            if (crypto == nullptr)
+            {
+                _decrypted.assign(_in.begin(), _in.begin() + headerLen);
+            }
+            else
+            {
+                _decrypted.resize(headerLen);
+                if (crypto->decryptHeader(_decrypted.data(), _in.data(), _rxSeq) == false)
+                {
+                    break;
+                }
+            }
+            CppsshConstPacket cpacket(&_decrypted);
             cryptoLen = cpacket.getCryptoLength();
+            if (cryptoLen < headerLen)
+            {
+                cdLog(LogLevel::Error) << "Invalid packet length: " << cryptoLen;
+                break;
+            }
             if (_in.size() < cryptoLen + macSize)
             {
                 if (receiveMessage(&_in, cryptoLen + macSize) == false)
@@ -91,20 +267,39 @@ void CppsshTransportCrypto::rxThread()
                     break;
                 }
             }
-            if ((cryptoLen > decryptBlockSize) && (_in.size() >= cryptoLen))
+            if (crypto == nullptr)
             {
-                _session->_crypto->decryptPacket(&decrypted,
-                                                 _in.data() + decryptBlockSize, cryptoLen - decryptBlockSize);
+                _decrypted.assign(_in.begin(), _in.begin() + cryptoLen);
             }
-            if (computeMac(decrypted, &cryptoLen) == false)
+            else
             {
-                break;
+                _decrypted.resize(cryptoLen);
+                if (crypto->decryptPacket(_decrypted.data(), _in.data(), cryptoLen, _rxSeq) == false)
+                {
+                    break;
+                }
+                if (computeMac(crypto, _decrypted, &cryptoLen) == false)
+                {
+                    break;
+                }
             }
-            if (processIncomingData(&_in, decrypted, cryptoLen) == true)
+            if (processIncomingData(&_in, _decrypted, cryptoLen) == true)
             {
                 _rxSeq++;
+                _kexBytes += cryptoLen;
+                if (cpacket.getCommand() == SSH2_MSG_KEXINIT)
+                {
+                    // A KEXINIT outside of a key exchange is the server starting a re-exchange
+                    if (_kexInProgress.exchange(true) == false)
+                    {
+                        _rekeyRequested = true;
+                    }
+                }
+                else if ((cpacket.getCommand() == SSH2_MSG_NEWKEYS) && (activateRxKeys() == false))
+                {
+                    break;
+                }
             }
-            decrypted.clear();
         }
     }
     catch (const std::exception& ex)
@@ -116,18 +311,20 @@ void CppsshTransportCrypto::rxThread()
     cdLog(LogLevel::Debug) << "crypto rx thread done";
 }
 
-bool CppsshTransportCrypto::computeMac(const Botan::secure_vector<Botan::byte>& decrypted, uint32_t* cryptoLen)
+bool CppsshTransportCrypto::computeMac(CppsshCrypto* crypto, const Botan::secure_vector<Botan::byte>& decrypted, uint32_t* cryptoLen)
 {
     bool ret = true;
-    const uint32_t macSize = _session->_crypto->getMacInLen();
-    if (macSize > 0)
+    const uint32_t macSize = crypto->getMacInLen();
+    if ((crypto->isAeadIn() == true) || (crypto->isEtmIn() == true))
+    {
+        // The tag or encrypt-then-mac mac was verified before decrypting
+        *cryptoLen += macSize;
+    }
+    else if (macSize > 0)
     {
         if (_in.size() >= ((*cryptoLen) + macSize))
         {
-            Botan::secure_vector<Botan::byte> ourMac;
-            _session->_crypto->computeMac(&ourMac, decrypted, _rxSeq);
-
-            if (std::equal(_in.begin() + (*cryptoLen), _in.begin() + (*cryptoLen) + macSize, ourMac.begin()) == false)
+            if (crypto->verifyMac(decrypted.data(), *cryptoLen, _in.data() + (*cryptoLen), _rxSeq) == false)
             {
                 cdLog(LogLevel::Error) << "Mismatched HMACs.";
                 ret = false;
@@ -20,24 +20,56 @@
 #define _TRANSPORT_CRYPTO_Hxx
 
 #include "transportthreaded.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
+// Carries the whole connection, starting in the clear. Each key exchange
+// switches the keys in place: the tx direction once our NEWKEYS is sent and
+// the rx direction once the server's NEWKEYS is received.
 class CppsshTransportCrypto : public CppsshTransportThreaded
 {
 public:
     CppsshTransportCrypto() = delete;
-    CppsshTransportCrypto(const std::shared_ptr<CppsshSession>& session, SOCKET sock);
+    CppsshTransportCrypto(const std::shared_ptr<CppsshSession>& session);
     virtual ~CppsshTransportCrypto();
+    bool sendNewKeys(const std::shared_ptr<CppsshCrypto>& crypto) override;
 
 protected:
     virtual bool sendMessage(const Botan::secure_vector<Botan::byte>& buffer);
-    bool computeMac(const Botan::secure_vector<Botan::byte>& packet, uint32_t* cryptoLen);
+    bool computeMac(CppsshCrypto* crypto, const Botan::secure_vector<Botan::byte>& packet, uint32_t* cryptoLen);
 
 private:
     virtual void rxThread();
+    virtual void txThread();
+    bool sendPacket(const Botan::secure_vector<Botan::byte>& buffer);
+    bool activateRxKeys();
+    bool rekeyDue() const;
+    bool rekey();
+    static bool isKexMessage(Botan::byte cmd);
+
+    // Guards _txCrypto, _txSeq and _deferred
+    std::mutex _txMutex;
+    std::shared_ptr<CppsshCrypto> _txCrypto;
+    // Only used by the rx thread
+    std::shared_ptr<CppsshCrypto> _rxCrypto;
+    // Keys handed over by sendNewKeys, taken by the rx thread at the server's NEWKEYS
+    std::mutex _rxKeysMutex;
+    std::condition_variable _rxKeysCondition;
+    std::shared_ptr<CppsshCrypto> _pendingRxCrypto;
+    // Messages that may not be sent during a key exchange, sent after our NEWKEYS
+    std::vector<Botan::secure_vector<Botan::byte> > _deferred;
+    std::atomic<bool> _kexInProgress;
+    std::atomic<bool> _rekeyRequested;
+    std::atomic<uint64_t> _kexBytes;
+    std::chrono::steady_clock::time_point _kexTime;
+    uint64_t _rekeyBytes;
+    uint32_t _rekeySeconds;
 
     uint32_t _txSeq;
     uint32_t _rxSeq;
-    Botan::secure_vector<Botan::byte> _in;
+    Botan::secure_vector<Botan::byte> _decrypted;
 };
 
 #endif
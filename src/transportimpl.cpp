@@ -23,6 +23,7 @@
 #include "packet.h"
 #include "messages.h"
 #include "x11channel.h"
+#include <algorithm>
 
 #ifdef WIN32
 #define close closesocket
@@ -272,6 +273,45 @@ bool CppsshTransportImpl::receiveMessage(Botan::secure_vector<Botan::byte>* buff
     return ret;
 }
 
+bool CppsshTransportImpl::receiveVersion(std::string* version)
+{
+    bool ret = false;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    while ((ret == false) && (_running == true) &&
+           (std::chrono::steady_clock::now() < (t0 + std::chrono::milliseconds(_session->getTimeout()))))
+    {
+        Botan::secure_vector<Botan::byte>::iterator eol = std::find(_in.begin(), _in.end(), '\n');
+        if (eol == _in.end())
+        {
+            if (_in.size() > CPPSSH_MAX_VERSION_LEN)
+            {
+                cdLog(LogLevel::Error) << "Remote version line too long.";
+                break;
+            }
+            if (receiveMessage(&_in) == false)
+            {
+                break;
+            }
+        }
+        else
+        {
+            std::string line(_in.begin(), eol);
+            _in.erase(_in.begin(), eol + 1);
+            if ((line.empty() == false) && (line.back() == '\r'))
+            {
+                line.pop_back();
+            }
+            if (line.compare(0, 4, "SSH-") == 0)
+            {
+                version->assign(line);
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
 bool CppsshTransportImpl::sendMessage(const Botan::secure_vector<Botan::byte>& buffer)
 {
     int len;
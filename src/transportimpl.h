@@ -27,7 +27,10 @@
 #include <condition_variable>
 
 #define CPPSSH_MAX_PACKET_LEN 0x4000
+// RFC 4253 section 4.2, including the CR LF
+#define CPPSSH_MAX_VERSION_LEN 255
 class CppsshSession;
+class CppsshCrypto;
 
 class CppsshTransportImpl
 {
@@ -39,6 +42,9 @@ public:
     bool receiveMessage(Botan::secure_vector<Botan::byte>* buffer, size_t numBytes);
     virtual bool receiveMessage(Botan::secure_vector<Botan::byte>* buffer);
     virtual bool sendMessage(const Botan::secure_vector<Botan::byte>& buffer);
+    // Read up to and including the line that starts with "SSH-", anything the
+    // server sent after it is kept for the rx thread.
+    bool receiveVersion(std::string* version);
 
     bool establish(const std::string& host, short port);
     bool establishX11();
@@ -59,6 +65,13 @@ public:
         return false;
     }
 
+    // Send SSH2_MSG_NEWKEYS and switch to the keys in crypto, transports
+    // without encryption can't do a key exchange.
+    virtual bool sendNewKeys(const std::shared_ptr<CppsshCrypto>& /*crypto*/)
+    {
+        return false;
+    }
+
     void enableKeepAlives()
     {
         _sendKeepAlives = true;
@@ -87,6 +100,8 @@ protected:
     SOCKET _sock;
     volatile bool _running;
     bool _sendKeepAlives;
+    // Received but not yet processed
+    Botan::secure_vector<Botan::byte> _in;
     std::chrono::steady_clock::time_point _lastMsgTime;
 };
 
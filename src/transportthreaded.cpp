@@ -54,7 +54,7 @@ bool CppsshTransportThreaded::startThreads()
 }
 
 bool CppsshTransportThreaded::setupMessage(const Botan::secure_vector<Botan::byte>& buffer,
-                                           Botan::secure_vector<Botan::byte>* outBuf)
+                                           Botan::secure_vector<Botan::byte>* outBuf, const CppsshCrypto* crypto)
 {
     bool ret = true;
     size_t length = buffer.size();
@@ -62,13 +62,16 @@ bool CppsshTransportThreaded::setupMessage(const Botan::secure_vector<Botan::byt
     Botan::byte padLen;
     uint32_t packetLen;
 
-    uint32_t encryptBlockSize = _session->_crypto->getEncryptBlockSize();
+    // Before the first key exchange there is no crypto, packets are padded to 8 bytes
+    uint32_t encryptBlockSize = (crypto != nullptr) ? crypto->getEncryptBlockSize() : 0;
+    const uint32_t aadLen = (crypto != nullptr) ? crypto->getEncryptAadLen() : 0;
     if (encryptBlockSize == 0)
     {
         encryptBlockSize = 8;
     }
 
-    padLen = (Botan::byte)(3 + encryptBlockSize - ((length + 8) % encryptBlockSize));
+    // Associated data is sent in the clear, so it is not part of the block alignment
+    padLen = (Botan::byte)(3 + encryptBlockSize - ((length + 8 - aadLen) % encryptBlockSize));
     packetLen = 1 + length + padLen;
 
     out.addInt(packetLen);
@@ -85,7 +88,7 @@ bool CppsshTransportThreaded::sendMessage(const Botan::secure_vector<Botan::byte
 {
     bool ret;
     Botan::secure_vector<Botan::byte> buf;
-    setupMessage(buffer, &buf);
+    setupMessage(buffer, &buf, _session->_crypto.get());
     ret = CppsshTransport::sendMessage(buf);
     return ret;
 }
@@ -95,21 +98,20 @@ void CppsshTransportThreaded::rxThread()
     cdLog(LogLevel::Debug) << "starting rx thread";
     try
     {
-        Botan::secure_vector<Botan::byte> incoming;
         size_t size = 0;
         while (_running == true)
         {
-            if (incoming.size() < sizeof(uint32_t))
+            if (_in.size() < sizeof(uint32_t))
             {
                 size = sizeof(uint32_t);
             }
-            if (receiveMessage(&incoming, size) == true)
+            if (receiveMessage(&_in, size) == true)
             {
-                CppsshPacket packet(&incoming);
+                CppsshPacket packet(&_in);
                 size = packet.getCryptoLength();
-                if (incoming.size() >= size)
+                if (_in.size() >= size)
                 {
-                    processIncomingData(&incoming, incoming, size);
+                    processIncomingData(&_in, _in, size);
                     size = packet.getCryptoLength();
                 }
             }
@@ -0,0 +1,354 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "umac.h"
+#include "botan/loadstor.h"
+#include "botan/mem_ops.h"
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+const uint64_t P36 = 0x0000000FFFFFFFFBULL;
+const uint64_t P64 = 0xFFFFFFFFFFFFFFC5ULL;
+const uint64_t M36 = 0x0000000FFFFFFFFFULL;
+}
+
+CppsshUmac::CppsshUmac(size_t tagLen)
+    : _tagLen(tagLen),
+    _streams(tagLen / sizeof(uint32_t)),
+    _pdfValid(false),
+    _chunkLen(0),
+    _longMsg(false)
+{
+    std::fill(_nonce, _nonce + NONCE_LEN, 0);
+    resetHash();
+}
+
+std::string CppsshUmac::name() const
+{
+    return "UMAC(" + std::to_string(_tagLen * 8) + ")";
+}
+
+size_t CppsshUmac::output_length() const
+{
+    return _tagLen;
+}
+
+Botan::MessageAuthenticationCode* CppsshUmac::clone() const
+{
+    return new CppsshUmac(_tagLen);
+}
+
+void CppsshUmac::clear()
+{
+    _pdfCipher.reset();
+    _nhKey.clear();
+    _pdfValid = false;
+    resetHash();
+}
+
+Botan::Key_Length_Specification CppsshUmac::key_spec() const
+{
+    return Botan::Key_Length_Specification(KEY_LEN);
+}
+
+void CppsshUmac::resetHash()
+{
+    for (size_t i = 0; i < MAX_STREAMS; i++)
+    {
+        _nhAccum[i] = 0;
+        _polyAccum[i] = 1;
+    }
+    _chunkLen = 0;
+    _longMsg = false;
+}
+
+// RFC 4418 section 3.2.1: AES in counter mode, the index in byte 7 and a one
+// based block counter in byte 15.
+void CppsshUmac::kdf(Botan::secure_vector<Botan::byte>* out, const Botan::BlockCipher& aes, Botan::byte index,
+                     size_t len) const
+{
+    Botan::byte in[16] = {0};
+    Botan::byte block[16];
+    in[7] = index;
+    out->clear();
+    for (Botan::byte counter = 1; out->size() < len; counter++)
+    {
+        in[15] = counter;
+        aes.encrypt(in, block);
+        out->insert(out->end(), block, block + std::min<size_t>(sizeof(block), len - out->size()));
+    }
+}
+
+void CppsshUmac::key_schedule(const Botan::byte key[], size_t length)
+{
+    std::unique_ptr<Botan::BlockCipher> aes(Botan::BlockCipher::create_or_throw("AES-128"));
+    Botan::secure_vector<Botan::byte> buf;
+    aes->set_key(key, length);
+
+    kdf(&buf, *aes, 0, KEY_LEN);
+    _pdfCipher = Botan::BlockCipher::create_or_throw("AES-128");
+    _pdfCipher->set_key(buf);
+    _pdfValid = false;
+
+    // Each stream uses the NH key shifted by 16 bytes
+    kdf(&buf, *aes, 1, L1_KEY_LEN + ((_streams - 1) * 16));
+    _nhKey.resize(buf.size() / sizeof(uint32_t));
+    Botan::load_be(_nhKey.data(), buf.data(), _nhKey.size());
+
+    kdf(&buf, *aes, 2, ((8 * _streams) + 4) * sizeof(uint64_t));
+    for (size_t i = 0; i < _streams; i++)
+    {
+        _polyKey[i] = Botan::load_be<uint64_t>(buf.data() + (24 * i), 0) & 0x01FFFFFF01FFFFFFULL;
+    }
+
+    kdf(&buf, *aes, 3, ((8 * _streams) + 4) * sizeof(uint64_t));
+    for (size_t i = 0; i < _streams; i++)
+    {
+        for (size_t j = 0; j < 4; j++)
+        {
+            _ipKeys[(4 * i) + j] = Botan::load_be<uint64_t>(buf.data() + (((8 * i) + 4) * sizeof(uint64_t)), j) % P36;
+        }
+    }
+
+    kdf(&buf, *aes, 4, _streams * sizeof(uint32_t));
+    Botan::load_be(_ipTrans, buf.data(), _streams);
+    resetHash();
+}
+
+void CppsshUmac::start_msg(const Botan::byte nonce[], size_t nonceLen)
+{
+    if (nonceLen != NONCE_LEN)
+    {
+        throw Botan::Invalid_IV_Length(name(), nonceLen);
+    }
+    std::copy(nonce, nonce + NONCE_LEN, _nonce);
+}
+
+// NH over whole 32 byte blocks of the current chunk, offset is the position of
+// data within the chunk. Every stream adds (k[i] + d[i]) * (k[i + 4] + d[i + 4])
+// for i = 0..3, with the key of stream s starting 4 words further along.
+void CppsshUmac::nhUpdate(const Botan::byte* data, size_t len, size_t offset)
+{
+    const uint32_t* key = _nhKey.data() + (offset / sizeof(uint32_t));
+#if defined(__SSE2__)
+    // Four 32 bit additions per register, _mm_mul_epu32 does the even lanes
+    // and a 32 bit shift brings the odd ones down.
+    __m128i accum[MAX_STREAMS];
+    for (size_t s = 0; s < _streams; s++)
+    {
+        accum[s] = _mm_setzero_si128();
+    }
+    for (size_t pos = 0; pos < len; pos += NH_BLOCK)
+    {
+        const __m128i dlo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const __m128i dhi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + 16));
+        const uint32_t* blockKey = key + (pos / sizeof(uint32_t));
+        for (size_t s = 0; s < _streams; s++)
+        {
+            const __m128i a = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blockKey + (4 * s))), dlo);
+            const __m128i b = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blockKey + (4 * s) + 4)), dhi);
+            accum[s] = _mm_add_epi64(accum[s], _mm_mul_epu32(a, b));
+            accum[s] = _mm_add_epi64(accum[s], _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+        }
+    }
+    for (size_t s = 0; s < _streams; s++)
+    {
+        uint64_t sums[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), accum[s]);
+        _nhAccum[s] += sums[0] + sums[1];
+    }
+#else
+    for (size_t pos = 0; pos < len; pos += NH_BLOCK)
+    {
+        uint32_t d[8];
+        const uint32_t* blockKey = key + (pos / sizeof(uint32_t));
+        Botan::load_le(d, data + pos, 8);
+        for (size_t s = 0; s < _streams; s++)
+        {
+            const uint32_t* k = blockKey + (4 * s);
+            for (size_t i = 0; i < 4; i++)
+            {
+                _nhAccum[s] += (uint64_t)(uint32_t)(k[i] + d[i]) * (uint32_t)(k[i + 4] + d[i + 4]);
+            }
+        }
+    }
+#endif
+}
+
+void CppsshUmac::add_data(const Botan::byte input[], size_t length)
+{
+    while (length > 0)
+    {
+        size_t partial = _chunkLen % NH_BLOCK;
+        size_t n;
+        if (_chunkLen == L1_KEY_LEN)
+        {
+            // Only now is it known that the message is longer than this chunk
+            uint64_t l1[MAX_STREAMS];
+            l1Result(l1);
+            polyHash(l1);
+            _longMsg = true;
+            partial = 0;
+        }
+        if ((partial > 0) || (length < NH_BLOCK))
+        {
+            n = std::min(length, NH_BLOCK - partial);
+            std::copy(input, input + n, _partial + partial);
+            if ((partial + n) == NH_BLOCK)
+            {
+                nhUpdate(_partial, NH_BLOCK, _chunkLen - partial);
+            }
+        }
+        else
+        {
+            // Hash straight from the caller's buffer
+            n = std::min(length, L1_KEY_LEN - _chunkLen) & ~(NH_BLOCK - 1);
+            nhUpdate(input, n, _chunkLen);
+        }
+        _chunkLen += n;
+        input += n;
+        length -= n;
+    }
+}
+
+// Zero pad the chunk to a whole NH block (an empty message hashes one block of
+// zeros) and add the chunk length in bits.
+void CppsshUmac::l1Result(uint64_t* result)
+{
+    const size_t partial = _chunkLen % NH_BLOCK;
+    if ((partial > 0) || (_chunkLen == 0))
+    {
+        std::fill(_partial + partial, _partial + NH_BLOCK, 0);
+        nhUpdate(_partial, NH_BLOCK, _chunkLen - partial);
+    }
+    for (size_t s = 0; s < _streams; s++)
+    {
+        result[s] = _nhAccum[s] + (_chunkLen * 8);
+        _nhAccum[s] = 0;
+    }
+    _chunkLen = 0;
+}
+
+void CppsshUmac::polyHash(const uint64_t* data)
+{
+    // POLY64 modulo 2^64 - 59, values above it are split in two
+    auto poly64 = [](uint64_t cur, uint64_t key, uint64_t m) -> uint64_t
+    {
+        const uint64_t keyHi = key >> 32;
+        const uint64_t keyLo = key & 0xFFFFFFFF;
+        const uint64_t curHi = cur >> 32;
+        const uint64_t curLo = cur & 0xFFFFFFFF;
+        const uint64_t x = (keyHi * curLo) + (curHi * keyLo);
+        const uint64_t t = x << 32;
+        uint64_t ret = (((keyHi * curHi) + (x >> 32)) * 59) + (keyLo * curLo);
+        ret += t;
+        if (ret < t)
+        {
+            ret += 59;
+        }
+        ret += m;
+        if (ret < m)
+        {
+            ret += 59;
+        }
+        return ret;
+    };
+
+    for (size_t s = 0; s < _streams; s++)
+    {
+        if ((data[s] >> 32) == 0xFFFFFFFF)
+        {
+            _polyAccum[s] = poly64(_polyAccum[s], _polyKey[s], P64 - 1);
+            _polyAccum[s] = poly64(_polyAccum[s], _polyKey[s], data[s] - 59);
+        }
+        else
+        {
+            _polyAccum[s] = poly64(_polyAccum[s], _polyKey[s], data[s]);
+        }
+    }
+}
+
+uint32_t CppsshUmac::ipHash(size_t stream, uint64_t data) const
+{
+    const uint64_t* key = _ipKeys + (4 * stream);
+    uint64_t t = 0;
+    uint64_t ret;
+    t += key[0] * (uint16_t)(data >> 48);
+    t += key[1] * (uint16_t)(data >> 32);
+    t += key[2] * (uint16_t)(data >> 16);
+    t += key[3] * (uint16_t)data;
+    ret = (t & M36) + (5 * (t >> 36));
+    if (ret >= P36)
+    {
+        ret -= P36;
+    }
+    return (uint32_t)ret ^ _ipTrans[stream];
+}
+
+void CppsshUmac::final_result(Botan::byte output[])
+{
+    uint64_t l1[MAX_STREAMS];
+    Botan::byte pdfIn[16] = {0};
+    size_t index = 0;
+
+    if (_longMsg == true)
+    {
+        if (_chunkLen > 0)
+        {
+            l1Result(l1);
+            polyHash(l1);
+        }
+        for (size_t s = 0; s < _streams; s++)
+        {
+            if (_polyAccum[s] >= P64)
+            {
+                _polyAccum[s] -= P64;
+            }
+            Botan::store_be(ipHash(s, _polyAccum[s]), output + (s * sizeof(uint32_t)));
+        }
+    }
+    else
+    {
+        l1Result(l1);
+        for (size_t s = 0; s < _streams; s++)
+        {
+            Botan::store_be(ipHash(s, l1[s]), output + (s * sizeof(uint32_t)));
+        }
+    }
+    resetHash();
+
+    // With a 64 bit tag the low nonce bit picks a half of the AES block, so
+    // consecutive sequence numbers share one encryption.
+    std::copy(_nonce, _nonce + NONCE_LEN, pdfIn);
+    if (_tagLen == 8)
+    {
+        index = pdfIn[NONCE_LEN - 1] & 1;
+        pdfIn[NONCE_LEN - 1] &= ~1;
+    }
+    if ((_pdfValid == false) || (Botan::same_mem(pdfIn, _pdfNonce, sizeof(pdfIn)) == false))
+    {
+        std::copy(pdfIn, pdfIn + sizeof(pdfIn), _pdfNonce);
+        _pdfCipher->encrypt(_pdfNonce, _pdfCache);
+        _pdfValid = true;
+    }
+    Botan::xor_buf(output, _pdfCache + (index * _tagLen), _tagLen);
+}
@@ -0,0 +1,84 @@
+/*
+    cppssh - C++ ssh library
+    Copyright (C) 2015  Chris Desjardins
+    http://blog.chrisd.info cjd@chrisd.info
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _UMAC_Hxx
+#define _UMAC_Hxx
+
+#include "botan/mac.h"
+#include "botan/block_cipher.h"
+#include <memory>
+#include <vector>
+
+// UMAC as described in RFC 4418, with the 8 byte nonce handling and the
+// 64 and 128 bit tags OpenSSH uses for umac-64@openssh.com and
+// umac-128@openssh.com. The nonce is given with start() before each message.
+class CppsshUmac : public Botan::MessageAuthenticationCode
+{
+public:
+    // tagLen is 8 or 16 bytes
+    explicit CppsshUmac(size_t tagLen);
+    CppsshUmac() = delete;
+    CppsshUmac(const CppsshUmac&) = delete;
+
+    std::string name() const override;
+    size_t output_length() const override;
+    Botan::MessageAuthenticationCode* clone() const override;
+    void clear() override;
+    Botan::Key_Length_Specification key_spec() const override;
+
+    static const size_t KEY_LEN = 16;
+    static const size_t NONCE_LEN = 8;
+
+private:
+    static const size_t MAX_STREAMS = 4;
+    // The L1 (NH) key covers one 1024 byte chunk, consumed 32 bytes at a time
+    static const size_t L1_KEY_LEN = 1024;
+    static const size_t NH_BLOCK = 32;
+
+    void start_msg(const Botan::byte nonce[], size_t nonceLen) override;
+    void add_data(const Botan::byte input[], size_t length) override;
+    void final_result(Botan::byte output[]) override;
+    void key_schedule(const Botan::byte key[], size_t length) override;
+
+    void kdf(Botan::secure_vector<Botan::byte>* out, const Botan::BlockCipher& aes, Botan::byte index, size_t len) const;
+    void nhUpdate(const Botan::byte* data, size_t len, size_t offset);
+    void l1Result(uint64_t* result);
+    void polyHash(const uint64_t* data);
+    uint32_t ipHash(size_t stream, uint64_t data) const;
+    void resetHash();
+
+    const size_t _tagLen;
+    const size_t _streams;
+    std::unique_ptr<Botan::BlockCipher> _pdfCipher;
+    std::vector<uint32_t> _nhKey;
+    uint64_t _polyKey[MAX_STREAMS];
+    uint64_t _ipKeys[MAX_STREAMS * 4];
+    uint32_t _ipTrans[MAX_STREAMS];
+    Botan::byte _nonce[NONCE_LEN];
+    Botan::byte _pdfNonce[16];
+    Botan::byte _pdfCache[16];
+    bool _pdfValid;
+
+    uint64_t _nhAccum[MAX_STREAMS];
+    uint64_t _polyAccum[MAX_STREAMS];
+    Botan::byte _partial[NH_BLOCK];
+    size_t _chunkLen;
+    bool _longMsg;
+};
+
+#endif
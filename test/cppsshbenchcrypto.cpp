@@ -0,0 +1,492 @@
+#include "cppssh.h"
+#include "impl.h"
+#include "crypto.h"
+#include "session.h"
+#include "packet.h"
+#include "strtrim.h"
+#include "botan/ctr.h"
+#include "botan/cbc.h"
+#include "botan/stream_mode.h"
+#include "botan/cipher_filter.h"
+#include "botan/pipe.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_TOTAL_BYTES   (64 * 1024 * 1024)
+#define BENCH_PACKET_LEN    (CPPSSH_MAX_PACKET_LEN - 64)
+#define BENCH_MATRIX_BYTES  (1024 * 1024)
+#define BENCH_MIN_PACKETS   100
+#define BENCH_MAX_PACKETS   2000
+#define BENCH_KEX_ROUNDS    50
+#define BENCH_PREFILL_BYTES (1024 * 1024)
+#define BENCH_CTR_MIN_CHUNK 4096
+
+class BenchStats
+{
+public:
+    BenchStats()
+        : _bytes(0)
+    {
+    }
+
+    void add(size_t bytes, const std::chrono::steady_clock::duration& elapsed)
+    {
+        _bytes += bytes;
+        _ns.push_back(std::chrono::duration_cast<std::chrono::duration<double, std::nano> >(elapsed).count());
+    }
+
+    bool empty() const
+    {
+        return _ns.empty();
+    }
+
+    double mbPerSec() const
+    {
+        double total = 0;
+        for (double ns : _ns)
+        {
+            total += ns;
+        }
+        return (total > 0) ? ((_bytes / (1024.0 * 1024.0)) / (total / 1e9)) : 0;
+    }
+
+    double percentile(double p)
+    {
+        if (empty() == true)
+        {
+            return 0;
+        }
+        std::sort(_ns.begin(), _ns.end());
+        return _ns[std::min(_ns.size() - 1, (size_t)(p * _ns.size()))];
+    }
+
+    void toJson(std::ostream& out)
+    {
+        if (empty() == true)
+        {
+            out << "null";
+        }
+        else
+        {
+            out << "{\"mb_per_sec\": " << mbPerSec() << ", \"p50_ns\": " << percentile(0.5) << ", \"p90_ns\": " <<
+                percentile(0.9) << ", \"p99_ns\": " << percentile(0.99) << "}";
+        }
+    }
+
+private:
+    size_t _bytes;
+    std::vector<double> _ns;
+};
+
+double getMbPerSec(size_t bytes, const std::chrono::steady_clock::duration& elapsed)
+{
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(elapsed).count();
+    return (seconds > 0) ? ((bytes / (1024.0 * 1024.0)) / seconds) : 0;
+}
+
+std::vector<std::string> getAlgoList(const std::string& algos)
+{
+    std::vector<std::string> list;
+    StrTrim::split(algos, ',', list);
+    return list;
+}
+
+// Give the crypto object real session keys without a server by running
+// the DH exchange against its own public value. The keys are built in
+// loopback so that the object can decrypt its own packets.
+bool setupCrypto(const std::shared_ptr<CppsshSession>& session, CppsshCrypto* crypto, cryptoMethods cipher, macMethods mac)
+{
+    bool ret = false;
+    Botan::secure_vector<Botan::byte> publicKey;
+    Botan::secure_vector<Botan::byte> k;
+    Botan::secure_vector<Botan::byte> h;
+
+    if ((crypto->setNegotiatedKex(kexMethods::DIFFIE_HELLMAN_GROUP14_SHA1) == true) &&
+        (crypto->getKexPublic(&publicKey) == true) &&
+        (crypto->makeKexSecret(&k, publicKey) == true) &&
+        (crypto->computeH(&h, k) == true))
+    {
+        session->setSessionID(h);
+        ret = ((crypto->setNegotiatedCryptoC2s(cipher) == true) &&
+               (crypto->setNegotiatedCryptoS2c(cipher) == true) &&
+               (crypto->setNegotiatedMacC2s(mac) == true) &&
+               (crypto->setNegotiatedMacS2c(mac) == true) &&
+               (crypto->makeLoopbackKeys() == true));
+    }
+    return ret;
+}
+
+// Encrypt the way the library did before the bulk path: one pipe message
+// per cipher block, and a new IV for every CTR block.
+double runPerBlock(const std::string& botanName, bool ctr)
+{
+    std::unique_ptr<Botan::BlockCipher> blockCipher(Botan::BlockCipher::create(botanName));
+    if (blockCipher == nullptr)
+    {
+        return 0;
+    }
+    const size_t blockSize = blockCipher->block_size();
+    Botan::secure_vector<Botan::byte> nonce(blockSize);
+    CppsshImpl::RNG->randomize(nonce.data(), nonce.size());
+    Botan::SymmetricKey key(*CppsshImpl::RNG, blockCipher->key_spec().maximum_keylength());
+    Botan::Keyed_Filter* filter;
+    if (ctr == true)
+    {
+        filter = new Botan::Transformation_Filter(new Botan::Stream_Cipher_Mode(new Botan::CTR_BE(blockCipher->clone())));
+    }
+    else
+    {
+        filter = new Botan::Transformation_Filter(new Botan::CBC_Encryption(blockCipher->clone(), new Botan::Null_Padding));
+    }
+    filter->set_key(key);
+    filter->set_iv(Botan::InitializationVector(nonce));
+    Botan::Pipe pipe(filter);
+
+    Botan::secure_vector<Botan::byte> plain(BENCH_PACKET_LEN - (BENCH_PACKET_LEN % blockSize));
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    size_t total = 0;
+    while (total < BENCH_TOTAL_BYTES)
+    {
+        Botan::secure_vector<Botan::byte> encrypted;
+        for (size_t i = 0; i < plain.size(); i += blockSize)
+        {
+            pipe.process_msg(plain.data() + i, blockSize);
+            encrypted += pipe.read_all(pipe.message_count() - 1);
+            if (ctr == true)
+            {
+                for (int n = nonce.size() - 1; n >= 0; n--)
+                {
+                    if ((nonce[n] = (nonce[n] + 1)) != 0)
+                    {
+                        break;
+                    }
+                }
+                filter->set_iv(Botan::InitializationVector(nonce));
+            }
+        }
+        total += plain.size();
+    }
+    return getMbPerSec(total, std::chrono::steady_clock::now() - t0);
+}
+
+double runBulk(CppsshCrypto* crypto)
+{
+    const uint32_t blockSize = crypto->getEncryptBlockSize();
+    const uint32_t aadLen = crypto->getEncryptAadLen();
+    Botan::secure_vector<Botan::byte> plain(BENCH_PACKET_LEN - (BENCH_PACKET_LEN % blockSize) + aadLen);
+    Botan::secure_vector<Botan::byte> encrypted;
+    Botan::secure_vector<Botan::byte> hmac;
+    uint32_t seq = 0;
+    size_t total = 0;
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (total < BENCH_TOTAL_BYTES)
+    {
+        encrypted.clear();
+        if (crypto->encryptPacket(&encrypted, &hmac, plain.data(), plain.size(), seq++) == false)
+        {
+            return 0;
+        }
+        total += plain.size();
+    }
+    return getMbPerSec(total, std::chrono::steady_clock::now() - t0);
+}
+
+void runCipherBench()
+{
+    std::string ciphers;
+    CppsshImpl::CIPHER_ALGORITHMS.toString(&ciphers);
+
+    std::cout << std::left << std::setw(32) << "cipher" << std::right << std::setw(16) << "per-block MB/s" <<
+        std::setw(12) << "bulk MB/s" << std::setw(10) << "speedup" << std::endl;
+    for (const std::string& sshName : getAlgoList(ciphers))
+    {
+        cryptoMethods cipher;
+        std::shared_ptr<CppsshSession> session(new CppsshSession(0, 1000));
+        CppsshCrypto crypto(session);
+        if ((CppsshImpl::CIPHER_ALGORITHMS.ssh2enum(sshName, &cipher) == false) ||
+            (setupCrypto(session, &crypto, cipher, macMethods::HMAC_NONE) == false))
+        {
+            std::cout << std::left << std::setw(32) << sshName << "unable to set up cipher" << std::endl;
+            continue;
+        }
+        bool ctr = (sshName.find("-ctr") != std::string::npos);
+        double perBlock = 0;
+        // There was no per-block implementation of the AEAD ciphers to compare against
+        if (CppsshCrypto::isAead(cipher) == false)
+        {
+            perBlock = runPerBlock(CppsshImpl::CIPHER_ALGORITHMS.enum2botan(cipher), ctr);
+        }
+        double bulk = runBulk(&crypto);
+        std::cout << std::left << std::setw(32) << sshName << std::right << std::fixed << std::setprecision(1) <<
+            std::setw(16) << perBlock << std::setw(12) << bulk << std::setw(9) <<
+            ((perBlock > 0) ? (bulk / perBlock) : 0) << "x" << std::endl;
+    }
+}
+
+// The aes*-ctr ciphers with the keystream prefill and the parallel CTR pool.
+// Packets are at most CPPSSH_MAX_PACKET_LEN, so the pool never gets ranges
+// larger than that divided by the thread count.
+void runCtrModeBench(std::ostream& json)
+{
+    class CtrMode
+    {
+    public:
+        const char* _name;
+        size_t _prefill;
+        unsigned int _threads;
+    };
+    const CtrMode modes[] =
+    {
+        { "plain", 0, 0 },
+        { "prefill", BENCH_PREFILL_BYTES, 0 },
+        { "parallel x2", 0, 2 },
+        { "parallel x4", 0, 4 }
+    };
+    std::string ciphers;
+    bool first = true;
+
+    CppsshImpl::CIPHER_ALGORITHMS.toString(&ciphers);
+    std::cout << std::endl << std::left << std::setw(32) << "cipher" << std::setw(16) << "ctr mode" << std::right <<
+        std::setw(12) << "MB/s" << std::setw(10) << "speedup" << std::endl;
+    json << "\"ctr_modes\": [";
+    for (const std::string& sshName : getAlgoList(ciphers))
+    {
+        cryptoMethods cipher;
+        if ((sshName.find("-ctr") == std::string::npos) ||
+            (CppsshImpl::CIPHER_ALGORITHMS.ssh2enum(sshName, &cipher) == false))
+        {
+            continue;
+        }
+        double plain = 0;
+        for (const CtrMode& mode : modes)
+        {
+            std::shared_ptr<CppsshSession> session(new CppsshSession(0, 1000));
+            double mbPerSec = 0;
+            Cppssh::setCtrKeystreamPrefill(mode._prefill, false);
+            Cppssh::setParallelCtr(mode._threads, BENCH_CTR_MIN_CHUNK);
+            {
+                CppsshCrypto crypto(session);
+                if (setupCrypto(session, &crypto, cipher, macMethods::HMAC_NONE) == true)
+                {
+                    mbPerSec = runBulk(&crypto);
+                }
+            }
+            if (plain == 0)
+            {
+                plain = mbPerSec;
+            }
+            std::cout << std::left << std::setw(32) << sshName << std::setw(16) << mode._name << std::right <<
+                std::fixed << std::setprecision(1) << std::setw(12) << mbPerSec << std::setw(9) <<
+                ((plain > 0) ? (mbPerSec / plain) : 0) << "x" << std::endl;
+            json << ((first == true) ? "" : ",") << "\n  {\"cipher\": \"" << sshName << "\", \"mode\": \"" <<
+                mode._name << "\", \"mb_per_sec\": " << mbPerSec << "}";
+            first = false;
+        }
+    }
+    Cppssh::setCtrKeystreamPrefill(0, false);
+    Cppssh::setParallelCtr(0, 0);
+    json << "\n]";
+}
+
+// Encrypt a run of packets of one size, then decrypt and verify them in order
+// the way the transport's rx thread does, timing each call.
+bool runPacketSize(CppsshCrypto* crypto, size_t size, BenchStats* encrypt, BenchStats* decrypt, BenchStats* mac)
+{
+    const uint32_t blockSize = crypto->getEncryptBlockSize();
+    const uint32_t aadLen = crypto->getEncryptAadLen();
+    const uint32_t macLen = crypto->getMacInLen();
+    const uint32_t len = size - ((size - aadLen) % blockSize);
+    const size_t packets = std::min<size_t>(std::max<size_t>(BENCH_MATRIX_BYTES / len, BENCH_MIN_PACKETS), BENCH_MAX_PACKETS);
+    Botan::secure_vector<Botan::byte> plain;
+    Botan::secure_vector<Botan::byte> payload(len - sizeof(uint32_t));
+    std::vector<Botan::secure_vector<Botan::byte> > encrypted(packets);
+    Botan::secure_vector<Botan::byte> hmac;
+    Botan::secure_vector<Botan::byte> decrypted(len);
+    CppsshPacket plainPacket(&plain);
+    bool ret = true;
+
+    // A well formed length field followed by random data
+    CppsshImpl::RNG->randomize(payload.data(), payload.size());
+    plainPacket.addInt(len - sizeof(uint32_t));
+    plainPacket.addVector(payload);
+    for (uint32_t seq = 0; (seq < packets) && (ret == true); seq++)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        ret = crypto->encryptPacket(&encrypted[seq], &hmac, plain.data(), plain.size(), seq);
+        encrypt->add(len, std::chrono::steady_clock::now() - t0);
+        encrypted[seq] += hmac;
+    }
+    for (uint32_t seq = 0; (seq < packets) && (ret == true); seq++)
+    {
+        const Botan::byte* in = encrypted[seq].data();
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        ret = ((crypto->decryptHeader(decrypted.data(), in, seq) == true) &&
+               (crypto->decryptPacket(decrypted.data(), in, len, seq) == true));
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        if ((ret == true) && (macLen > 0) && (crypto->isAeadIn() == false) && (crypto->isEtmIn() == false))
+        {
+            ret = crypto->verifyMac(decrypted.data(), len, in + len, seq);
+            mac->add(len, std::chrono::steady_clock::now() - t1);
+        }
+        decrypt->add(len, std::chrono::steady_clock::now() - t0);
+    }
+    return ret;
+}
+
+void runMatrixBench(std::ostream& json)
+{
+    std::string ciphers;
+    std::string macs;
+    std::vector<size_t> sizes;
+    bool first = true;
+
+    CppsshImpl::CIPHER_ALGORITHMS.toString(&ciphers);
+    CppsshImpl::MAC_ALGORITHMS.toString(&macs);
+    for (size_t size = 64; size < CPPSSH_MAX_PACKET_LEN; size *= 4)
+    {
+        sizes.push_back(size);
+    }
+    sizes.push_back(CPPSSH_MAX_PACKET_LEN);
+
+    std::cout << std::endl << std::left << std::setw(32) << "cipher" << std::setw(32) << "mac" << std::right <<
+        std::setw(8) << "size" << std::setw(12) << "enc MB/s" << std::setw(12) << "dec MB/s" << std::setw(12) <<
+        "mac MB/s" << std::setw(12) << "enc p99 ns" << std::endl;
+    json << "\"results\": [";
+    for (const std::string& cipherName : getAlgoList(ciphers))
+    {
+        for (const std::string& macName : getAlgoList(macs))
+        {
+            cryptoMethods cipher;
+            macMethods mac;
+            if ((CppsshImpl::CIPHER_ALGORITHMS.ssh2enum(cipherName, &cipher) == false) ||
+                (CppsshImpl::MAC_ALGORITHMS.ssh2enum(macName, &mac) == false))
+            {
+                continue;
+            }
+            // AEAD ciphers ignore the negotiated mac, so they are only measured once
+            if ((CppsshCrypto::isAead(cipher) == true) && (macName != macs.substr(0, macs.find(','))))
+            {
+                continue;
+            }
+            const std::string reportedMac = (CppsshCrypto::isAead(cipher) == true) ? "aead" : macName;
+            for (size_t size : sizes)
+            {
+                std::shared_ptr<CppsshSession> session(new CppsshSession(0, 1000));
+                CppsshCrypto crypto(session);
+                BenchStats encrypt;
+                BenchStats decrypt;
+                BenchStats macStats;
+                if ((setupCrypto(session, &crypto, cipher, mac) == false) ||
+                    (runPacketSize(&crypto, size, &encrypt, &decrypt, &macStats) == false))
+                {
+                    std::cout << std::left << std::setw(32) << cipherName << std::setw(32) << reportedMac <<
+                        "failed" << std::endl;
+                    continue;
+                }
+                std::cout << std::left << std::setw(32) << cipherName << std::setw(32) << reportedMac << std::right <<
+                    std::fixed << std::setprecision(1) << std::setw(8) << size << std::setw(12) << encrypt.mbPerSec() <<
+                    std::setw(12) << decrypt.mbPerSec() << std::setw(12) << macStats.mbPerSec() << std::setw(12) <<
+                    encrypt.percentile(0.99) << std::endl;
+                json << ((first == true) ? "" : ",") << "\n  {\"cipher\": \"" << cipherName << "\", \"mac\": \"" <<
+                    reportedMac << "\", \"size\": " << size << ", \"encrypt\": ";
+                encrypt.toJson(json);
+                json << ", \"decrypt\": ";
+                decrypt.toJson(json);
+                json << ", \"mac\": ";
+                macStats.toJson(json);
+                json << "}";
+                first = false;
+            }
+        }
+    }
+    json << "\n]";
+}
+
+// The client half of each key exchange method against a second crypto object
+// playing the server: generate our key, then derive the secret from theirs.
+// The host key signature is the same for every method and is not included.
+void runKexBench(std::ostream& json)
+{
+    std::string kexs;
+    bool first = true;
+
+    CppsshImpl::KEX_ALGORITHMS.toString(&kexs);
+    std::cout << std::endl << std::left << std::setw(32) << "kex" << std::right << std::setw(16) << "handshakes/s" <<
+        std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::endl;
+    json << "\"kex\": [";
+    for (const std::string& kexName : getAlgoList(kexs))
+    {
+        kexMethods kex;
+        std::shared_ptr<CppsshSession> clientSession(new CppsshSession(0, 1000));
+        std::shared_ptr<CppsshSession> serverSession(new CppsshSession(0, 1000));
+        CppsshCrypto client(clientSession);
+        CppsshCrypto server(serverSession);
+        BenchStats stats;
+        bool ok = ((CppsshImpl::KEX_ALGORITHMS.ssh2enum(kexName, &kex) == true) &&
+                   (client.setNegotiatedKex(kex) == true) && (server.setNegotiatedKex(kex) == true));
+
+        for (size_t i = 0; (i < BENCH_KEX_ROUNDS) && (ok == true); i++)
+        {
+            Botan::secure_vector<Botan::byte> e;
+            Botan::secure_vector<Botan::byte> f;
+            Botan::secure_vector<Botan::byte> clientK;
+            Botan::secure_vector<Botan::byte> serverK;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ok = (client.getKexPublic(&e) == true);
+            std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+            ok = ((ok == true) && (server.getKexPublic(&f) == true) && (server.makeKexSecret(&serverK, e) == true));
+            start = std::chrono::steady_clock::now();
+            ok = ((ok == true) && (client.makeKexSecret(&clientK, f) == true));
+            elapsed += std::chrono::steady_clock::now() - start;
+            ok = ((ok == true) && (clientK == serverK));
+            stats.add(0, elapsed);
+        }
+        if (ok == false)
+        {
+            std::cout << std::left << std::setw(32) << kexName << "failed" << std::endl;
+            continue;
+        }
+        const double p50 = stats.percentile(0.5);
+        const double p99 = stats.percentile(0.99);
+        std::cout << std::left << std::setw(32) << kexName << std::right << std::fixed << std::setprecision(1) <<
+            std::setw(16) << ((p50 > 0) ? (1e9 / p50) : 0) << std::setw(12) << (p50 / 1000) << std::setw(12) <<
+            (p99 / 1000) << std::endl;
+        json << ((first == true) ? "" : ",") << "\n  {\"kex\": \"" << kexName << "\", \"p50_ns\": " << p50 <<
+            ", \"p90_ns\": " << stats.percentile(0.9) << ", \"p99_ns\": " << p99 << "}";
+        first = false;
+    }
+    json << "\n]";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        std::cerr << "Syntax: " << argv[0] << " [json output file]" << std::endl;
+        return -1;
+    }
+    Cppssh::create();
+    try
+    {
+        std::ofstream json((argc > 1) ? argv[1] : "cppsshbenchcrypto.json");
+        runCipherBench();
+        json << "{";
+        runMatrixBench(json);
+        json << ",\n";
+        runCtrModeBench(json);
+        json << ",\n";
+        runKexBench(json);
+        json << "}" << std::endl;
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+    }
+    Cppssh::destroy();
+    return 0;
+}
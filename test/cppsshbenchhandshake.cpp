@@ -0,0 +1,133 @@
+#include "cppssh.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define close closesocket
+#else
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_HANDSHAKE_ROUNDS 10
+#define BENCH_TIMEOUT_MS       10000
+#define BENCH_SSH_PORT         22
+
+static double median(std::vector<double> samples)
+{
+    double ret = 0;
+    if (samples.empty() == false)
+    {
+        std::sort(samples.begin(), samples.end());
+        ret = samples[samples.size() / 2];
+    }
+    return ret;
+}
+
+// A bare TCP connect takes one round trip, which is the unit the handshake is measured in
+static double measureRtt(const std::string& hostname, short port, int rounds)
+{
+    std::vector<double> samples;
+    addrinfo hints;
+    addrinfo* addrs = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostname.c_str(), std::to_string(port).c_str(), &hints, &addrs) == 0)
+    {
+        for (int i = 0; i < rounds; i++)
+        {
+            int sock = (int)socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+            if (sock >= 0)
+            {
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                if (connect(sock, addrs->ai_addr, (int)addrs->ai_addrlen) == 0)
+                {
+                    samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+                }
+                close(sock);
+            }
+        }
+        freeaddrinfo(addrs);
+    }
+    return median(samples);
+}
+
+// Connect and authenticate without a shell, which is where the handshake round trips are
+static double measureConnect(const std::string& hostname, short port, const std::string& username,
+                             const std::string& password, const char* keyfile, int rounds, bool pipeline, bool guess)
+{
+    std::vector<double> samples;
+    Cppssh::setKexPipeline(pipeline);
+    Cppssh::setKexGuess(guess);
+    for (int i = 0; i < rounds; i++)
+    {
+        int channel;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        if (Cppssh::connect(&channel, hostname.c_str(), port, username.c_str(), keyfile, password.c_str(),
+                            BENCH_TIMEOUT_MS, false, false, nullptr) == CPPSSH_CONNECT_OK)
+        {
+            samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+        else
+        {
+            std::cerr << "Did not connect " << channel << std::endl;
+        }
+        Cppssh::close(channel);
+    }
+    return median(samples);
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc < 4) || (argc > 7))
+    {
+        std::cerr << "Syntax: " << argv[0] << " <hostname> <username> <password> [rounds] [key] [port]" << std::endl;
+        return -1;
+    }
+    Cppssh::create();
+    try
+    {
+        std::string hostname(argv[1]);
+        std::string username(argv[2]);
+        std::string password(argv[3]);
+        int rounds = (argc > 4) ? std::stoi(argv[4]) : BENCH_HANDSHAKE_ROUNDS;
+        const char* keyfile = ((argc > 5) && (strlen(argv[5]) > 0)) ? argv[5] : nullptr;
+        short port = (argc > 6) ? (short)std::stoi(argv[6]) : BENCH_SSH_PORT;
+
+        double rtt = measureRtt(hostname, port, rounds);
+        double serial = measureConnect(hostname, port, username, password, keyfile, rounds, false, false);
+        double pipelined = measureConnect(hostname, port, username, password, keyfile, rounds, true, false);
+        double guessed = measureConnect(hostname, port, username, password, keyfile, rounds, true, true);
+
+        std::cout << std::left << std::setw(32) << "handshake" << std::right << std::setw(16) << "median ms" <<
+            std::setw(16) << "RTTs" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << std::left << std::setw(32) << "tcp connect" << std::right << std::setw(16) << rtt <<
+            std::setw(16) << 1.0 << std::endl;
+        std::cout << std::left << std::setw(32) << "serial version, kexinit" << std::right << std::setw(16) << serial <<
+            std::setw(16) << ((rtt > 0) ? (serial / rtt) : 0) << std::endl;
+        std::cout << std::left << std::setw(32) << "pipelined kexinit" << std::right << std::setw(16) << pipelined <<
+            std::setw(16) << ((rtt > 0) ? (pipelined / rtt) : 0) << std::endl;
+        std::cout << std::left << std::setw(32) << "pipelined kexinit + guess" << std::right << std::setw(16) <<
+            guessed << std::setw(16) << ((rtt > 0) ? (guessed / rtt) : 0) << std::endl;
+        if (rtt > 0)
+        {
+            std::cout << "RTTs saved by pipelining the kexinit: " << ((serial - pipelined) / rtt) << std::endl;
+            std::cout << "RTTs saved by the guessed kex packet: " << ((pipelined - guessed) / rtt) << std::endl;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+    }
+    Cppssh::destroy();
+    return 0;
+}
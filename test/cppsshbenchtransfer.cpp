@@ -0,0 +1,89 @@
+#include "cppssh.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+
+#define BENCH_TRANSFER_STREAMS 4
+#define BENCH_TIMEOUT_MS       10000
+
+// Download remotePath once per layout, from a single stream up to several connections
+static void runLayout(const std::vector<int>& connections, size_t usedConnections, size_t streamsPerConnection,
+                      const std::string& remotePath, const std::string& localPath, uint64_t size)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    bool ok = Cppssh::transferGet(connections.data(), usedConnections, streamsPerConnection, remotePath.c_str(),
+                                  localPath.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::string label(std::to_string(usedConnections) + " conn x " + std::to_string(streamsPerConnection) + " chan");
+    std::cout << std::left << std::setw(24) << label << std::right << std::setw(12);
+    if (ok == true)
+    {
+        std::vector<char> rates(Cppssh::getTransferRates(nullptr) + 1);
+        Cppssh::getTransferRates(rates.data());
+        std::cout << ((size / (1024.0 * 1024.0)) / seconds) << "  " << rates.data() << std::endl;
+    }
+    else
+    {
+        std::cout << "failed" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc < 5) || (argc > 7))
+    {
+        std::cerr << "Syntax: " << argv[0] << " <hostname> <username> <password> <remote file> [streams] [key]" << std::endl;
+        return -1;
+    }
+    Cppssh::create();
+    try
+    {
+        std::string hostname(argv[1]);
+        std::string username(argv[2]);
+        std::string password(argv[3]);
+        std::string remotePath(argv[4]);
+        size_t streams = (argc > 5) ? std::stoul(argv[5]) : BENCH_TRANSFER_STREAMS;
+        const char* keyfile = (argc > 6) ? argv[6] : nullptr;
+        std::string localPath("cppsshbenchtransfer.out");
+        std::vector<int> connections;
+        uint64_t size = 0;
+
+        for (size_t i = 0; i < streams; i++)
+        {
+            int connection;
+            if (Cppssh::connect(&connection, hostname.c_str(), 22, username.c_str(), keyfile, password.c_str(),
+                                BENCH_TIMEOUT_MS, false, false, nullptr) == CPPSSH_CONNECT_OK)
+            {
+                connections.push_back(connection);
+            }
+        }
+        int sftp;
+        if ((connections.size() == streams) && (Cppssh::sftpOpen(connections[0], &sftp) == true))
+        {
+            Cppssh::sftpGetFileSize(sftp, remotePath.c_str(), &size);
+            Cppssh::close(sftp);
+            std::cout << std::fixed << std::setprecision(1);
+            std::cout << std::left << std::setw(24) << "layout" << std::right << std::setw(12) << "MB/s" <<
+                "  per stream MB/s" << std::endl;
+            runLayout(connections, 1, 1, remotePath, localPath, size);
+            runLayout(connections, 1, streams, remotePath, localPath, size);
+            runLayout(connections, streams, 1, remotePath, localPath, size);
+        }
+        else
+        {
+            std::cerr << "Did not connect" << std::endl;
+        }
+        for (int connection : connections)
+        {
+            Cppssh::close(connection);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+    }
+    Cppssh::destroy();
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "umac.h"
+#include "botan/hex.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The test vectors of RFC 4418 appendix A: the key "abcdefghijklmnop", the
+// nonce "bcdefghi" and messages of 'a' repeated. The RFC lists UMAC-32/64/96,
+// UMAC-128 is checked against the UMAC-96 tag, which its first 12 bytes are.
+class UmacVector
+{
+public:
+    size_t _len;
+    const char* _umac64;
+    const char* _umac96;
+};
+
+bool checkTag(CppsshUmac* umac, const UmacVector& vector, const std::string& expected)
+{
+    const std::string key("abcdefghijklmnop");
+    const std::string nonce("bcdefghi");
+    const std::vector<Botan::byte> message(vector._len, 'a');
+
+    umac->set_key((const Botan::byte*)key.data(), key.size());
+    umac->start((const Botan::byte*)nonce.data(), nonce.size());
+    umac->update(message.data(), message.size());
+    std::string tag = Botan::hex_encode(umac->final()).substr(0, expected.size());
+    bool ret = (tag == expected);
+    std::cout << umac->name() << " 'a' * " << vector._len << ": " << tag << ((ret == true) ? " ok" : " expected " + expected) <<
+        std::endl;
+    return ret;
+}
+
+int main()
+{
+    const UmacVector vectors[] =
+    {
+        { 0, "6E155FAD26900BE1", "32FEDB100C79AD58F07FF764" },
+        { 3, "44B5CB542F220104", "185E4FE905CBA7BD85E4C2DC" },
+        { 1024, "26BF2F5D60118BD9", "7A54ABE04AF82D60FB298C3C" },
+        { 32768, "27F8EF643B0D118D", "7B136BD911E4B734286EF2BE" }
+    };
+    int failed = 0;
+    try
+    {
+        CppsshUmac umac64(8);
+        CppsshUmac umac128(16);
+        for (const UmacVector& vector : vectors)
+        {
+            if (checkTag(&umac64, vector, vector._umac64) == false)
+            {
+                failed++;
+            }
+            if (checkTag(&umac128, vector, vector._umac96) == false)
+            {
+                failed++;
+            }
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        failed++;
+    }
+    std::cout << ((failed == 0) ? "OK" : "FAILED") << std::endl;
+    return failed;
+}
@@ -11,6 +11,9 @@ class TestAlgos(unittest.TestCase):
         "aes128-ctr",
         "aes192-ctr",
         "aes256-ctr",
+        "aes128-gcm@openssh.com",
+        "aes256-gcm@openssh.com",
+        "chacha20-poly1305@openssh.com",
         #"twofish-cbc",
         #"twofish256-cbc",
         "blowfish-cbc",
@@ -22,6 +25,12 @@ class TestAlgos(unittest.TestCase):
         "hmac-sha1",
         #"hmac-sha2-512",
         "hmac-sha2-256",
+        "hmac-sha1-etm@openssh.com",
+        "hmac-sha2-256-etm@openssh.com",
+        "umac-64@openssh.com",
+        "umac-128@openssh.com",
+        "umac-64-etm@openssh.com",
+        "umac-128-etm@openssh.com",
         "none"
     ]
     keys = [
@@ -41,7 +50,9 @@ class TestAlgos(unittest.TestCase):
         "Hostkey algos",
         " agreed on: ",
         "Authenticated with",
-        "Remote version: "
+        "Remote version: ",
+        "Extension ",
+        "Kex guess "
     ]
     testoutputIgnores = [
         "Last login:",